@@ -0,0 +1,131 @@
+package main
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io"
+	"net"
+	"os"
+	"strings"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// binaryOutput selects the records of package stream over text lines.
+var binaryOutput bool
+
+// openOutput opens the destination of the events: "-" for stdout or
+// "unix:PATH" for a Unix stream socket a collector listens on.
+func openOutput(dest string) (io.WriteCloser, error) {
+	if dest == "-" {
+		return os.Stdout, nil
+	}
+	if strings.HasPrefix(dest, "unix:") {
+		conn, err := net.Dial("unix", strings.TrimPrefix(dest, "unix:"))
+		if err != nil {
+			return nil, fmt.Errorf("failed to connect to the output socket: %v", err)
+		}
+		return conn, nil
+	}
+	return nil, fmt.Errorf("invalid output %q, expected - or unix:PATH", dest)
+}
+
+// readyOutput returns where Ready. is printed: stdout along with text
+// lines, stderr when the output is binary, to keep it out of the stream.
+func readyOutput() io.Writer {
+	if binaryOutput {
+		return os.Stderr
+	}
+	return os.Stdout
+}
+
+// putHost32 and putHost64 store v in host byte order like
+// tracer.ByteOrder, but through the concrete types: dst passed to the
+// interface would escape, and the records with it, once per event.
+func putHost32(dst []byte, v uint32) {
+	if tracer.ByteOrder == binary.ByteOrder(binary.LittleEndian) {
+		binary.LittleEndian.PutUint32(dst, v)
+	} else {
+		binary.BigEndian.PutUint32(dst, v)
+	}
+}
+
+func putHost64(dst []byte, v uint64) {
+	if tracer.ByteOrder == binary.ByteOrder(binary.LittleEndian) {
+		binary.LittleEndian.PutUint64(dst, v)
+	} else {
+		binary.BigEndian.PutUint64(dst, v)
+	}
+}
+
+func encodeTCPEventV4(buf, data []byte) ([]byte, uint64, uint32, error) {
+	var event tracer.TCPEventV4
+	if err := tracer.DecodeTCPEventV4(data, &event); err != nil {
+		return buf, 0, 0, err
+	}
+
+	r := stream.TCPEventV4{
+		Timestamp: event.Timestamp,
+		CPU:       event.Cpu,
+		Type:      event.Type,
+		Pid:       event.Pid,
+		Comm:      event.Comm,
+		SPort:     event.SPort,
+		DPort:     event.DPort,
+		NetNS:     event.NetNS,
+		Weight:    event.Weight,
+	}
+	// back to the bytes the kernel read, i.e. network order
+	putHost32(r.SAddr[:], event.SAddr)
+	putHost32(r.DAddr[:], event.DAddr)
+	return stream.AppendTCPEventV4(buf, &r, 0), event.Timestamp, event.Weight, nil
+}
+
+func encodeTCPEventV6(buf, data []byte) ([]byte, uint64, uint32, error) {
+	var event tracer.TCPEventV6
+	if err := tracer.DecodeTCPEventV6(data, &event); err != nil {
+		return buf, 0, 0, err
+	}
+
+	r := stream.TCPEventV6{
+		Timestamp: event.Timestamp,
+		CPU:       event.Cpu,
+		Type:      event.Type,
+		Pid:       event.Pid,
+		Comm:      event.Comm,
+		SPort:     event.SPort,
+		DPort:     event.DPort,
+		NetNS:     event.NetNS,
+		Weight:    event.Weight,
+	}
+	putHost64(r.SAddr[0:], event.SAddrH)
+	putHost64(r.SAddr[8:], event.SAddrL)
+	putHost64(r.DAddr[0:], event.DAddrH)
+	putHost64(r.DAddr[8:], event.DAddrL)
+	return stream.AppendTCPEventV6(buf, &r, 0), event.Timestamp, event.Weight, nil
+}
+
+func encodeFlow(buf []byte, timestamp uint64, k *flowKey, count uint64) []byte {
+	r := stream.Flow{
+		Timestamp: timestamp,
+		Pid:       k.Pid,
+		NetNS:     k.NetNS,
+		DPort:     k.DPort,
+		Count:     count,
+	}
+	putHost32(r.SAddr[:], k.SAddr)
+	putHost32(r.DAddr[:], k.DAddr)
+	return stream.AppendFlow(buf, &r)
+}
+
+func encodeLatency(buf []byte, timestamp uint64, dest latencyDest, slot int, count uint64) []byte {
+	r := stream.Latency{
+		Timestamp: timestamp,
+		NetNS:     dest.NetNS,
+		DPort:     dest.DPort,
+		Slot:      uint8(slot),
+		Count:     count,
+	}
+	return stream.AppendLatency(buf, &r)
+}
@@ -0,0 +1,114 @@
+package main
+
+import (
+	"io"
+	"io/ioutil"
+	"os"
+	"testing"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// benchSamples are a batch of compact IPv4 samples, as a Sink gets them.
+func benchSamples() [][]byte {
+	samples := make([][]byte, 256)
+	for i := range samples {
+		data := make([]byte, 52)
+		tracer.ByteOrder.PutUint64(data[0:8], uint64(1000000+i))
+		data[8] = 2 // compact layout
+		data[9] = uint8(tracer.EventConnect)
+		tracer.ByteOrder.PutUint16(data[10:12], uint16(30000+i))
+		tracer.ByteOrder.PutUint32(data[16:20], uint32(4242+i))
+		copy(data[20:36], "curl")
+		copy(data[36:40], []byte{127, 0, 0, 1})
+		copy(data[40:44], []byte{10, 1, 2, byte(i)})
+		tracer.ByteOrder.PutUint16(data[44:46], 80)
+		tracer.ByteOrder.PutUint32(data[48:52], 4026531993)
+		samples[i] = data
+	}
+	return samples
+}
+
+func TestEncodeTCPEventV4(t *testing.T) {
+	samples := benchSamples()
+	block, ts, weight, err := encodeTCPEventV4(nil, samples[3])
+	if err != nil {
+		t.Fatal(err)
+	}
+	if ts != 1000003 || weight != 1 || len(block) != stream.TCPEventV4Size {
+		t.Fatalf("got timestamp %d, weight %d, %d bytes", ts, weight, len(block))
+	}
+
+	rec := stream.Record{Kind: block[0], Payload: block[stream.RecordHeaderSize:]}
+	var e stream.TCPEventV4
+	if err := rec.TCPEventV4(&e); err != nil {
+		t.Fatal(err)
+	}
+	if e.SAddr != [4]byte{127, 0, 0, 1} || e.DAddr != [4]byte{10, 1, 2, 3} ||
+		e.SPort != 30003 || e.DPort != 80 || e.Pid != 4245 || e.Weight != 1 {
+		t.Fatalf("got %+v", e)
+	}
+}
+
+// benchmarkOutput formats a batch of samples with format and writes it, as
+// eventFamily.handle and the batch writer do, in text or binary mode.
+// Binary output to stdout sends Ready. to stderr, leaving os.Stdout to
+// the stream.
+func TestOpenOutputBinary(t *testing.T) {
+	stdout := os.Stdout
+	defer func() { binaryOutput = false }()
+	binaryOutput = true
+
+	out, err := openOutput("-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if out != stdout || os.Stdout != stdout {
+		t.Error("the output is not stdout, or os.Stdout changed")
+	}
+	if readyOutput() != os.Stderr {
+		t.Error("Ready. not sent to stderr with binary output")
+	}
+	binaryOutput = false
+	if readyOutput() != os.Stdout {
+		t.Error("Ready. not sent to stdout with text output")
+	}
+}
+
+func benchmarkOutput(b *testing.B, w io.Writer, format func(buf, data []byte) ([]byte, uint64, uint32, error)) {
+	samples := benchSamples()
+	buf := make([]byte, 0, 64*1024)
+	b.SetBytes(int64(len(samples[0])))
+	b.ReportAllocs()
+	for i := 0; i < b.N; {
+		buf = buf[:0]
+		for _, s := range samples {
+			buf, _, _, _ = format(buf, s)
+			if i++; i == b.N {
+				break
+			}
+		}
+		w.Write(buf)
+	}
+}
+
+func BenchmarkOutputText(b *testing.B) {
+	benchmarkOutput(b, ioutil.Discard, formatTCPEventV4)
+}
+
+func BenchmarkOutputBinary(b *testing.B) {
+	w, err := stream.NewWriter(ioutil.Discard, false)
+	if err != nil {
+		b.Fatal(err)
+	}
+	benchmarkOutput(b, w, encodeTCPEventV4)
+}
+
+func BenchmarkOutputBinaryCompressed(b *testing.B) {
+	w, err := stream.NewWriter(ioutil.Discard, true)
+	if err != nil {
+		b.Fatal(err)
+	}
+	benchmarkOutput(b, w, encodeTCPEventV4)
+}
@@ -0,0 +1,111 @@
+// stream-dump prints the records of a binary output stream read from
+// stdin, or of a spool directory, one per line, e.g.
+//
+//	gobpf-elf-loader -output-format binary ebpf.o | stream-dump
+//	stream-dump -spool /var/spool/tcptracer -since 1234567890 -follow
+package main
+
+import (
+	"bufio"
+	"flag"
+	"fmt"
+	"io"
+	"net"
+	"os"
+	"time"
+
+	"github.com/kinvolk/gobpf-elf-loader/spool"
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+)
+
+type recordReader interface {
+	Next() (stream.Record, error)
+}
+
+var (
+	spoolDir = flag.String("spool", "", "read the segments of this spool directory instead of stdin")
+	since    = flag.Uint64("since", 0, "with -spool, start at the first record stamped at or after this timestamp")
+	follow   = flag.Bool("follow", false, "with -spool, wait for new records at the end")
+)
+
+func main() {
+	flag.Parse()
+
+	var r recordReader
+	var err error
+	if *spoolDir != "" {
+		var sr *spool.Reader
+		sr, err = spool.Open(*spoolDir)
+		if err == nil && *since > 0 {
+			err = sr.Seek(*since)
+		}
+		r = sr
+	} else {
+		r, err = stream.NewReader(os.Stdin)
+	}
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+		os.Exit(1)
+	}
+	w := bufio.NewWriter(os.Stdout)
+	defer w.Flush()
+
+	var v4 stream.TCPEventV4
+	var v6 stream.TCPEventV6
+	var flow stream.Flow
+	var latency stream.Latency
+	for {
+		rec, err := r.Next()
+		if err == io.EOF && *follow && *spoolDir != "" {
+			w.Flush()
+			time.Sleep(100 * time.Millisecond)
+			continue
+		}
+		if err == io.EOF {
+			return
+		}
+		if err != nil {
+			w.Flush()
+			fmt.Fprintf(os.Stderr, "%v\n", err)
+			os.Exit(1)
+		}
+
+		late := ""
+		if rec.Flags&stream.RecordLate != 0 {
+			late = " late"
+		}
+		switch rec.Kind {
+		case stream.KindTCPEventV4:
+			if err = rec.TCPEventV4(&v4); err == nil {
+				fmt.Fprintf(w, "%d cpu#%d %d %d %s:%d %s:%d %d weight %d%s\n",
+					v4.Timestamp, v4.CPU, v4.Type, v4.Pid,
+					net.IP(v4.SAddr[:]), v4.SPort, net.IP(v4.DAddr[:]), v4.DPort,
+					v4.NetNS, v4.Weight, late)
+			}
+		case stream.KindTCPEventV6:
+			if err = rec.TCPEventV6(&v6); err == nil {
+				fmt.Fprintf(w, "%d cpu#%d %d %d [%s]:%d [%s]:%d %d weight %d%s\n",
+					v6.Timestamp, v6.CPU, v6.Type, v6.Pid,
+					net.IP(v6.SAddr[:]), v6.SPort, net.IP(v6.DAddr[:]), v6.DPort,
+					v6.NetNS, v6.Weight, late)
+			}
+		case stream.KindFlow:
+			if err = rec.Flow(&flow); err == nil {
+				fmt.Fprintf(w, "%d flow %d %s %s:%d %d count=%d\n",
+					flow.Timestamp, flow.Pid, net.IP(flow.SAddr[:]),
+					net.IP(flow.DAddr[:]), flow.DPort, flow.NetNS, flow.Count)
+			}
+		case stream.KindLatency:
+			if err = rec.Latency(&latency); err == nil {
+				fmt.Fprintf(w, "%d latency %d %d %v=%d\n",
+					latency.Timestamp, latency.NetNS, latency.DPort,
+					time.Duration(uint64(1)<<latency.Slot), latency.Count)
+			}
+		default:
+			fmt.Fprintf(w, "record of unknown kind %d, %d bytes\n", rec.Kind, len(rec.Payload))
+		}
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "%v\n", err)
+		}
+	}
+}
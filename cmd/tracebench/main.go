@@ -0,0 +1,390 @@
+// tracebench measures the loader end to end. It makes loopback connects at
+// a controlled rate, first without the loader to get a baseline, then with
+// it, and reports the events delivered per second, the connects whose event
+// never arrived, the loader's CPU time per event, the connect() latency the
+// probes add and the latency from the connect to its event reaching the
+// output. Must run as root, like the loader, e.g.
+//
+//	tracebench -rate 20000 -concurrency 8 -loader ./gobpf-elf-loader \
+//		kernel/trace_output_kern.o -- -perf-readers 2
+//
+// Arguments after -- are passed on to the loader, so that each of its modes
+// can be measured against the others. With several objects, each is
+// measured in turn against the same baseline, e.g. -rate 0 for a connect
+// storm and the objects built before and after a change of the probes, to
+// compare the time they add to each connect.
+package main
+
+import (
+	"bufio"
+	"flag"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net"
+	"os"
+	"os/exec"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+)
+
+var (
+	loaderPath  = flag.String("loader", "gobpf-elf-loader", "loader binary to measure")
+	rate        = flag.Int("rate", 10000, "connects per second over all workers, 0 for as fast as possible")
+	concurrency = flag.Int("concurrency", 4, "number of goroutines making connects")
+	duration    = flag.Duration("duration", 10*time.Second, "length of each measurement")
+	baseline    = flag.Bool("baseline", true, "measure connect() latency without the loader first")
+	readyWait   = flag.Duration("ready-timeout", time.Minute, "how long to wait for the loader to be ready")
+)
+
+const clockMonotonic = 1
+
+// monotonicNow returns CLOCK_MONOTONIC, the clock of bpf_ktime_get_ns().
+func monotonicNow() uint64 {
+	var ts syscall.Timespec
+	syscall.Syscall(syscall.SYS_CLOCK_GETTIME, clockMonotonic, uintptr(unsafe.Pointer(&ts)), 0)
+	return uint64(ts.Sec)*1000000000 + uint64(ts.Nsec)
+}
+
+// serve accepts and closes connections until l is closed.
+func serve(l net.Listener) {
+	for {
+		conn, err := l.Accept()
+		if err != nil {
+			return
+		}
+		conn.Close()
+	}
+}
+
+// loadResult is what one run of the load generator measured.
+type loadResult struct {
+	connects  uint64
+	failures  uint64
+	latencies []time.Duration
+	start     uint64
+	end       uint64
+}
+
+func (r *loadResult) meanLatency() time.Duration {
+	if len(r.latencies) == 0 {
+		return 0
+	}
+	var sum time.Duration
+	for _, l := range r.latencies {
+		sum += l
+	}
+	return sum / time.Duration(len(r.latencies))
+}
+
+// generate connects to addr at rate for d and returns the connect()
+// latencies.
+func generate(addr string, rate, concurrency int, d time.Duration) loadResult {
+	var res loadResult
+	var mu sync.Mutex
+	var wg sync.WaitGroup
+
+	var interval time.Duration
+	if rate > 0 {
+		interval = time.Duration(int64(time.Second) * int64(concurrency) / int64(rate))
+	}
+
+	res.start = monotonicNow()
+	deadline := time.Now().Add(d)
+	for i := 0; i < concurrency; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+
+			var lat []time.Duration
+			next := time.Now()
+			for time.Now().Before(deadline) {
+				if interval > 0 {
+					if wait := time.Until(next); wait > 0 {
+						time.Sleep(wait)
+					}
+					next = next.Add(interval)
+				}
+
+				start := time.Now()
+				conn, err := net.Dial("tcp4", addr)
+				elapsed := time.Since(start)
+				if err != nil {
+					atomic.AddUint64(&res.failures, 1)
+					continue
+				}
+				atomic.AddUint64(&res.connects, 1)
+				lat = append(lat, elapsed)
+
+				// no TIME_WAIT, as in guessOffsets
+				conn.(*net.TCPConn).SetLinger(0)
+				conn.Close()
+			}
+
+			mu.Lock()
+			res.latencies = append(res.latencies, lat...)
+			mu.Unlock()
+		}()
+	}
+	wg.Wait()
+	res.end = monotonicNow()
+	return res
+}
+
+func percentiles(d []time.Duration) string {
+	if len(d) == 0 {
+		return "n/a"
+	}
+	sort.Slice(d, func(i, j int) bool { return d[i] < d[j] })
+	at := func(q float64) time.Duration { return d[int(q*float64(len(d)-1))] }
+	return fmt.Sprintf("p50 %v p90 %v p99 %v p99.9 %v max %v",
+		at(0.5), at(0.9), at(0.99), at(0.999), d[len(d)-1])
+}
+
+// cpuTime returns the user and system time of process pid.
+func cpuTime(pid int) (time.Duration, error) {
+	data, err := ioutil.ReadFile(fmt.Sprintf("/proc/%d/stat", pid))
+	if err != nil {
+		return 0, err
+	}
+	// the fields after the command, which may hold spaces
+	fields := strings.Fields(string(data[strings.LastIndexByte(string(data), ')')+1:]))
+	if len(fields) < 13 {
+		return 0, fmt.Errorf("unexpected /proc/%d/stat", pid)
+	}
+	utime, _ := strconv.ParseUint(fields[11], 10, 64)
+	stime, _ := strconv.ParseUint(fields[12], 10, 64)
+	// USER_HZ is 100 on all the architectures the loader supports
+	return time.Duration(utime+stime) * 10 * time.Millisecond, nil
+}
+
+// eventReader counts the connect events to port read from the loader's
+// output and their end-to-end latencies.
+type eventReader struct {
+	port uint16
+
+	mu        sync.Mutex
+	events    uint64
+	latencies []time.Duration
+}
+
+func (er *eventReader) run(r io.Reader) error {
+	sr, err := stream.NewReader(r)
+	if err != nil {
+		return err
+	}
+	var e stream.TCPEventV4
+	for {
+		rec, err := sr.Next()
+		if err != nil {
+			if err == io.EOF {
+				return nil
+			}
+			return err
+		}
+		now := monotonicNow()
+		if rec.Kind != stream.KindTCPEventV4 || rec.TCPEventV4(&e) != nil {
+			continue
+		}
+		if e.Type != 1 || e.DPort != er.port {
+			continue
+		}
+
+		er.mu.Lock()
+		er.events += uint64(e.Weight)
+		if now > e.Timestamp {
+			er.latencies = append(er.latencies, time.Duration(now-e.Timestamp))
+		}
+		er.mu.Unlock()
+	}
+}
+
+func (er *eventReader) reset() {
+	er.mu.Lock()
+	er.events = 0
+	er.latencies = nil
+	er.mu.Unlock()
+}
+
+// measure runs the loader with object while generating load and prints the
+// report, the connect() latencies compared to base if not nil.
+func measure(object string, loaderArgs []string, addr string, port uint16, base *loadResult) error {
+	// only the connects of the benchmark are sent
+	filters, err := ioutil.TempFile("", "tracebench")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(filters.Name())
+	fmt.Fprintf(filters, "allow dport %d\n", port)
+	filters.Close()
+
+	args := append([]string{"-output-format", "binary", "-filters", filters.Name()}, loaderArgs...)
+	cmd := exec.Command(*loaderPath, append(args, object)...)
+	stdout, err := cmd.StdoutPipe()
+	if err != nil {
+		return err
+	}
+	stderr, err := cmd.StderrPipe()
+	if err != nil {
+		return err
+	}
+	if err := cmd.Start(); err != nil {
+		return fmt.Errorf("failed to start the loader: %v", err)
+	}
+
+	// In binary mode the loader's messages, Ready. included, go to stderr.
+	// What follows Ready. is the startup time and the statistics printed
+	// on exit, which are part of the report.
+	ready := make(chan struct{})
+	stderrDone := make(chan struct{})
+	var report []string
+	go func() {
+		defer close(stderrDone)
+		scanner := bufio.NewScanner(stderr)
+		seenReady := false
+		for scanner.Scan() {
+			line := scanner.Text()
+			switch {
+			case seenReady:
+				report = append(report, line)
+			case line == "Ready.":
+				seenReady = true
+				close(ready)
+			default:
+				fmt.Fprintf(os.Stderr, "loader: %s\n", line)
+			}
+		}
+	}()
+
+	er := &eventReader{port: port}
+	readDone := make(chan error, 1)
+	go func() { readDone <- er.run(stdout) }()
+
+	select {
+	case <-ready:
+	case <-stderrDone:
+		<-readDone
+		return fmt.Errorf("the loader exited before being ready: %v", cmd.Wait())
+	case <-time.After(*readyWait):
+		cmd.Process.Kill()
+		cmd.Wait()
+		return fmt.Errorf("the loader did not get ready in %v", *readyWait)
+	}
+
+	// events of the offset guessing and the like
+	time.Sleep(200 * time.Millisecond)
+	er.reset()
+
+	cpuBefore, cpuErr := cpuTime(cmd.Process.Pid)
+	fmt.Fprintf(os.Stderr, "traced: %s, %d connects/s, %d workers, %v\n", object, *rate, *concurrency, *duration)
+	traced := generate(addr, *rate, *concurrency, *duration)
+
+	// let the last events through the reorder window and output flushes
+	time.Sleep(time.Second)
+	cpuAfter, err := cpuTime(cmd.Process.Pid)
+	if cpuErr == nil {
+		cpuErr = err
+	}
+
+	cmd.Process.Signal(os.Interrupt)
+	if err := <-readDone; err != nil {
+		fmt.Fprintf(os.Stderr, "reading the loader output: %v\n", err)
+	}
+	<-stderrDone
+	cmd.Wait()
+
+	elapsed := time.Duration(traced.end - traced.start)
+	er.mu.Lock()
+	events := er.events
+	lat := er.latencies
+	er.mu.Unlock()
+
+	fmt.Printf("object: %s\n", object)
+	fmt.Printf("connects: %d in %v, %.0f/s, %d failed\n",
+		traced.connects, elapsed, float64(traced.connects)/elapsed.Seconds(), traced.failures)
+	fmt.Printf("events: %d, %.0f/s, %d missing\n",
+		events, float64(events)/elapsed.Seconds(), int64(traced.connects)-int64(events))
+	if cpuErr == nil && events > 0 {
+		cpu := cpuAfter - cpuBefore
+		fmt.Printf("loader cpu: %v, %v per event\n", cpu, cpu/time.Duration(events))
+	}
+	if base != nil {
+		fmt.Printf("connect() baseline: %s\n", percentiles(base.latencies))
+	}
+	fmt.Printf("connect() traced:   %s\n", percentiles(traced.latencies))
+	if base != nil && len(base.latencies) > 0 && len(traced.latencies) > 0 {
+		// the mean, unlike the percentiles, adds up the cost of the probes
+		// over all connects
+		fmt.Printf("probe cost: %v per connect (mean %v traced, %v baseline)\n",
+			traced.meanLatency()-base.meanLatency(), traced.meanLatency(), base.meanLatency())
+	}
+	fmt.Printf("connect to event:   %s\n", percentiles(lat))
+
+	for _, line := range report {
+		fmt.Printf("loader: %s\n", line)
+	}
+	return nil
+}
+
+func main() {
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [options] ebpf.o... [-- loader options]\n", os.Args[0])
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+	var objects, loaderArgs []string
+	for i, arg := range flag.Args() {
+		if arg == "--" {
+			loaderArgs = flag.Args()[i+1:]
+			break
+		}
+		objects = append(objects, arg)
+	}
+	if len(objects) < 1 {
+		flag.Usage()
+		os.Exit(1)
+	}
+	if *concurrency < 1 {
+		*concurrency = 1
+	}
+
+	l, err := net.Listen("tcp4", "127.0.0.1:0")
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+		os.Exit(1)
+	}
+	go serve(l)
+	defer l.Close()
+	addr := l.Addr().String()
+	port := uint16(l.Addr().(*net.TCPAddr).Port)
+
+	var base *loadResult
+	if *baseline {
+		fmt.Fprintf(os.Stderr, "baseline: %d connects/s, %d workers, %v\n", *rate, *concurrency, *duration)
+		res := generate(addr, *rate, *concurrency, *duration)
+		base = &res
+	}
+
+	failed := false
+	for i, object := range objects {
+		if i > 0 {
+			fmt.Println()
+		}
+		if err := measure(object, loaderArgs, addr, port, base); err != nil {
+			fmt.Fprintf(os.Stderr, "%s: %v\n", object, err)
+			failed = true
+		}
+	}
+	if failed {
+		l.Close()
+		os.Exit(1)
+	}
+}
@@ -0,0 +1,96 @@
+package main
+
+import (
+	"fmt"
+	"os"
+	"sync"
+	"time"
+
+	"github.com/iovisor/gobpf/elf"
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// mapCollector periodically drains a per-CPU map of u64 counters. Every
+// interval it reads and resets the map, hands each key with a count to
+// print along with the time of the collection, then calls flush if set.
+type mapCollector struct {
+	walker   *tracer.MapWalker
+	cpus     int
+	interval time.Duration
+	what     string
+
+	print func(timestamp uint64, key []byte, count uint64)
+	flush func(timestamp uint64)
+
+	stop chan struct{}
+	wg   sync.WaitGroup
+}
+
+// newMapCollector returns a collector of mp, of keys keySize bytes long.
+// what names the counters in errors.
+func newMapCollector(mp *elf.Map, keySize int, interval time.Duration, what string) (*mapCollector, error) {
+	cpus, err := tracer.PossibleCPUs()
+	if err != nil {
+		return nil, err
+	}
+	return &mapCollector{
+		walker:   tracer.NewMapWalker(mp.Fd(), keySize, 8*cpus),
+		cpus:     cpus,
+		interval: interval,
+		what:     what,
+		stop:     make(chan struct{}),
+	}, nil
+}
+
+// collect reads and resets all counters, summed over the CPUs. Counts
+// between the read and the delete of a key are lost, which is fine for
+// rates.
+func (mc *mapCollector) collect() error {
+	now := tracer.MonotonicNow()
+	err := mc.walker.Walk(true, func(key, value []byte) {
+		var count uint64
+		for cpu := 0; cpu < mc.cpus; cpu++ {
+			count += tracer.ByteOrder.Uint64(value[8*cpu:])
+		}
+		if count > 0 {
+			mc.print(now, key, count)
+		}
+	})
+	if err != nil {
+		return fmt.Errorf("failed to read %s: %v", mc.what, err)
+	}
+	if mc.flush != nil {
+		mc.flush(now)
+	}
+	return nil
+}
+
+func (mc *mapCollector) Start() {
+	mc.wg.Add(1)
+	go func() {
+		defer mc.wg.Done()
+
+		ticker := time.NewTicker(mc.interval)
+		defer ticker.Stop()
+
+		for {
+			select {
+			case <-ticker.C:
+				if err := mc.collect(); err != nil {
+					fmt.Fprintf(os.Stderr, "%v\n", err)
+				}
+			case <-mc.stop:
+				return
+			}
+		}
+	}()
+}
+
+// Stop stops the collector after a last collection.
+func (mc *mapCollector) Stop() {
+	close(mc.stop)
+	mc.wg.Wait()
+	if err := mc.collect(); err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+	}
+}
@@ -0,0 +1,122 @@
+package main
+
+import (
+	"fmt"
+	"os"
+	"sync/atomic"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// eventFamily is one kind of event read from one map: it knows how to turn
+// the map's samples into text and tracks their ordering. All families are
+// consumed by the same goroutine, the tracer's sink.
+type eventFamily struct {
+	Name string
+
+	// format decodes data and appends its text representation to buf.
+	// It returns the event's timestamp and weight. encode does the same
+	// for the binary output.
+	format func(buf, data []byte) ([]byte, uint64, uint32, error)
+	encode func(buf, data []byte) ([]byte, uint64, uint32, error)
+
+	lastTimestamp uint64
+
+	// events counts the events printed, weighted the events they stand
+	// for once the kernel's sampling is undone.
+	events   uint64
+	weighted uint64
+
+	// late counts the events older than one already printed. They are
+	// printed anyway, with a "late" flag.
+	late uint64
+}
+
+// eventFamilies are indexed by tracer.Family.
+var eventFamilies = []*eventFamily{
+	tracer.FamilyIPv4: {Name: "ipv4", format: formatTCPEventV4, encode: encodeTCPEventV4},
+	tracer.FamilyIPv6: {Name: "ipv6", format: formatTCPEventV6, encode: encodeTCPEventV6},
+}
+
+// outputSink returns the sink printing the events of all families to
+// output.
+func outputSink() tracer.Sink {
+	buf := make([]byte, 0, 256)
+	return tracer.SinkFunc(func(f tracer.Family, samples [][]byte) {
+		family := eventFamilies[f]
+		for _, sample := range samples {
+			buf = family.handle(buf, sample)
+		}
+	})
+}
+
+func formatTCPEventV4(buf, data []byte) ([]byte, uint64, uint32, error) {
+	var event tracer.TCPEventV4
+	if err := tracer.DecodeTCPEventV4(data, &event); err != nil {
+		return buf, 0, 0, err
+	}
+	return appendTCPEventV4(buf, &event), event.Timestamp, event.Weight, nil
+}
+
+func formatTCPEventV6(buf, data []byte) ([]byte, uint64, uint32, error) {
+	var event tracer.TCPEventV6
+	if err := tracer.DecodeTCPEventV6(data, &event); err != nil {
+		return buf, 0, 0, err
+	}
+	return appendTCPEventV6(buf, &event), event.Timestamp, event.Weight, nil
+}
+
+// Late returns the number of events of the family printed out of order.
+func (f *eventFamily) Late() uint64 {
+	return atomic.LoadUint64(&f.late)
+}
+
+// Counts returns the number of events of the family printed and the
+// number of events they stand for.
+func (f *eventFamily) Counts() (events, weighted uint64) {
+	return atomic.LoadUint64(&f.events), atomic.LoadUint64(&f.weighted)
+}
+
+// appendLateFlag marks the line in buf as out of order.
+func appendLateFlag(buf []byte) []byte {
+	return append(buf[:len(buf)-1], " late\n"...)
+}
+
+// handle prints the event in data and returns buf, reused as scratch space
+// for the text representation, so that the caller can hand it back for the
+// next event.
+func (f *eventFamily) handle(buf, data []byte) []byte {
+	format := f.format
+	if binaryOutput {
+		format = f.encode
+	}
+	buf, timestamp, weight, err := format(buf[:0], data)
+	if err != nil {
+		if binaryOutput {
+			fmt.Fprintf(os.Stderr, "failed to decode received data: %s\n", err)
+		} else {
+			fmt.Fprintf(output, "failed to decode received data: %s\n", err)
+		}
+		return buf
+	}
+	atomic.AddUint64(&f.events, 1)
+	atomic.AddUint64(&f.weighted, uint64(weight))
+
+	switch {
+	case *unordered:
+		// out of order by design, no event is late
+	case f.lastTimestamp > timestamp:
+		atomic.AddUint64(&f.late, 1)
+		if binaryOutput {
+			buf[1] |= stream.RecordLate
+		} else {
+			buf = appendLateFlag(buf)
+		}
+	default:
+		f.lastTimestamp = timestamp
+	}
+	output.Write(buf)
+
+	return buf
+}
@@ -0,0 +1,53 @@
+package main
+
+import (
+	"bytes"
+	"encoding/binary"
+	"strings"
+	"testing"
+	"time"
+)
+
+// handleAll prints events of the given timestamps through a family and
+// returns the output.
+func handleAll(f *eventFamily, timestamps ...uint64) string {
+	var w bytes.Buffer
+	output = newBatchWriter(&w, 1<<16, time.Hour)
+	var buf []byte
+	for _, ts := range timestamps {
+		var data [8]byte
+		binary.LittleEndian.PutUint64(data[:], ts)
+		buf = f.handle(buf, data[:])
+	}
+	output.Close()
+	output = nil
+	return w.String()
+}
+
+func testFamily() *eventFamily {
+	format := func(buf, data []byte) ([]byte, uint64, uint32, error) {
+		ts := binary.LittleEndian.Uint64(data)
+		return append(buf, "event\n"...), ts, 1, nil
+	}
+	return &eventFamily{Name: "test", format: format, encode: format}
+}
+
+func TestHandleLate(t *testing.T) {
+	f := testFamily()
+	out := handleAll(f, 1, 3, 2, 4)
+	if f.Late() != 1 || strings.Count(out, " late\n") != 1 {
+		t.Errorf("%d late events, output %q, want 1", f.Late(), out)
+	}
+}
+
+// With -unordered the events come as read, none is flagged late.
+func TestHandleUnordered(t *testing.T) {
+	*unordered = true
+	defer func() { *unordered = false }()
+
+	f := testFamily()
+	out := handleAll(f, 1, 3, 2, 4)
+	if f.Late() != 0 || strings.Contains(out, "late") {
+		t.Errorf("%d late events, output %q, want none", f.Late(), out)
+	}
+}
@@ -0,0 +1,56 @@
+package main
+
+import (
+	"strconv"
+	"time"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// flowKey mirrors struct flow_key of the aggregating kernel program
+type flowKey struct {
+	Pid   uint32
+	SAddr uint32
+	DAddr uint32
+	NetNS uint32
+	DPort uint16
+	_     uint16
+}
+
+// newFlowCollector returns a collector of the per-CPU connect counters of
+// the tcp_flows map, printing one line per flow seen during the interval.
+func newFlowCollector(mp *elf.Map, interval time.Duration) (*mapCollector, error) {
+	mc, err := newMapCollector(mp, int(unsafe.Sizeof(flowKey{})), interval, "flows")
+	if err != nil {
+		return nil, err
+	}
+	var buf []byte
+	mc.print = func(timestamp uint64, key []byte, count uint64) {
+		k := (*flowKey)(unsafe.Pointer(&key[0]))
+		if binaryOutput {
+			buf = encodeFlow(buf[:0], timestamp, k, count)
+		} else {
+			buf = appendFlow(buf[:0], timestamp, k, count)
+		}
+		output.Write(buf)
+	}
+	return mc, nil
+}
+
+func appendFlow(buf []byte, timestamp uint64, k *flowKey, count uint64) []byte {
+	buf = strconv.AppendUint(buf, timestamp, 10)
+	buf = append(buf, " flow "...)
+	buf = strconv.AppendUint(buf, uint64(k.Pid), 10)
+	buf = append(buf, ' ')
+	buf = appendIPv4(buf, k.SAddr)
+	buf = append(buf, ' ')
+	buf = appendIPv4(buf, k.DAddr)
+	buf = append(buf, ':')
+	buf = strconv.AppendUint(buf, uint64(k.DPort), 10)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(k.NetNS), 10)
+	buf = append(buf, " count="...)
+	buf = strconv.AppendUint(buf, count, 10)
+	return append(buf, '\n')
+}
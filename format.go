@@ -0,0 +1,207 @@
+package main
+
+import (
+	"strconv"
+	"unicode/utf8"
+
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+const hexDigits = "0123456789abcdef"
+
+// appendTCPEventV4 appends the text representation of event to buf. The
+// output matches what the former fmt.Printf based callback printed, but
+// nothing is allocated as long as buf has enough capacity.
+func appendTCPEventV4(buf []byte, event *tracer.TCPEventV4) []byte {
+	buf = strconv.AppendUint(buf, event.Timestamp, 10)
+	buf = append(buf, " cpu#"...)
+	buf = strconv.AppendUint(buf, event.Cpu, 10)
+	buf = append(buf, ' ')
+	buf = append(buf, tracer.EventType(event.Type).String()...)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(event.Pid), 10)
+	buf = append(buf, ' ')
+	buf = appendComm(buf, event.Comm[:])
+	buf = append(buf, ' ')
+	buf = appendIPv4(buf, event.SAddr)
+	buf = append(buf, ':')
+	buf = strconv.AppendUint(buf, uint64(event.SPort), 10)
+	buf = append(buf, ' ')
+	buf = appendIPv4(buf, event.DAddr)
+	buf = append(buf, ':')
+	buf = strconv.AppendUint(buf, uint64(event.DPort), 10)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(event.NetNS), 10)
+	return appendWeight(buf, event.Weight)
+}
+
+// appendTCPEventV6 is the IPv6 counterpart of appendTCPEventV4.
+func appendTCPEventV6(buf []byte, event *tracer.TCPEventV6) []byte {
+	buf = strconv.AppendUint(buf, event.Timestamp, 10)
+	buf = append(buf, " cpu#"...)
+	buf = strconv.AppendUint(buf, event.Cpu, 10)
+	buf = append(buf, ' ')
+	buf = append(buf, tracer.EventType(event.Type).String()...)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(event.Pid), 10)
+	buf = append(buf, " ["...)
+	buf = appendIPv6(buf, event.SAddrH, event.SAddrL)
+	buf = append(buf, "]:"...)
+	buf = strconv.AppendUint(buf, uint64(event.SPort), 10)
+	buf = append(buf, " ["...)
+	buf = appendIPv6(buf, event.DAddrH, event.DAddrL)
+	buf = append(buf, "]:"...)
+	buf = strconv.AppendUint(buf, uint64(event.DPort), 10)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(event.NetNS), 10)
+	return appendWeight(buf, event.Weight)
+}
+
+// appendWeight ends the line, with the event's weight if it stands for
+// more than itself.
+func appendWeight(buf []byte, weight uint32) []byte {
+	if weight > 1 {
+		buf = append(buf, " weight "...)
+		buf = strconv.AppendUint(buf, uint64(weight), 10)
+	}
+	return append(buf, '\n')
+}
+
+// appendIPv4 appends the dotted notation of addr. addr holds the address
+// in network byte order as read by the kernel side, i.e. the first octet
+// is the least significant byte.
+func appendIPv4(buf []byte, addr uint32) []byte {
+	for i := uint(0); i < 4; i++ {
+		if i > 0 {
+			buf = append(buf, '.')
+		}
+		buf = strconv.AppendUint(buf, uint64(addr>>(8*i)&0xff), 10)
+	}
+	return buf
+}
+
+// appendIPv6 appends the textual form of the address stored in hi and lo
+// (same layout as tracer.TCPEventV6). Like net.IP.String(), IPv4-mapped
+// addresses are printed in dotted notation and the longest run of two or
+// more zero groups is collapsed to "::".
+func appendIPv6(buf []byte, hi, lo uint64) []byte {
+	var groups [8]uint16
+	for i := uint(0); i < 4; i++ {
+		// the 64-bit halves were filled from memory in little endian
+		// order, byte 0 of the address is their least significant byte
+		groups[i] = uint16(hi>>(16*i))<<8 | uint16(hi>>(16*i+8))&0xff
+		groups[i+4] = uint16(lo>>(16*i))<<8 | uint16(lo>>(16*i+8))&0xff
+	}
+
+	if groups[0] == 0 && groups[1] == 0 && groups[2] == 0 &&
+		groups[3] == 0 && groups[4] == 0 && groups[5] == 0xffff {
+		return appendIPv4(buf, uint32(lo>>32))
+	}
+
+	// find the longest run of zero groups
+	e0, e1 := -1, -1
+	for i := 0; i < 8; i++ {
+		j := i
+		for j < 8 && groups[j] == 0 {
+			j++
+		}
+		if j-i >= 2 && j-i > e1-e0 {
+			e0, e1 = i, j
+		}
+		i = j
+	}
+
+	for i := 0; i < 8; i++ {
+		if i == e0 {
+			buf = append(buf, ':', ':')
+			i = e1
+			if i >= 8 {
+				break
+			}
+		} else if i > 0 {
+			buf = append(buf, ':')
+		}
+		buf = appendHex16(buf, groups[i])
+	}
+	return buf
+}
+
+func appendHex16(buf []byte, v uint16) []byte {
+	started := false
+	for shift := uint(12); ; shift -= 4 {
+		d := v >> shift & 0xf
+		if d != 0 || started || shift == 0 {
+			buf = append(buf, hexDigits[d])
+			started = true
+		}
+		if shift == 0 {
+			return buf
+		}
+	}
+}
+
+// appendComm appends the NUL terminated comm as a Go quoted string, the
+// same way the %q verb does it.
+func appendComm(buf []byte, comm []byte) []byte {
+	for i, c := range comm {
+		if c == 0 {
+			comm = comm[:i]
+			break
+		}
+	}
+
+	buf = append(buf, '"')
+	for len(comm) > 0 {
+		r, width := utf8.DecodeRune(comm)
+		switch {
+		case width == 1 && r == utf8.RuneError:
+			buf = append(buf, '\\', 'x', hexDigits[comm[0]>>4], hexDigits[comm[0]&0xf])
+		case r == '"' || r == '\\':
+			buf = append(buf, '\\', byte(r))
+		case strconv.IsPrint(r):
+			buf = append(buf, comm[:width]...)
+		default:
+			buf = appendEscapedRune(buf, r)
+		}
+		comm = comm[width:]
+	}
+	return append(buf, '"')
+}
+
+func appendEscapedRune(buf []byte, r rune) []byte {
+	switch r {
+	case '\a':
+		return append(buf, `\a`...)
+	case '\b':
+		return append(buf, `\b`...)
+	case '\f':
+		return append(buf, `\f`...)
+	case '\n':
+		return append(buf, `\n`...)
+	case '\r':
+		return append(buf, `\r`...)
+	case '\t':
+		return append(buf, `\t`...)
+	case '\v':
+		return append(buf, `\v`...)
+	}
+
+	var digits int
+	switch {
+	case r < ' ' || r == 0x7f:
+		buf = append(buf, '\\', 'x')
+		digits = 2
+	case r < 0x10000:
+		buf = append(buf, '\\', 'u')
+		digits = 4
+	default:
+		buf = append(buf, '\\', 'U')
+		digits = 8
+	}
+	for shift := uint(4 * (digits - 1)); ; shift -= 4 {
+		buf = append(buf, hexDigits[r>>shift&0xf])
+		if shift == 0 {
+			return buf
+		}
+	}
+}
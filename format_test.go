@@ -0,0 +1,165 @@
+package main
+
+import (
+	"bytes"
+	"encoding/binary"
+	"fmt"
+	"math/rand"
+	"net"
+	"testing"
+
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// fmtTCPEventV4 and fmtTCPEventV6 are the former fmt.Printf based output,
+// which appendTCPEventV4 and appendTCPEventV6 must reproduce.
+func fmtTCPEventV4(event *tracer.TCPEventV4) string {
+	comm := string(event.Comm[:bytes.IndexByte(append(event.Comm[:], 0), 0)])
+
+	saddrbuf := make([]byte, 4)
+	daddrbuf := make([]byte, 4)
+	binary.LittleEndian.PutUint32(saddrbuf, event.SAddr)
+	binary.LittleEndian.PutUint32(daddrbuf, event.DAddr)
+	sIP := net.IPv4(saddrbuf[0], saddrbuf[1], saddrbuf[2], saddrbuf[3])
+	dIP := net.IPv4(daddrbuf[0], daddrbuf[1], daddrbuf[2], daddrbuf[3])
+
+	return fmt.Sprintf("%v cpu#%d %s %v %q %v:%v %v:%v %v\n", event.Timestamp, event.Cpu,
+		tracer.EventType(event.Type), event.Pid, comm, sIP, event.SPort, dIP, event.DPort, event.NetNS)
+}
+
+func fmtTCPEventV6(event *tracer.TCPEventV6) string {
+	saddrbuf := make([]byte, 16)
+	daddrbuf := make([]byte, 16)
+	binary.LittleEndian.PutUint64(saddrbuf, event.SAddrH)
+	binary.LittleEndian.PutUint64(saddrbuf[8:], event.SAddrL)
+	binary.LittleEndian.PutUint64(daddrbuf, event.DAddrH)
+	binary.LittleEndian.PutUint64(daddrbuf[8:], event.DAddrL)
+
+	return fmt.Sprintf("%v cpu#%d %s %v [%v]:%v [%v]:%v %v\n", event.Timestamp, event.Cpu,
+		tracer.EventType(event.Type), event.Pid, net.IP(saddrbuf), event.SPort, net.IP(daddrbuf), event.DPort, event.NetNS)
+}
+
+var testComms = []string{
+	"curl",
+	"",
+	"0123456789abcdef", // no NUL
+	"curl\x00garbage",
+	"h\xc3\xa9llo",
+	"tab\there",
+	"quo\"te\\",
+	"\x01\x7f\xff\xfe",
+	"\xe2\x80\x8b", // not printable
+	"\xf0\x9f\x98\x80",
+	"\xc3",
+}
+
+// randHalf returns half of an IPv6 address, often with zero groups so that
+// the "::" collapsing is exercised.
+func randHalf(rnd *rand.Rand) uint64 {
+	v := rnd.Uint64()
+	switch rnd.Intn(4) {
+	case 0:
+		v &= 0xffff0000ffff0000
+	case 1:
+		v &= 0x0000ffffffff0000
+	case 2:
+		v = 0
+	}
+	return v
+}
+
+func TestAppendTCPEventV4(t *testing.T) {
+	if tracer.ByteOrder != binary.LittleEndian {
+		t.Skip("the former output assumed a little endian host")
+	}
+	rnd := rand.New(rand.NewSource(1))
+	var buf []byte
+	for i := 0; i < 10000; i++ {
+		e := tracer.TCPEventV4{
+			Timestamp: rnd.Uint64(),
+			Cpu:       uint64(rnd.Intn(256)),
+			Type:      uint32(rnd.Intn(5)),
+			Pid:       rnd.Uint32(),
+			SAddr:     rnd.Uint32(),
+			DAddr:     rnd.Uint32(),
+			SPort:     uint16(rnd.Uint32()),
+			DPort:     uint16(rnd.Uint32()),
+			NetNS:     rnd.Uint32(),
+		}
+		copy(e.Comm[:], testComms[i%len(testComms)])
+
+		buf = appendTCPEventV4(buf[:0], &e)
+		if want := fmtTCPEventV4(&e); string(buf) != want {
+			t.Fatalf("got  %q\nwant %q", buf, want)
+		}
+	}
+}
+
+func TestAppendTCPEventV6(t *testing.T) {
+	if tracer.ByteOrder != binary.LittleEndian {
+		t.Skip("the former output assumed a little endian host")
+	}
+	rnd := rand.New(rand.NewSource(1))
+	var buf []byte
+	for i := 0; i < 10000; i++ {
+		e := tracer.TCPEventV6{
+			Timestamp: rnd.Uint64(),
+			Type:      uint32(rnd.Intn(5)),
+			Pid:       rnd.Uint32(),
+			SAddrH:    randHalf(rnd),
+			SAddrL:    randHalf(rnd),
+			DAddrH:    randHalf(rnd),
+			DAddrL:    randHalf(rnd),
+			SPort:     uint16(rnd.Uint32()),
+			DPort:     uint16(rnd.Uint32()),
+		}
+		if i%7 == 0 {
+			// IPv4-mapped
+			e.SAddrH, e.SAddrL = 0, uint64(rnd.Uint32())<<32|0xffff0000
+		}
+
+		buf = appendTCPEventV6(buf[:0], &e)
+		if want := fmtTCPEventV6(&e); string(buf) != want {
+			t.Fatalf("got  %q\nwant %q", buf, want)
+		}
+	}
+}
+
+func TestAppendWeight(t *testing.T) {
+	e := tracer.TCPEventV4{Type: uint32(tracer.EventConnect), Weight: 40}
+	want := "0 cpu#0 connect 0 \"\" 0.0.0.0:0 0.0.0.0:0 0 weight 40\n"
+	if got := string(appendTCPEventV4(nil, &e)); got != want {
+		t.Fatalf("got %q, want %q", got, want)
+	}
+}
+
+func BenchmarkAppendTCPEventV4(b *testing.B) {
+	e := tracer.TCPEventV4{Timestamp: 123456789, Type: uint32(tracer.EventConnect), Pid: 4242,
+		SAddr: 0x0100007f, DAddr: 0x0100007f, SPort: 33000, DPort: 80, NetNS: 4026531993}
+	copy(e.Comm[:], "curl")
+	buf := make([]byte, 0, 256)
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		buf = appendTCPEventV4(buf[:0], &e)
+	}
+}
+
+func BenchmarkAppendTCPEventV6(b *testing.B) {
+	e := tracer.TCPEventV6{Timestamp: 123456789, Type: uint32(tracer.EventConnect), Pid: 4242,
+		SAddrL: 0x0100000000000000, DAddrH: 0x000000000000b80d, SPort: 33000, DPort: 80}
+	buf := make([]byte, 0, 256)
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		buf = appendTCPEventV6(buf[:0], &e)
+	}
+}
+
+func BenchmarkFmtTCPEventV4(b *testing.B) {
+	e := tracer.TCPEventV4{Timestamp: 123456789, Type: uint32(tracer.EventConnect), Pid: 4242,
+		SAddr: 0x0100007f, DAddr: 0x0100007f, SPort: 33000, DPort: 80, NetNS: 4026531993}
+	copy(e.Comm[:], "curl")
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		fmtTCPEventV4(&e)
+	}
+}
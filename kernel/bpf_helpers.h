@@ -57,6 +57,29 @@ static int (*bpf_skb_set_tunnel_key)(void *ctx, void *key, int size, int flags)
 //	(void *) BPF_FUNC_skb_set_tunnel_opt;
 static unsigned long long (*bpf_get_prandom_u32)(void) =
 	(void *) BPF_FUNC_get_prandom_u32;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
+static void *(*bpf_ringbuf_reserve)(void *ringbuf, unsigned long long size,
+				    unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_reserve;
+static void (*bpf_ringbuf_submit)(void *data, unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_submit;
+static void (*bpf_ringbuf_discard)(void *data, unsigned long long flags) =
+	(void *) BPF_FUNC_ringbuf_discard;
+#endif
+
+/* bpf_debug() prints to the trace_pipe in debug builds (make DEBUG=1) and
+ * compiles to nothing otherwise: bpf_trace_printk is serialized on a global
+ * buffer and far too slow for probes on hot paths.
+ */
+#ifdef DEBUG
+#define bpf_debug(fmt, ...)						\
+	({								\
+		char ____fmt[] = fmt;					\
+		bpf_trace_printk(____fmt, sizeof(____fmt), ##__VA_ARGS__); \
+	})
+#else
+#define bpf_debug(fmt, ...) ({})
+#endif
 
 /* llvm builtin functions that eBPF C program may use to
  * emit BPF_LD_ABS and BPF_LD_IND instructions
@@ -0,0 +1,173 @@
+#include <linux/kconfig.h>
+
+#include <linux/ptrace.h>
+#include <linux/version.h>
+#include <linux/bpf.h>
+#include "bpf_helpers.h"
+
+/* A program finding the offsets of the struct sock fields tcptracer-bpf
+ * objects read, for the loader to set in their tcptracer_status. It only
+ * needs the kernel headers for struct pt_regs, the offsets are what it
+ * looks for. Each connect of the loader makes it read the field being
+ * guessed at a whole batch of candidate offsets, see guessOffsetsBatched
+ * in tracer/guess_batch.go.
+ */
+
+/* Values of tcpTracerState and guessWhat in tracer/offsets.go */
+#define GUESS_CHECKING	1
+#define GUESS_CHECKED	2
+
+#define GUESS_SADDR		0
+#define GUESS_DADDR		1
+#define GUESS_FAMILY		2
+#define GUESS_SPORT		3
+#define GUESS_DPORT		4
+#define GUESS_NETNS		5
+#define GUESS_DADDR_IPV6	6
+
+/* Number of candidates per connect, guessBatchSize in
+ * tracer/guess_batch.go
+ */
+#define GUESS_BATCH	32
+
+/* Bytes read at each candidate, enough for an IPv6 address */
+#define GUESS_VALUE_SIZE	16
+
+/* tcpTracerStatusBatch in tracer/guess_batch.go: the tcpTracerStatus of
+ * tcptracer-bpf followed by the candidates and the values read at them.
+ * The single field values of tcpTracerStatus are not used here.
+ */
+struct tcptracer_status {
+	u64 status;
+	u64 pid_tgid;
+	u64 what;
+	u64 offset_saddr;
+	u64 offset_daddr;
+	u64 offset_sport;
+	u64 offset_dport;
+	u64 offset_netns;
+	u64 offset_ino;
+	u64 offset_family;
+	u64 offset_daddr_ipv6;
+	u8 err;
+	u32 saddr;
+	u32 daddr;
+	u16 sport;
+	u16 dport;
+	u32 netns;
+	u16 family;
+	u32 daddr_ipv6[4];
+
+	u16 candidates[GUESS_BATCH];
+	u16 ncandidates;
+	u8 pad[6];
+	u8 values[GUESS_BATCH][GUESS_VALUE_SIZE];
+};
+
+_Static_assert(sizeof(struct tcptracer_status) == 712,
+	       "struct tcptracer_status does not match tcpTracerStatusBatch");
+
+struct bpf_map_def SEC("maps/tcptracer_status") tcptracer_status = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__u64),
+	.value_size = sizeof(struct tcptracer_status),
+	.max_entries = 1,
+};
+
+/* The socket of the connects in flight of the loader, by pid_tgid */
+struct bpf_map_def SEC("maps/guess_connect") guess_connect = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__u64),
+	.value_size = sizeof(void *),
+	.max_entries = 16,
+};
+
+static __always_inline int guess_entry(struct pt_regs *ctx)
+{
+	u64 pid = bpf_get_current_pid_tgid();
+	void *skp = (void *) PT_REGS_PARM1(ctx);
+
+	bpf_map_update_elem(&guess_connect, &pid, &skp, BPF_ANY);
+	return 0;
+}
+
+/* Reads the field of what at every candidate offset of the socket of the
+ * connect returning, if it is one of the loader's. The values are read in
+ * the map value itself, it is too large for the stack. A read failing
+ * leaves zeros, which never match what the loader expects. For
+ * GUESS_NETNS the candidates are offsets of the inode number in the
+ * struct net at offset_netns, err tells the loader there is none.
+ */
+static __always_inline int guess_return(struct pt_regs *ctx, int ipv6)
+{
+	u64 pid = bpf_get_current_pid_tgid();
+	struct tcptracer_status *status;
+	void **skpp, *skp, *base;
+	u64 zero = 0;
+	int i;
+
+	skpp = bpf_map_lookup_elem(&guess_connect, &pid);
+	if (skpp == 0)
+		return 0;
+	skp = *skpp;
+	bpf_map_delete_elem(&guess_connect, &pid);
+
+	status = bpf_map_lookup_elem(&tcptracer_status, &zero);
+	if (status == 0 || status->status != GUESS_CHECKING || status->pid_tgid != pid)
+		return 0;
+	if ((status->what == GUESS_DADDR_IPV6) != ipv6)
+		return 0;
+
+	base = skp;
+	status->err = 0;
+	if (status->what == GUESS_NETNS) {
+		base = 0;
+		bpf_probe_read(&base, sizeof(base), skp + status->offset_netns);
+		if (base == 0) {
+			status->err = 1;
+			status->status = GUESS_CHECKED;
+			return 0;
+		}
+	}
+
+#pragma unroll
+	for (i = 0; i < GUESS_BATCH; i++) {
+		if (i >= status->ncandidates)
+			break;
+		bpf_probe_read(status->values[i], GUESS_VALUE_SIZE,
+			       base + status->candidates[i]);
+	}
+
+	status->status = GUESS_CHECKED;
+	return 0;
+}
+
+SEC("kprobe/tcp_v4_connect")
+int kprobe__tcp_v4_connect(struct pt_regs *ctx)
+{
+	return guess_entry(ctx);
+}
+
+SEC("kretprobe/tcp_v4_connect")
+int kretprobe__tcp_v4_connect(struct pt_regs *ctx)
+{
+	return guess_return(ctx, 0);
+}
+
+/* tcp_v6_connect sets skc_v6_daddr before it looks up a route, it is there
+ * even for connects failing with ENETUNREACH
+ */
+SEC("kprobe/tcp_v6_connect")
+int kprobe__tcp_v6_connect(struct pt_regs *ctx)
+{
+	return guess_entry(ctx);
+}
+
+SEC("kretprobe/tcp_v6_connect")
+int kretprobe__tcp_v6_connect(struct pt_regs *ctx)
+{
+	return guess_return(ctx, 1);
+}
+
+char _license[] SEC("license") = "GPL";
+__u32 _version SEC("version") = LINUX_VERSION_CODE;
@@ -1,6 +1,7 @@
 #include <linux/kconfig.h>
 
 #include <linux/ptrace.h>
+#include <linux/sched.h>
 #include <linux/version.h>
 #include <linux/bpf.h>
 #include "bpf_helpers.h"
@@ -9,87 +10,746 @@
 #include <net/inet_sock.h>
 #include <net/net_namespace.h>
 
-struct tcp_event_t {
-	u64 timestamp;
-	u64 cpu;
-	char ev_type[12];
+/* Values of the event type, they match EventType in main.go */
+#define TCP_EVENT_CONNECT	1
+#define TCP_EVENT_ACCEPT	2
+#define TCP_EVENT_CLOSE		3
+
+/* Versions of the compact layouts below, the second one without comm */
+#define TCP_EVENT_VERSION		2
+#define TCP_EVENT_VERSION_SHORT		3
+
+/* Compact event layouts, decoded by decodeTCPEventV4 and decodeTCPEventV6
+ * in tracer/decode.go. Packed so that a perf record, its 8 byte header and
+ * 4 byte size included, fits in 64 bytes for IPv4 and 88 for IPv6. weight
+ * is the number of events the record stands for once sampled and rate
+ * limited. The _short layouts leave out the comm, which userspace gets
+ * from pid_comm, and fit in 48 and 72 bytes.
+ */
+#define TCP_EVENT_BASE		\
+	u64 timestamp;		\
+	u8 version;		\
+	u8 type;		\
+	u16 sport;		\
+	u32 cpu;		\
+	u32 pid
+
+#define TCP_EVENT_HEADER	\
+	TCP_EVENT_BASE;		\
+	char comm[TASK_COMM_LEN]
+
+#define TCP_EVENT_V4_ADDRS	\
+	u32 saddr;		\
+	u32 daddr;		\
+	u16 dport;		\
+	u16 weight;		\
+	u32 netns
+
+#define TCP_EVENT_V6_ADDRS		\
+	struct in6_addr saddr;		\
+	struct in6_addr daddr;		\
+	u16 dport;			\
+	u16 weight;			\
+	u32 netns
+
+struct tcp_event_v4_t {
+	TCP_EVENT_HEADER;
+	TCP_EVENT_V4_ADDRS;
+} __attribute__((packed, aligned(4)));
+
+struct tcp_event_v6_t {
+	TCP_EVENT_HEADER;
+	TCP_EVENT_V6_ADDRS;
+} __attribute__((packed, aligned(4)));
+
+struct tcp_event_v4_short_t {
+	TCP_EVENT_BASE;
+	TCP_EVENT_V4_ADDRS;
+} __attribute__((packed, aligned(4)));
+
+struct tcp_event_v6_short_t {
+	TCP_EVENT_BASE;
+	TCP_EVENT_V6_ADDRS;
+} __attribute__((packed, aligned(4)));
+
+#if defined(AGGREGATE)
+/* Instead of one event per connect, count IPv4 connects per flow. Userspace
+ * reads and resets the counters periodically.
+ */
+struct flow_key {
 	u32 pid;
-	char comm[TASK_COMM_LEN];
 	u32 saddr;
 	u32 daddr;
-	u16 sport;
-	u16 dport;
 	u32 netns;
+	u16 dport;
+	u16 pad;
+};
+
+#ifndef FLOWS_MAX
+#define FLOWS_MAX 65536
+#endif
+
+struct bpf_map_def SEC("maps/tcp_flows") tcp_flows = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(struct flow_key),
+	.value_size = sizeof(__u64),
+	.max_entries = FLOWS_MAX,
+};
+#elif defined(USE_RINGBUF)
+/* One ring per address family shared by all CPUs, its size must be a power
+ * of 2 multiple of the page size. Records come out in reservation order.
+ */
+#ifndef RINGBUF_SIZE
+#define RINGBUF_SIZE (4 * 1024 * 1024)
+#endif
+
+struct bpf_map_def SEC("maps/tcp_event_ipv4") tcp_event_ipv4 = {
+	.type = BPF_MAP_TYPE_RINGBUF,
+	.key_size = 0,
+	.value_size = 0,
+	.max_entries = RINGBUF_SIZE,
+};
+
+struct bpf_map_def SEC("maps/tcp_event_ipv6") tcp_event_ipv6 = {
+	.type = BPF_MAP_TYPE_RINGBUF,
+	.key_size = 0,
+	.value_size = 0,
+	.max_entries = RINGBUF_SIZE,
+};
+#else
+/* max_entries is overwritten by the loader with the number of possible CPUs */
+struct bpf_map_def SEC("maps/tcp_event_ipv4") tcp_event_ipv4 = {
+	.type = BPF_MAP_TYPE_PERF_EVENT_ARRAY,
+	.key_size = sizeof(int),
+	.value_size = sizeof(__u32),
+	.max_entries = 16,
 };
 
-struct bpf_map_def SEC("maps/tcp_event") tcp_event = {
+struct bpf_map_def SEC("maps/tcp_event_ipv6") tcp_event_ipv6 = {
 	.type = BPF_MAP_TYPE_PERF_EVENT_ARRAY,
 	.key_size = sizeof(int),
 	.value_size = sizeof(__u32),
 	.max_entries = 16,
 };
+#endif
+
+/* Per-CPU counters of what the probes did, read by userspace. The indexes
+ * must match probeCounterNames in counters.go.
+ */
+enum probe_counter {
+	COUNTER_KPROBE_CALLS,
+	COUNTER_KRETPROBE_CALLS,
+	COUNTER_MISSED_ENTRY,
+	COUNTER_CONNECT_FAILED,
+	COUNTER_FILTERED,
+	COUNTER_EVENTS_SENT,
+	COUNTER_EVENTS_DROPPED,
+	COUNTER_ENTRY_DROPPED,
+	COUNTER_SAMPLED_OUT,
+	COUNTER_RATE_LIMITED,
+	COUNTER_COMM_OMITTED,
+	COUNTER_MAX,
+};
+
+struct bpf_map_def SEC("maps/probe_counters") probe_counters = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u64),
+	.max_entries = COUNTER_MAX,
+};
+
+static __always_inline void count(__u32 counter)
+{
+	__u64 *value = bpf_map_lookup_elem(&probe_counters, &counter);
+
+	if (value)
+		(*value)++;
+}
+
+/* Sockets of the connects in flight and when they started, keyed by
+ * thread. max_entries is overwritten by the loader from the cpu and thread
+ * count. With an LRU hash a full map evicts the oldest entries, e.g. those
+ * of threads killed inside connect, instead of refusing new ones.
+ */
+struct connect_start {
+	struct sock *sk;
+	u64 start_ns;
+};
 
 struct bpf_map_def SEC("maps/connectsock") connectsock = {
+#ifdef CONNECTSOCK_LRU
+	.type = BPF_MAP_TYPE_LRU_HASH,
+#else
 	.type = BPF_MAP_TYPE_HASH,
+#endif
 	.key_size = sizeof(__u64),
-	.value_size = sizeof(void *),
+	.value_size = sizeof(struct connect_start),
 	.max_entries = 128,
 };
 
-SEC("kretprobe/tcp_v4_connect")
-int kretprobe__tcp_v4_connect(struct pt_regs *ctx)
+/* log2 histograms of the time spent in tcp_v4_connect and tcp_v6_connect
+ * per netns and destination port, slot n counting the connects that took
+ * [2^n, 2^(n+1)) ns. Userspace reads and resets them periodically, see
+ * latency.go.
+ */
+struct latency_key {
+	u32 netns;
+	u16 dport;
+	u16 slot;
+};
+
+#ifndef LATENCY_MAX
+#define LATENCY_MAX 16384
+#endif
+
+struct bpf_map_def SEC("maps/connect_latency") connect_latency = {
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+	.key_size = sizeof(struct latency_key),
+	.value_size = sizeof(__u64),
+	.max_entries = LATENCY_MAX,
+};
+
+static __always_inline u32 log2_u32(u32 v)
+{
+	u32 r, shift;
+
+	r = (v > 0xffff) << 4; v >>= r;
+	shift = (v > 0xff) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xf) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static __always_inline u32 log2_u64(u64 v)
+{
+	u32 hi = v >> 32;
+
+	if (hi)
+		return log2_u32(hi) + 32;
+	return log2_u32(v);
+}
+
+/* Filters set by userspace, see filters.go. Each map holds the netns
+ * inodes, pids or destination ports (host order) explicitly allowed or
+ * denied. When filter_config says a map holds allowed values, only those
+ * pass, otherwise everything not denied does.
+ */
+#define FILTER_ALLOW	1
+#define FILTER_DENY	2
+
+#ifndef FILTER_MAX
+#define FILTER_MAX 1024
+#endif
+
+struct filter_config {
+	u32 allow_netns;
+	u32 allow_pid;
+	u32 allow_dport;
+};
+
+struct bpf_map_def SEC("maps/filter_config") filter_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct filter_config),
+	.max_entries = 1,
+};
+
+struct bpf_map_def SEC("maps/filter_netns") filter_netns = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u8),
+	.max_entries = FILTER_MAX,
+};
+
+struct bpf_map_def SEC("maps/filter_pid") filter_pid = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u8),
+	.max_entries = FILTER_MAX,
+};
+
+struct bpf_map_def SEC("maps/filter_dport") filter_dport = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(__u8),
+	.max_entries = FILTER_MAX,
+};
+
+static __always_inline int filter_pass(void *map, u32 value, u32 allowlist)
+{
+	u8 *action = bpf_map_lookup_elem(map, &value);
+
+	if (action)
+		return *action == FILTER_ALLOW;
+	return !allowlist;
+}
+
+/* Sampling and per-flow rate limiting, set by userspace. One event in
+ * sample_every is kept, then each flow may send one event per
+ * flow_interval_ns with bursts of up to flow_burst_ns worth of them. A
+ * flow is the addresses, destination port and netns, without the source
+ * port so that connect retries count as one flow.
+ */
+struct sampling_config {
+	u64 flow_interval_ns;	/* 0 for no rate limit */
+	u64 flow_burst_ns;
+	u32 sample_every;	/* 0 or 1 to keep all events */
+	u32 pad;
+};
+
+struct bpf_map_def SEC("maps/sampling_config") sampling_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct sampling_config),
+	.max_entries = 1,
+};
+
+struct flow_rate_key {
+	struct in6_addr saddr;
+	struct in6_addr daddr;
+	u32 netns;
+	u16 dport;
+	u16 family;
+};
+
+/* tat is the theoretical arrival time of the next event (GCRA), suppressed
+ * the weight of the events dropped since the last one sent.
+ */
+struct flow_rate {
+	u64 tat;
+	u32 suppressed;
+	u32 pad;
+};
+
+#ifndef FLOW_RATE_MAX
+#define FLOW_RATE_MAX 16384
+#endif
+
+/* Per CPU, so the buckets need no atomics, but a flow spread over several
+ * CPUs gets up to one rate per CPU.
+ */
+struct bpf_map_def SEC("maps/flow_rate") flow_rate = {
+	.type = BPF_MAP_TYPE_LRU_PERCPU_HASH,
+	.key_size = sizeof(struct flow_rate_key),
+	.value_size = sizeof(struct flow_rate),
+	.max_entries = FLOW_RATE_MAX,
+};
+
+/* With omit set by userspace, the comm of a process is sent with its first
+ * event only and stored in pid_comm, its other events use the _short
+ * layouts. An entry is removed when the process changes its comm, on exec
+ * or prctl(PR_SET_NAME), and when it exits, so that the next event carries
+ * the comm again.
+ */
+struct comm_config {
+	u32 omit;
+	u32 pad;
+};
+
+struct bpf_map_def SEC("maps/comm_config") comm_config = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct comm_config),
+	.max_entries = 1,
+};
+
+struct pid_comm {
+	char comm[TASK_COMM_LEN];
+};
+
+#ifndef PID_COMM_MAX
+#define PID_COMM_MAX 16384
+#endif
+
+struct bpf_map_def SEC("maps/pid_comm") pid_comm = {
+	.type = BPF_MAP_TYPE_LRU_HASH,
+	.key_size = sizeof(__u32),
+	.value_size = sizeof(struct pid_comm),
+	.max_entries = PID_COMM_MAX,
+};
+
+/* Returns whether the event of process tgid has to carry the comm. The
+ * comm of a process is the one of the thread sending its first event.
+ */
+static __always_inline int comm_needed(u32 tgid)
+{
+	struct comm_config *cfg;
+	struct pid_comm pc = {};
+	u32 zero = 0;
+
+	cfg = bpf_map_lookup_elem(&comm_config, &zero);
+	if (cfg == 0 || !cfg->omit)
+		return 1;
+
+	if (bpf_map_lookup_elem(&pid_comm, &tgid)) {
+		count(COUNTER_COMM_OMITTED);
+		return 0;
+	}
+
+	bpf_get_current_comm(&pc.comm, sizeof(pc.comm));
+	bpf_map_update_elem(&pid_comm, &tgid, &pc, BPF_ANY);
+	return 1;
+}
+
+/* Returns whether the flow may send an event now. If so, *weight is scaled
+ * up by the events the flow was denied since its last one.
+ */
+static __always_inline int rate_limit(struct sampling_config *cfg,
+				      struct flow_rate_key *key, u32 *weight)
+{
+	struct flow_rate *fr, init = {};
+	u64 now, tat;
+
+	if (cfg->flow_interval_ns == 0)
+		return 1;
+
+	now = bpf_ktime_get_ns();
+	fr = bpf_map_lookup_elem(&flow_rate, key);
+	if (fr == 0) {
+		init.tat = now + cfg->flow_interval_ns;
+		bpf_map_update_elem(&flow_rate, key, &init, BPF_ANY);
+		return 1;
+	}
+
+	tat = fr->tat > now ? fr->tat : now;
+	tat += cfg->flow_interval_ns;
+	if (tat - now > cfg->flow_burst_ns) {
+		fr->suppressed += *weight;
+		count(COUNTER_RATE_LIMITED);
+		return 0;
+	}
+	fr->tat = tat;
+
+	*weight += fr->suppressed;
+	fr->suppressed = 0;
+	if (*weight > 0xffff)
+		*weight = 0xffff;
+	return 1;
+}
+
+/* The start of struct sock_common, from skc_addrpair to skc_family, read
+ * with a single bpf_probe_read.
+ */
+struct sock_addrs {
+	__be32 daddr;
+	__be32 rcv_saddr;
+	unsigned int hash;
+	__be16 dport;
+	__u16 num;
+	unsigned short family;
+};
+
+#define sock_addrs_offset(f) \
+	(offsetof(struct sock_common, f) - offsetof(struct sock_common, skc_daddr))
+
+_Static_assert(sock_addrs_offset(skc_rcv_saddr) == offsetof(struct sock_addrs, rcv_saddr),
+	       "struct sock_addrs does not match struct sock_common");
+_Static_assert(sock_addrs_offset(skc_dport) == offsetof(struct sock_addrs, dport),
+	       "struct sock_addrs does not match struct sock_common");
+_Static_assert(sock_addrs_offset(skc_num) == offsetof(struct sock_addrs, num),
+	       "struct sock_addrs does not match struct sock_common");
+_Static_assert(sock_addrs_offset(skc_family) == offsetof(struct sock_addrs, family),
+	       "struct sock_addrs does not match struct sock_common");
+
+/* skc_v6_daddr and skc_v6_rcv_saddr, read together for IPv6 sockets */
+struct sock_addrs_v6 {
+	struct in6_addr daddr;
+	struct in6_addr rcv_saddr;
+};
+
+_Static_assert(offsetof(struct sock_common, skc_v6_rcv_saddr) -
+	       offsetof(struct sock_common, skc_v6_daddr) ==
+	       offsetof(struct sock_addrs_v6, rcv_saddr),
+	       "struct sock_addrs_v6 does not match struct sock_common");
+
+/* Fills the fields all layouts have. skc_num is the local port in host
+ * order, inet_sport is htons(skc_num) once the socket is bound.
+ */
+#define fill_event_base(evt, ev_type, pid, addrs, w, v) do {	\
+		(evt)->timestamp = bpf_ktime_get_ns();			\
+		(evt)->version = (v);					\
+		(evt)->type = (ev_type);				\
+		(evt)->sport = (addrs)->num;				\
+		(evt)->cpu = bpf_get_smp_processor_id();		\
+		(evt)->pid = (pid) >> 32;				\
+		(evt)->dport = ntohs((addrs)->dport);			\
+		(evt)->weight = (w);					\
+	} while (0)
+
+#define fill_event_header(evt, ev_type, pid, addrs, w) do {	\
+		fill_event_base(evt, ev_type, pid, addrs, w, TCP_EVENT_VERSION); \
+		bpf_get_current_comm(&(evt)->comm, sizeof((evt)->comm)); \
+	} while (0)
+
+#define fill_event_short(evt, ev_type, pid, addrs, w) \
+	fill_event_base(evt, ev_type, pid, addrs, w, TCP_EVENT_VERSION_SHORT)
+
+#ifdef USE_RINGBUF
+#define reserve_event(map, evt, evt_buf) \
+	((evt) = bpf_ringbuf_reserve(map, sizeof(*(evt)), 0))
+#define submit_event(ctx, map, evt) \
+	(bpf_ringbuf_submit(evt, 0), 0)
+#else
+#define reserve_event(map, evt, evt_buf) \
+	((evt) = &(evt_buf))
+#define submit_event(ctx, map, evt) \
+	bpf_perf_event_output(ctx, map, BPF_F_CURRENT_CPU, evt, sizeof(*(evt)))
+#endif
+
+/* Builds an event of struct layout with fill and sends it to map. Returns
+ * 0 once sent, else the ring is full.
+ */
+#define emit_event(ctx, map, layout, fill, ev_type, pid, addrs, w, sa, da, ns) ({ \
+		struct layout evt_buf __attribute__((aligned(8))) = {};	\
+		struct layout *evt;						\
+		int r = -1;							\
+		if (reserve_event(map, evt, evt_buf)) {			\
+			fill(evt, ev_type, pid, addrs, w);			\
+			evt->saddr = (sa);					\
+			evt->daddr = (da);					\
+			evt->netns = (ns);					\
+			r = submit_event(ctx, map, evt);			\
+		}								\
+		r;								\
+	})
+
+/* The addresses, ports and network namespace of a socket */
+struct sock_info {
+	struct sock_addrs addrs;
+	u32 netns;
+};
+
+static __always_inline void read_sock_addrs(struct sock *skp, struct sock_addrs *addrs)
+{
+	bpf_probe_read(addrs, sizeof(*addrs), &skp->__sk_common.skc_daddr);
+}
+
+static __always_inline void read_sock_netns(struct sock *skp, u32 *netns)
+{
+	possible_net_t skc_net;
+
+	bpf_probe_read(&skc_net, sizeof(skc_net), &skp->__sk_common.skc_net);
+	bpf_probe_read(netns, sizeof(*netns), &skc_net.net->ns.inum);
+}
+
+/* send_event builds and sends the event of type ev_type for the socket skp,
+ * picking the layout and the map from the socket's address family. Sockets
+ * without addresses or ports, e.g. closed before they got connected, are
+ * skipped. known holds the addresses and netns of skp when the caller read
+ * them already, else they are read here once past the filters that need
+ * no probe read.
+ */
+static __always_inline void send_event(struct pt_regs *ctx, struct sock *skp,
+				       u8 ev_type, u64 pid, struct sock_info *known)
+{
+	struct sock_info info = {};
+	struct filter_config *filters;
+	u32 zero = 0;
+
+	filters = bpf_map_lookup_elem(&filter_config, &zero);
+	if (filters == 0)
+		return;
+
+	// cheapest first, the pid needs no probe read
+	if (!filter_pass(&filter_pid, pid >> 32, filters->allow_pid)) {
+		count(COUNTER_FILTERED);
+		return;
+	}
+
+	if (known)
+		info = *known;
+	else
+		read_sock_addrs(skp, &info.addrs);
+
+	if (info.addrs.num == 0 || info.addrs.dport == 0 ||
+	    (info.addrs.family != AF_INET && info.addrs.family != AF_INET6) ||
+	    !filter_pass(&filter_dport, ntohs(info.addrs.dport), filters->allow_dport)) {
+		count(COUNTER_FILTERED);
+		return;
+	}
+
+	if (!known)
+		read_sock_netns(skp, &info.netns);
+
+	if (!filter_pass(&filter_netns, info.netns, filters->allow_netns)) {
+		count(COUNTER_FILTERED);
+		return;
+	}
+
+#ifdef AGGREGATE
+	struct flow_key key = {};
+	u64 one = 1, *cnt;
+
+	if (ev_type != TCP_EVENT_CONNECT || info.addrs.family != AF_INET ||
+	    info.addrs.rcv_saddr == 0 || info.addrs.daddr == 0) {
+		count(COUNTER_FILTERED);
+		return;
+	}
+
+	key.pid = pid >> 32;
+	key.saddr = info.addrs.rcv_saddr;
+	key.daddr = info.addrs.daddr;
+	key.netns = info.netns;
+	key.dport = ntohs(info.addrs.dport);
+
+	cnt = bpf_map_lookup_elem(&tcp_flows, &key);
+	if (cnt == 0 && bpf_map_update_elem(&tcp_flows, &key, &one, BPF_NOEXIST) == 0) {
+		count(COUNTER_EVENTS_SENT);
+	} else {
+		// created by another cpu in the meantime
+		if (cnt == 0)
+			cnt = bpf_map_lookup_elem(&tcp_flows, &key);
+		if (cnt) {
+			(*cnt)++;
+			count(COUNTER_EVENTS_SENT);
+		} else {
+			count(COUNTER_EVENTS_DROPPED);	// map full
+		}
+	}
+#else
+	struct sampling_config *sampling;
+	struct flow_rate_key flow = {};
+	u32 weight = 1;
+	int ret;
+
+	sampling = bpf_map_lookup_elem(&sampling_config, &zero);
+	if (sampling == 0)
+		return;
+
+	if (sampling->sample_every > 1) {
+		if (bpf_get_prandom_u32() % sampling->sample_every != 0) {
+			count(COUNTER_SAMPLED_OUT);
+			return;
+		}
+		weight = sampling->sample_every;
+	}
+
+	flow.netns = info.netns;
+	flow.dport = info.addrs.dport;
+	flow.family = info.addrs.family;
+
+	// stack accesses must be aligned to their size, the layouts are
+	// not: emit_event aligns its buffer
+	if (info.addrs.family == AF_INET) {
+		if (info.addrs.rcv_saddr == 0 || info.addrs.daddr == 0) {
+			count(COUNTER_FILTERED);
+			return;
+		}
+
+		flow.saddr.s6_addr32[0] = info.addrs.rcv_saddr;
+		flow.daddr.s6_addr32[0] = info.addrs.daddr;
+		if (!rate_limit(sampling, &flow, &weight))
+			return;
+
+		if (comm_needed(pid >> 32))
+			ret = emit_event(ctx, &tcp_event_ipv4, tcp_event_v4_t, fill_event_header,
+					 ev_type, pid, &info.addrs, weight,
+					 info.addrs.rcv_saddr, info.addrs.daddr, info.netns);
+		else
+			ret = emit_event(ctx, &tcp_event_ipv4, tcp_event_v4_short_t, fill_event_short,
+					 ev_type, pid, &info.addrs, weight,
+					 info.addrs.rcv_saddr, info.addrs.daddr, info.netns);
+	} else {
+		struct sock_addrs_v6 addrs6 = {};
+
+		bpf_probe_read(&addrs6, sizeof(addrs6), &skp->__sk_common.skc_v6_daddr);
+		if ((addrs6.daddr.s6_addr32[0] | addrs6.daddr.s6_addr32[1] |
+		     addrs6.daddr.s6_addr32[2] | addrs6.daddr.s6_addr32[3]) == 0) {
+			count(COUNTER_FILTERED);
+			return;
+		}
+
+		flow.saddr = addrs6.rcv_saddr;
+		flow.daddr = addrs6.daddr;
+		if (!rate_limit(sampling, &flow, &weight))
+			return;
+
+		if (comm_needed(pid >> 32))
+			ret = emit_event(ctx, &tcp_event_ipv6, tcp_event_v6_t, fill_event_header,
+					 ev_type, pid, &info.addrs, weight,
+					 addrs6.rcv_saddr, addrs6.daddr, info.netns);
+		else
+			ret = emit_event(ctx, &tcp_event_ipv6, tcp_event_v6_short_t, fill_event_short,
+					 ev_type, pid, &info.addrs, weight,
+					 addrs6.rcv_saddr, addrs6.daddr, info.netns);
+	}
+
+	if (ret == 0)
+		count(COUNTER_EVENTS_SENT);
+	else
+		count(COUNTER_EVENTS_DROPPED);	// ring full
+#endif /* AGGREGATE */
+}
+
+/* On entry of tcp_v4_connect and tcp_v6_connect the socket has no
+ * addresses yet, remember it until the function returns.
+ */
+static __always_inline int connect_entry(struct pt_regs *ctx)
+{
+	struct connect_start start = {};
+	u64 pid = bpf_get_current_pid_tgid();
+
+	count(COUNTER_KPROBE_CALLS);
+	bpf_debug("kprobe/tcp_connect called\n");
+
+	start.sk = (struct sock *) PT_REGS_PARM1(ctx);
+	start.start_ns = bpf_ktime_get_ns();
+
+	if (bpf_map_update_elem(&connectsock, &pid, &start, BPF_ANY) != 0)
+		count(COUNTER_ENTRY_DROPPED);	// map full
+
+	return 0;
+}
+
+/* Counts a connect to dport, in host order, in netns that took delta ns in
+ * its histogram.
+ */
+static __always_inline void record_latency(u16 dport, u32 netns, u64 delta)
+{
+	struct latency_key key = {};
+	u64 one = 1, *cnt;
+
+	key.netns = netns;
+	key.dport = dport;
+	key.slot = log2_u64(delta);
+
+	cnt = bpf_map_lookup_elem(&connect_latency, &key);
+	if (cnt)
+		(*cnt)++;
+	else
+		bpf_map_update_elem(&connect_latency, &key, &one, BPF_NOEXIST);
+}
+
+static __always_inline int connect_return(struct pt_regs *ctx)
 {
 	int ret = PT_REGS_RC(ctx);
 	u64 pid = bpf_get_current_pid_tgid();
-	struct sock **skpp;
-	char called_msg[] = "kretprobe/tcp_v4_connect called\n";
+	struct connect_start *start;
+	struct sock_info info = {};
 
-	skpp = bpf_map_lookup_elem(&connectsock, &pid);
-	if (skpp == 0) {
+	count(COUNTER_KRETPROBE_CALLS);
+
+	start = bpf_map_lookup_elem(&connectsock, &pid);
+	if (start == 0) {
+		count(COUNTER_MISSED_ENTRY);
 		return 0;	// missed entry
 	}
 
 	if (ret != 0) {
+		count(COUNTER_CONNECT_FAILED);
 		// failed to send SYNC packet, may not have populated
 		// socket __sk_common.{skc_rcv_saddr, ...}
 		bpf_map_delete_elem(&connectsock, &pid);
 		return 0;
 	}
 
-	// pull in details
-	struct sock *skp = *skpp;
-	struct ns_common *ns;
-	u32 saddr = 0, daddr = 0, net_ns_inum = 0;
-	u16 sport = 0, dport = 0;
-	bpf_probe_read(&sport, sizeof(sport), &((struct inet_sock *)skp)->inet_sport);
-	bpf_probe_read(&saddr, sizeof(saddr), &skp->__sk_common.skc_rcv_saddr);
-	bpf_probe_read(&daddr, sizeof(daddr), &skp->__sk_common.skc_daddr);
-	bpf_probe_read(&dport, sizeof(dport), &skp->__sk_common.skc_dport);
-
-	// Get network namespace id
-	possible_net_t skc_net;
-	bpf_probe_read(&skc_net, sizeof(skc_net), &skp->__sk_common.skc_net);
-	bpf_probe_read(&net_ns_inum, sizeof(net_ns_inum), &skc_net.net->ns.inum);
-
-	// output
-	struct tcp_event_t evt = {
-		.timestamp = bpf_ktime_get_ns(),
-		.cpu = bpf_get_smp_processor_id(),
-		.ev_type = "connect",
-		.pid = pid >> 32,
-		.saddr = saddr,
-		.daddr = daddr,
-		.sport = ntohs(sport),
-		.dport = ntohs(dport),
-		.netns = net_ns_inum,
-	};
-
-	bpf_get_current_comm(&evt.comm, sizeof(evt.comm));
-
-	// do not send event if IP address is 0.0.0.0 or port is 0
-	if (evt.saddr != 0 && evt.daddr != 0 && evt.sport != 0 && evt.dport != 0) {
-		bpf_perf_event_output(ctx, &tcp_event, BPF_F_CURRENT_CPU, &evt, sizeof(evt));
-	}
+	// read once for both the histogram and the event
+	read_sock_addrs(start->sk, &info.addrs);
+	read_sock_netns(start->sk, &info.netns);
+	record_latency(ntohs(info.addrs.dport), info.netns,
+		       bpf_ktime_get_ns() - start->start_ns);
+	send_event(ctx, start->sk, TCP_EVENT_CONNECT, pid, &info);
 
 	bpf_map_delete_elem(&connectsock, &pid);
 
@@ -99,18 +759,83 @@ int kretprobe__tcp_v4_connect(struct pt_regs *ctx)
 SEC("kprobe/tcp_v4_connect")
 int kprobe__tcp_v4_connect(struct pt_regs *ctx)
 {
-	struct sock *sk;
-	u64 pid = bpf_get_current_pid_tgid();
-	char called_msg[] = "kprobe/tcp_v4_connect called\n";
+	return connect_entry(ctx);
+}
 
-	bpf_trace_printk(called_msg, sizeof(called_msg));
+SEC("kretprobe/tcp_v4_connect")
+int kretprobe__tcp_v4_connect(struct pt_regs *ctx)
+{
+	return connect_return(ctx);
+}
+
+#ifndef AGGREGATE
+SEC("kprobe/tcp_v6_connect")
+int kprobe__tcp_v6_connect(struct pt_regs *ctx)
+{
+	return connect_entry(ctx);
+}
 
-	sk = (struct sock *) PT_REGS_PARM1(ctx);
+SEC("kretprobe/tcp_v6_connect")
+int kretprobe__tcp_v6_connect(struct pt_regs *ctx)
+{
+	return connect_return(ctx);
+}
+
+SEC("kretprobe/inet_csk_accept")
+int kretprobe__inet_csk_accept(struct pt_regs *ctx)
+{
+	struct sock *newsk = (struct sock *) PT_REGS_RC(ctx);
+
+	count(COUNTER_KRETPROBE_CALLS);
+
+	if (newsk == 0)
+		return 0;
+
+	send_event(ctx, newsk, TCP_EVENT_ACCEPT, bpf_get_current_pid_tgid(), 0);
+
+	return 0;
+}
+
+SEC("kprobe/tcp_close")
+int kprobe__tcp_close(struct pt_regs *ctx)
+{
+	struct sock *sk = (struct sock *) PT_REGS_PARM1(ctx);
+
+	count(COUNTER_KPROBE_CALLS);
+
+	send_event(ctx, sk, TCP_EVENT_CLOSE, bpf_get_current_pid_tgid(), 0);
+
+	return 0;
+}
+
+/* A process gets a new comm on exec and prctl(PR_SET_NAME), the task may
+ * not be the current one when written to through /proc.
+ */
+SEC("kprobe/__set_task_comm")
+int kprobe____set_task_comm(struct pt_regs *ctx)
+{
+	struct task_struct *tsk = (struct task_struct *) PT_REGS_PARM1(ctx);
+	u32 tgid = 0;
+
+	bpf_probe_read(&tgid, sizeof(tgid), &tsk->tgid);
+	bpf_map_delete_elem(&pid_comm, &tgid);
+
+	return 0;
+}
+
+/* Only the exit of the thread group leader frees the pid of the process */
+SEC("kprobe/do_exit")
+int kprobe__do_exit(struct pt_regs *ctx)
+{
+	u64 pid = bpf_get_current_pid_tgid();
+	u32 tgid = pid >> 32;
 
-	bpf_map_update_elem(&connectsock, &pid, &sk, BPF_ANY);
+	if ((u32) pid == tgid)
+		bpf_map_delete_elem(&pid_comm, &tgid);
 
 	return 0;
 }
+#endif /* AGGREGATE */
 
 char _license[] SEC("license") = "GPL";
 __u32 _version SEC("version") = LINUX_VERSION_CODE;
@@ -0,0 +1,144 @@
+package main
+
+import (
+	"sort"
+	"strconv"
+	"time"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// latencySlots is the number of log2 slots of a connect latency histogram
+const latencySlots = 64
+
+// latencyKey mirrors struct latency_key of the kernel program
+type latencyKey struct {
+	NetNS uint32
+	DPort uint16
+	Slot  uint16
+}
+
+// latencyDest is what a histogram is kept for
+type latencyDest struct {
+	NetNS uint32
+	DPort uint16
+}
+
+// latencyHistograms sums the counts of the connect_latency map by
+// destination, as the map holds one counter per slot of a histogram.
+type latencyHistograms struct {
+	hist map[latencyDest]*[latencySlots]uint64
+	buf  []byte
+}
+
+// newLatencyCollector returns a collector of the connect latency
+// histograms of the connect_latency map, printing one line per destination
+// connected to during the interval.
+func newLatencyCollector(mp *elf.Map, interval time.Duration) (*mapCollector, error) {
+	mc, err := newMapCollector(mp, int(unsafe.Sizeof(latencyKey{})), interval, "connect latencies")
+	if err != nil {
+		return nil, err
+	}
+	lh := &latencyHistograms{hist: make(map[latencyDest]*[latencySlots]uint64)}
+	mc.print = lh.add
+	mc.flush = lh.flush
+	return mc, nil
+}
+
+func (lh *latencyHistograms) add(timestamp uint64, key []byte, count uint64) {
+	k := (*latencyKey)(unsafe.Pointer(&key[0]))
+	if k.Slot >= latencySlots {
+		return
+	}
+
+	dest := latencyDest{k.NetNS, k.DPort}
+	h := lh.hist[dest]
+	if h == nil {
+		h = new([latencySlots]uint64)
+		lh.hist[dest] = h
+	}
+	h[k.Slot] += count
+}
+
+// flush prints and resets the histograms, ordered by destination.
+func (lh *latencyHistograms) flush(timestamp uint64) {
+	dests := make([]latencyDest, 0, len(lh.hist))
+	for dest := range lh.hist {
+		dests = append(dests, dest)
+	}
+	sort.Slice(dests, func(i, j int) bool {
+		if dests[i].NetNS != dests[j].NetNS {
+			return dests[i].NetNS < dests[j].NetNS
+		}
+		return dests[i].DPort < dests[j].DPort
+	})
+	for _, dest := range dests {
+		h := lh.hist[dest]
+		if binaryOutput {
+			for slot, count := range h {
+				if count > 0 {
+					lh.buf = encodeLatency(lh.buf[:0], timestamp, dest, slot, count)
+					output.Write(lh.buf)
+				}
+			}
+		} else {
+			lh.buf = appendLatency(lh.buf[:0], timestamp, dest, h)
+			output.Write(lh.buf)
+		}
+		delete(lh.hist, dest)
+	}
+}
+
+// latencyQuantile returns the upper bound of the slot holding the q-th
+// quantile of h, count being the sum of h.
+func latencyQuantile(h *[latencySlots]uint64, count uint64, q float64) time.Duration {
+	rank := uint64(q * float64(count))
+	var seen uint64
+	for slot, n := range h {
+		seen += n
+		if seen > rank {
+			return slotUpperBound(slot)
+		}
+	}
+	return slotUpperBound(latencySlots - 1)
+}
+
+func slotUpperBound(slot int) time.Duration {
+	if slot >= 62 {
+		return time.Duration(1<<63 - 1)
+	}
+	return time.Duration(uint64(2) << uint(slot))
+}
+
+// appendLatency formats a histogram as its count, median and 99th
+// percentile followed by the non-empty slots, named after their lower
+// bound.
+func appendLatency(buf []byte, timestamp uint64, dest latencyDest, h *[latencySlots]uint64) []byte {
+	var count uint64
+	for _, n := range h {
+		count += n
+	}
+
+	buf = strconv.AppendUint(buf, timestamp, 10)
+	buf = append(buf, " latency "...)
+	buf = strconv.AppendUint(buf, uint64(dest.NetNS), 10)
+	buf = append(buf, ' ')
+	buf = strconv.AppendUint(buf, uint64(dest.DPort), 10)
+	buf = append(buf, " count="...)
+	buf = strconv.AppendUint(buf, count, 10)
+	buf = append(buf, " p50<"...)
+	buf = append(buf, latencyQuantile(h, count, 0.5).String()...)
+	buf = append(buf, " p99<"...)
+	buf = append(buf, latencyQuantile(h, count, 0.99).String()...)
+	for slot, n := range h {
+		if n == 0 {
+			continue
+		}
+		buf = append(buf, ' ')
+		buf = append(buf, time.Duration(uint64(1)<<uint(slot)).String()...)
+		buf = append(buf, '=')
+		buf = strconv.AppendUint(buf, n, 10)
+	}
+	return append(buf, '\n')
+}
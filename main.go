@@ -1,506 +1,287 @@
 package main
 
 import (
-	"bytes"
-	"encoding/binary"
+	"flag"
 	"fmt"
-	"math/rand"
-	"net"
+	"io"
 	"os"
 	"os/signal"
-	"strconv"
 	"strings"
 	"syscall"
 	"time"
-	"unsafe"
 
-	"github.com/iovisor/gobpf/elf"
+	"github.com/kinvolk/gobpf-elf-loader/spool"
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
 )
 
-type EventType uint32
-
-const (
-	_ EventType = iota
-	EventConnect
-	EventAccept
-	EventClose
+// output is the single buffered output stage shared by the consumers
+var output *batchWriter
+
+var (
+	flushSize      = flag.Int("flush-size", 1<<20, "flush the output once this many bytes are buffered")
+	flushInterval  = flag.Duration("flush-interval", 100*time.Millisecond, "flush the output at least this often")
+	perfPages      = flag.Int("perf-pages", 8, "size of each per-cpu perf ring in pages, must be a power of 2")
+	reorderWindow  = flag.Duration("reorder-window", 10*time.Millisecond, "how long perf samples are held to put them back in order")
+	reorderMax     = flag.Int("reorder-max", 65536, "maximum number of perf samples held for reordering")
+	flowsInterval  = flag.Duration("flows-interval", 10*time.Second, "how often per-flow counters are collected, for objects aggregating in the kernel")
+	histInterval   = flag.Duration("latency-interval", 10*time.Second, "how often the connect latency histograms are printed, 0 to disable")
+	useBTF         = flag.Bool("btf", true, "resolve struct offsets from "+tracer.BTFVmlinuxPath+" when available instead of guessing them")
+	offsetCacheDir = flag.String("offset-cache", "/var/cache/gobpf-elf-loader", "directory caching the guessed offsets per kernel, empty to disable")
+	guessObject    = flag.String("guess-object", "", "guess the offsets with this object, like kernel/offset_guess_kern.o, testing many per connect")
+	outputDest     = flag.String("output", "-", "where the events go, - for stdout or unix:PATH for a Unix socket")
+	outputFormat   = flag.String("output-format", "text", "text, or binary for the length-prefixed records of package stream")
+	outputCompress = flag.Bool("output-compress", false, "deflate each block of the binary output")
+	fastStart      = flag.Bool("fast-start", false, "set up the event sources while the struct offsets are resolved")
+	spoolDir       = flag.String("spool", "", "append the binary records to memory-mapped segment files in this directory instead of -output")
+	spoolSegment   = flag.Int("spool-segment-size", 64<<20, "size of each spool segment in bytes")
+	spoolSegments  = flag.Int("spool-segments", 16, "number of spool segments kept, 0 to keep them all")
+
+	perfWakeupEvents   = flag.Int("perf-wakeup-events", 1, "wake up the reader every this many samples per perf ring")
+	perfWakeupBytes    = flag.Int("perf-wakeup-bytes", 0, "wake up the reader when a perf ring holds this many bytes, instead of counting samples")
+	perfMaxLatency     = flag.Duration("perf-max-latency", 100*time.Millisecond, "read the perf rings and ring buffers at least this often, bounding latency when wakeups are batched")
+	perfReaders        = flag.Int("perf-readers", 1, "number of goroutines reading the perf rings of each map, their streams are merged")
+	unordered          = flag.Bool("unordered", false, "print the perf samples as they are read, without reordering nor merging them")
+	commOnce           = flag.Bool("comm-once", false, "send the comm of a process with its first event only, the loader remembers it for the others")
+	batchSize          = flag.Int("batch-size", 256, "maximum number of samples handed to the consumer at once, 1 for one at a time")
+	statsInterval      = flag.Duration("stats-interval", 0, "print event, byte and lost sample rates to stderr this often, 0 to disable")
+	connectsockEntries = flag.Int("connectsock-entries", 0, "size of the map holding connects in flight, 0 to size it from the cpu and thread count")
+	sampleEvery        = flag.Int("sample-every", 1, "keep one event in this many, chosen at random in the kernel")
+	flowRate           = flag.Float64("flow-rate", 0, "maximum events per second per flow and cpu sent by the kernel, 0 for no limit")
+	flowBurst          = flag.Int("flow-burst", 10, "number of events a flow may send at once above -flow-rate")
+	filterFile         = flag.String("filters", "", "file of \"allow|deny netns|pid|dport value\" rules applied in the kernel, reloaded on SIGHUP")
 )
 
-func (e EventType) String() string {
-	switch e {
-	case EventConnect:
-		return "connect"
-	case EventAccept:
-		return "accept"
-	case EventClose:
-		return "close"
-	default:
-		return "unknown"
+func main() {
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: %s [options] ${GOPATH}/src/github.com/kinvolk/tcptracer-bpf/ebpf/ebpf.o\n", os.Args[0])
+		flag.PrintDefaults()
 	}
-}
-
-type tcpEventV4 struct {
-	// Timestamp must be the first field, the sorting depends on it
-	Timestamp uint64
-
-	Cpu   uint64
-	Type  uint32
-	Pid   uint32
-	Comm  [16]byte
-	SAddr uint32
-	DAddr uint32
-	SPort uint16
-	DPort uint16
-	NetNS uint32
-}
-
-type tcpEventV6 struct {
-	// Timestamp must be the first field, the sorting depends on it
-	Timestamp uint64
-
-	Cpu    uint64
-	Type   uint32
-	Pid    uint32
-	Comm   [16]byte
-	SAddrH uint64
-	SAddrL uint64
-	DAddrH uint64
-	DAddrL uint64
-	SPort  uint16
-	DPort  uint16
-	NetNS  uint32
-}
-
-var byteOrder binary.ByteOrder
-
-// In lack of binary.HostEndian ...
-func init() {
-	var i int32 = 0x01020304
-	u := unsafe.Pointer(&i)
-	pb := (*byte)(u)
-	b := *pb
-	if b == 0x04 {
-		byteOrder = binary.LittleEndian
-	} else {
-		byteOrder = binary.BigEndian
+	flag.Parse()
+	if flag.NArg() != 1 {
+		flag.Usage()
+		os.Exit(1)
 	}
-}
-
-var lastTimestampV4 uint64
-var lastTimestampV6 uint64
-
-func tcpEventCbV4(event tcpEventV4) {
-	timestamp := uint64(event.Timestamp)
-	cpu := event.Cpu
-	typ := EventType(event.Type)
-	pid := event.Pid & 0xffffffff
-	comm := string(event.Comm[:bytes.IndexByte(event.Comm[:], 0)])
-
-	saddrbuf := make([]byte, 4)
-	daddrbuf := make([]byte, 4)
-
-	binary.LittleEndian.PutUint32(saddrbuf, uint32(event.SAddr))
-	binary.LittleEndian.PutUint32(daddrbuf, uint32(event.DAddr))
+	fileName := flag.Arg(0)
+	startup := newStartupTimer()
 
-	sIP := net.IPv4(saddrbuf[0], saddrbuf[1], saddrbuf[2], saddrbuf[3])
-	dIP := net.IPv4(daddrbuf[0], daddrbuf[1], daddrbuf[2], daddrbuf[3])
-
-	sport := event.SPort
-	dport := event.DPort
-	netns := event.NetNS
-
-	fmt.Printf("%v cpu#%d %s %v %q %v:%v %v:%v %v\n", timestamp, cpu, typ, pid, comm, sIP, sport, dIP, dport, netns)
-
-	if lastTimestampV4 > timestamp {
-		fmt.Printf("ERROR: late event!\n")
+	switch *outputFormat {
+	case "text":
+		if *outputCompress {
+			fmt.Fprintf(os.Stderr, "-output-compress needs -output-format binary\n")
+			os.Exit(1)
+		}
+	case "binary":
+		binaryOutput = true
+	default:
+		fmt.Fprintf(os.Stderr, "invalid output format %q\n", *outputFormat)
 		os.Exit(1)
 	}
-
-	lastTimestampV4 = timestamp
-}
-
-func tcpEventCbV6(event tcpEventV6) {
-	timestamp := uint64(event.Timestamp)
-	cpu := event.Cpu
-	typ := EventType(event.Type)
-	pid := event.Pid & 0xffffffff
-
-	saddrbuf := make([]byte, 16)
-	daddrbuf := make([]byte, 16)
-
-	binary.LittleEndian.PutUint64(saddrbuf, event.SAddrH)
-	binary.LittleEndian.PutUint64(saddrbuf[8:], event.SAddrL)
-	binary.LittleEndian.PutUint64(daddrbuf, event.DAddrH)
-	binary.LittleEndian.PutUint64(daddrbuf[8:], event.DAddrL)
-
-	sIP := net.IP(saddrbuf)
-	dIP := net.IP(daddrbuf)
-
-	sport := event.SPort
-	dport := event.DPort
-	netns := event.NetNS
-
-	fmt.Printf("%v cpu#%d %s %v [%v]:%v [%v]:%v %v\n", timestamp, cpu, typ, pid, sIP, sport, dIP, dport, netns)
-
-	if lastTimestampV6 > timestamp {
-		fmt.Printf("ERROR: late event!\n")
+	var out io.WriteCloser
+	var err error
+	if *spoolDir != "" {
+		if *outputCompress || *outputDest != "-" {
+			fmt.Fprintf(os.Stderr, "-spool does not go with -output and -output-compress\n")
+			os.Exit(1)
+		}
+		binaryOutput = true
+		out, err = spool.Create(*spoolDir, *spoolSegment, *spoolSegments)
+	} else {
+		out, err = openOutput(*outputDest)
+	}
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
 		os.Exit(1)
 	}
 
-	lastTimestampV6 = timestamp
-}
-
-type tcpTracerState uint64
-
-const (
-	uninitialized tcpTracerState = iota
-	checking
-	checked
-	ready
-)
-
-type guessWhat uint64
-
-const (
-	guessSaddr guessWhat = iota
-	guessDaddr
-	guessFamily
-	guessSport
-	guessDport
-	guessNetns
-	guessDaddrIPv6
-)
-
-type tcpTracerStatus struct {
-	status          tcpTracerState
-	pidTgid         uint64
-	what            guessWhat
-	offsetSaddr     uint64
-	offsetDaddr     uint64
-	offsetSport     uint64
-	offsetDport     uint64
-	offsetNetns     uint64
-	offsetIno       uint64
-	offsetFamily    uint64
-	offsetDaddrIPv6 uint64
-	err             byte
-	saddr           uint32
-	daddr           uint32
-	sport           uint16
-	dport           uint16
-	netns           uint32
-	family          uint16
-	daddrIPv6       [4]uint32
-}
-
-func listen(url, netType string, finish chan struct{}) {
-	l, err := net.Listen(netType, url)
+	t, err := tracer.Load(fileName, tracer.Options{
+		PerfPages:          *perfPages,
+		ReorderWindow:      *reorderWindow,
+		ReorderMax:         *reorderMax,
+		WakeupEvents:       *perfWakeupEvents,
+		WakeupWatermark:    *perfWakeupBytes,
+		MaxLatency:         *perfMaxLatency,
+		Readers:            *perfReaders,
+		Unordered:          *unordered,
+		OmitComm:           *commOnce,
+		BatchSize:          *batchSize,
+		ConnectsockEntries: *connectsockEntries,
+		DisableBTF:         !*useBTF,
+		OffsetCacheDir:     *offsetCacheDir,
+		GuessObject:        *guessObject,
+		Log:                os.Stderr,
+		Phase:              startup.Begin,
+	})
 	if err != nil {
-		fmt.Println("Error listening:", err.Error())
+		fmt.Fprintf(os.Stderr, "%v\n", err)
 		os.Exit(1)
 	}
-	fmt.Println("Listening on " + url)
-	select {
-	case <-finish:
-		l.Close()
-		return
-	}
-}
+	b := t.Module()
 
-func compareIPv6(a, b [4]uint32) bool {
-	for i := 0; i < 4; i++ {
-		if a[i] != b[i] {
-			return false
+	// filter and sample before the first event
+	endPhase := startup.Begin("config")
+	if err := t.SetSampling(*sampleEvery, *flowRate, *flowBurst); err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+		os.Exit(1)
+	}
+	if *filterFile != "" {
+		if err := reloadFilters(t, *filterFile); err != nil {
+			fmt.Fprintf(os.Stderr, "%v\n", err)
+			os.Exit(1)
 		}
 	}
-	return true
-}
 
-func ownNetNS() (uint64, error) {
-	var s syscall.Stat_t
-	if err := syscall.Stat("/proc/self/ns/net", &s); err != nil {
-		return 0, err
-	}
-	return s.Ino, nil
-}
+	endPhase()
 
-func ipFromUint32Arr(ipv6Addr [4]uint32) net.IP {
-	buf := make([]byte, 16)
-	for i := 0; i < 16; i++ {
-		buf[i] = *(*byte)(unsafe.Pointer((uintptr(unsafe.Pointer(&ipv6Addr[0])) + uintptr(i))))
+	endPhase = startup.Begin("kprobes")
+	if err := t.EnableKprobes(); err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
 	}
-	return net.IP(buf)
-}
-
-func htons(a uint16) uint16 {
-	arr := make([]byte, 2)
-	binary.BigEndian.PutUint16(arr, a)
-	return byteOrder.Uint16(arr)
-}
-
-func guessOffsets(b *elf.Module) error {
-	listenIP := "127.0.0.2"
-	listenPort := uint16(9091)
-	bindAddress := fmt.Sprintf("%s:%d", listenIP, listenPort)
+	endPhase()
 
-	finish := make(chan struct{})
-	go listen(bindAddress, "tcp4", finish)
-	time.Sleep(300 * time.Millisecond)
-
-	currentNetns, err := ownNetNS()
-	if err != nil {
-		return fmt.Errorf("error getting current netns: %v", err)
-		os.Exit(1)
+	offsets := make(chan error, 1)
+	resolve := func() {
+		defer startup.Begin("offsets")()
+		offsets <- t.ResolveOffsets()
 	}
-
-	mp := b.Map("tcptracer_status")
-
-	var zero uint64
-	pidTgid := uint64(os.Getpid()<<32 | syscall.Gettid())
-
-	status := tcpTracerStatus{
-		status:  checking,
-		pidTgid: pidTgid,
+	waitOffsets := func() {
+		if err := <-offsets; err != nil {
+			fmt.Fprintf(os.Stderr, "%v\n", err)
+			os.Exit(1)
+		}
 	}
-
-	err = b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0)
-	if err != nil {
-		return fmt.Errorf("error: %v", err)
+	if *fastStart {
+		// the event sources start meanwhile, the programs of objects
+		// needing the offsets do not send events before they are set
+		go resolve()
+	} else {
+		resolve()
+		waitOffsets()
 	}
 
-	dport := htons(listenPort)
-
-	// 127.0.0.1
-	saddr := 0x0100007F
-	// 127.0.0.2
-	daddr := 0x0200007F
-	// will be set later
-	sport := 0
-	netns := uint32(currentNetns)
-	family := syscall.AF_INET
-
-	for status.status != ready {
-		var daddrIPv6 [4]uint32
-
-		daddrIPv6[0] = rand.Uint32()
-		daddrIPv6[1] = rand.Uint32()
-		daddrIPv6[2] = rand.Uint32()
-		daddrIPv6[3] = rand.Uint32()
-
-		ip := ipFromUint32Arr(daddrIPv6)
-
-		if status.what != guessDaddrIPv6 {
-			conn, err := net.Dial("tcp4", bindAddress)
-			if err != nil {
-				fmt.Printf("error: %v\n", err)
-			}
-
-			sport, err = strconv.Atoi(strings.Split(conn.LocalAddr().String(), ":")[1])
-			if err != nil {
-				return fmt.Errorf("error: %v", err)
-			}
-
-			sport = int(htons(uint16(sport)))
-
-			// set SO_LINGER to 0 so the connection state after closing is
-			// CLOSE instead of TIME_WAIT. In this way, they will disappear
-			// from the conntrack table after around 10 seconds instead of 2
-			// minutes
-			if tcpConn, ok := conn.(*net.TCPConn); ok {
-				tcpConn.SetLinger(0)
-			} else {
-				panic("not a tcp connection")
-			}
-
-			conn.Close()
-		} else {
-			conn, err := net.Dial("tcp6", fmt.Sprintf("[%s]:9092", ip))
-			if err == nil {
-				conn.Close()
-			}
-		}
-
-		err = b.LookupElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status))
+	endPhase = startup.Begin("sources")
+	var w io.Writer = out
+	if binaryOutput && *spoolDir == "" {
+		w, err = stream.NewWriter(out, *outputCompress)
 		if err != nil {
-			return fmt.Errorf("error: %v", err)
+			fmt.Fprintf(os.Stderr, "failed to write the output header: %v\n", err)
+			os.Exit(1)
 		}
+	}
+	output = newBatchWriter(w, *flushSize, *flushInterval)
 
-		if status.status == checked {
-			switch status.what {
-			case guessSaddr:
-				if status.saddr == uint32(saddr) {
-					fmt.Println("offsetSaddr found:", status.offsetSaddr)
-					status.what++
-					status.status = checking
-				} else {
-					status.offsetSaddr++
-					status.status = checking
-					status.saddr = uint32(saddr)
-				}
-			case guessDaddr:
-				if status.daddr == uint32(daddr) {
-					fmt.Println("offsetDaddr found:", status.offsetDaddr)
-					status.what++
-					status.status = checking
-				} else {
-					status.offsetDaddr++
-					status.status = checking
-					status.daddr = uint32(daddr)
-				}
-			case guessFamily:
-				if status.family == uint16(family) {
-					fmt.Println("offsetFamily found:", status.offsetFamily)
-					status.what++
-					status.status = checking
-					// we know the sport ((struct inet_sock)->inet_sport) is
-					// after the family field, so we start from there
-					status.offsetSport = status.offsetFamily
-				} else {
-					status.offsetFamily++
-					status.status = checking
-				}
-			case guessSport:
-				if status.sport == uint16(sport) {
-					fmt.Println("offsetSport found:", status.offsetSport)
-					status.what++
-					status.status = checking
-				} else {
-					status.offsetSport++
-					status.status = checking
-				}
-			case guessDport:
-				if status.dport == dport {
-					fmt.Println("offsetDport found:", status.offsetDport)
-					status.what++
-					status.status = checking
-				} else {
-					status.offsetDport++
-					status.status = checking
-				}
-			case guessNetns:
-				if status.netns == netns {
-					fmt.Println("offsetNetns found:", status.offsetNetns)
-					fmt.Println("offsetIno found:", status.offsetIno)
-					status.what++
-					status.status = checking
-				} else {
-					status.offsetIno++
-					// go to the next offsetNetns if we get an error
-					if status.err != 0 || status.offsetIno >= 200 {
-						status.offsetIno = 0
-						status.offsetNetns++
-					}
-					status.status = checking
-				}
-			case guessDaddrIPv6:
-				if compareIPv6(status.daddrIPv6, daddrIPv6) {
-					fmt.Println("offsetDaddrIPv6 found:", status.offsetDaddrIPv6)
-					status.what++
-					status.status = ready
-				} else {
-					status.offsetDaddrIPv6++
-					status.status = checking
+	sig := make(chan os.Signal, 1)
+	signal.Notify(sig, os.Interrupt, os.Kill)
+
+	if *filterFile != "" {
+		hup := make(chan os.Signal, 1)
+		signal.Notify(hup, syscall.SIGHUP)
+		go func() {
+			for range hup {
+				if err := reloadFilters(t, *filterFile); err != nil {
+					fmt.Fprintf(os.Stderr, "keeping the previous filters: %v\n", err)
 				}
-			default:
-				return fmt.Errorf("Uh, oh!")
 			}
-		}
+		}()
+	}
 
-		err = b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0)
+	// objects built for in-kernel aggregation count connects per flow in
+	// tcp_flows and may not have the event maps at all
+	var flows *mapCollector
+	if mp := b.Map("tcp_flows"); mp != nil {
+		flows, err = newFlowCollector(mp, *flowsInterval)
 		if err != nil {
-			return fmt.Errorf("error: %v", err)
+			fmt.Fprintf(os.Stderr, "%v\n", err)
+			os.Exit(1)
 		}
+	}
 
-		if status.offsetSaddr >= 200 || status.offsetDaddr >= 200 ||
-			status.offsetSport >= 2000 || status.offsetDport >= 200 ||
-			status.offsetNetns >= 200 || status.offsetFamily >= 200 ||
-			status.offsetDaddrIPv6 >= 200 {
-			fmt.Fprintf(os.Stderr, "overflow, bailing out!\n")
+	var latencies *mapCollector
+	if mp := b.Map("connect_latency"); mp != nil && *histInterval > 0 {
+		latencies, err = newLatencyCollector(mp, *histInterval)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "%v\n", err)
 			os.Exit(1)
 		}
 	}
 
-	close(finish)
-
-	return nil
-}
-
-func main() {
-	if len(os.Args) != 2 {
-		fmt.Fprintf(os.Stderr, "Usage: %s ${GOPATH}/src/github.com/kinvolk/tcptracer-bpf/ebpf/ebpf.o\n", os.Args[0])
+	if err := t.Start(outputSink()); err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
 		os.Exit(1)
 	}
-	fileName := os.Args[1]
-	b := elf.NewModule(fileName)
-	if b == nil {
-		fmt.Fprintf(os.Stderr, "System doesn't support BPF\n")
-		os.Exit(1)
+	if flows != nil {
+		flows.Start()
 	}
-
-	err := b.Load()
-	if err != nil {
-		fmt.Fprintf(os.Stderr, "%v\n", err)
-		os.Exit(1)
+	if latencies != nil {
+		latencies.Start()
 	}
-
-	for p := range b.IterKprobes() {
-		b.EnableKprobe(p.Name)
+	var stats *statsReporter
+	if *statsInterval > 0 {
+		stats = newStatsReporter(os.Stderr, *statsInterval, t)
+		stats.Start()
 	}
+	endPhase()
 
-	if err := guessOffsets(b); err != nil {
-		fmt.Fprintf(os.Stderr, "%v\n", err)
-		os.Exit(1)
+	if *fastStart {
+		waitOffsets()
 	}
+	fmt.Fprintf(readyOutput(), "Ready.\n")
+	fmt.Fprintf(os.Stderr, "%s\n", startup)
 
-	fmt.Printf("Ready.\n")
-
-	channelV4 := make(chan []byte)
-	channelV6 := make(chan []byte)
-
-	sig := make(chan os.Signal, 1)
-	signal.Notify(sig, os.Interrupt, os.Kill)
-
-	go func() {
-		var event tcpEventV4
-		for {
-			data := <-channelV4
-			err := binary.Read(bytes.NewBuffer(data), byteOrder, &event)
-			if err != nil {
-				fmt.Printf("failed to decode received data: %s\n", err)
-				continue
-			}
-			tcpEventCbV4(event)
-		}
-	}()
+	<-sig
+	if stats != nil {
+		stats.Stop()
+	}
+	t.Stop()
+	if flows != nil {
+		flows.Stop()
+	}
+	if latencies != nil {
+		latencies.Stop()
+	}
 
-	go func() {
-		var event tcpEventV6
-		for {
-			data := <-channelV6
-			err := binary.Read(bytes.NewBuffer(data), byteOrder, &event)
-			if err != nil {
-				fmt.Printf("failed to decode received data: %s\n", err)
-				continue
-			}
-			tcpEventCbV6(event)
+	output.Close()
+	if *spoolDir != "" || *outputDest != "-" {
+		if err := out.Close(); err != nil {
+			fmt.Fprintf(os.Stderr, "%v\n", err)
 		}
-	}()
+	}
+	fmt.Fprintf(os.Stderr, "%s\n", output)
+	if sw, ok := out.(*spool.Writer); ok {
+		fmt.Fprintf(os.Stderr, "%s\n", sw)
+	}
+	late := make([]string, len(eventFamilies))
+	counts := make([]string, len(eventFamilies))
+	for i, f := range eventFamilies {
+		late[i] = fmt.Sprintf("%d %s", f.Late(), f.Name)
+		events, weighted := f.Counts()
+		counts[i] = fmt.Sprintf("%d %s (%d once weighted)", events, f.Name, weighted)
+	}
+	fmt.Fprintf(os.Stderr, "events: %s\n", strings.Join(counts, ", "))
+	fmt.Fprintf(os.Stderr, "late events: %s\n", strings.Join(late, ", "))
+	for _, st := range t.Stats() {
+		fmt.Fprintf(os.Stderr, "%s\n", st)
+	}
+	if comm := t.CommStats(); comm != "" {
+		fmt.Fprintf(os.Stderr, "%s\n", comm)
+	}
 
-	pmIPv4, err := elf.InitPerfMap(b, "tcp_event_ipv4", channelV4)
-	if err != nil {
+	if counters, err := t.Counters(); err != nil {
 		fmt.Fprintf(os.Stderr, "%v\n", err)
-		os.Exit(1)
+	} else if counters != "" {
+		fmt.Fprintf(os.Stderr, "%s\n", counters)
 	}
+}
 
-	pmIPv6, err := elf.InitPerfMap(b, "tcp_event_ipv6", channelV6)
+// reloadFilters applies the rules of fileName to the running program.
+func reloadFilters(t *tracer.Tracer, fileName string) error {
+	rules, err := tracer.LoadFilterRules(fileName)
 	if err != nil {
-		fmt.Fprintf(os.Stderr, "%v\n", err)
-		os.Exit(1)
+		return err
 	}
-
-	pmIPv4.PollStart()
-	pmIPv6.PollStart()
-	<-sig
-	pmIPv4.PollStop()
-	pmIPv6.PollStop()
+	if err := t.SetFilters(rules); err != nil {
+		return err
+	}
+	fmt.Fprintf(os.Stderr, "filters: %s\n", rules)
+	return nil
 }
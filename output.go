@@ -0,0 +1,169 @@
+package main
+
+import (
+	"fmt"
+	"io"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// batchWriter collects the formatted events of all consumers into one
+// large buffer and writes it out when it grows past a size threshold or
+// when the flush interval expires, whichever comes first. It uses two
+// buffers so that producers can keep appending while the previous batch
+// is being written.
+type batchWriter struct {
+	w        io.Writer
+	size     int
+	interval time.Duration
+
+	// mu protects buf, writeMu serializes the writes to w. writeMu is
+	// always acquired while holding mu so batches are written in order.
+	mu      sync.Mutex
+	writeMu sync.Mutex
+	buf     []byte
+	free    chan []byte
+
+	done      chan struct{}
+	closeOnce sync.Once
+	wg        sync.WaitGroup
+
+	start time.Time
+	stats outputStats
+}
+
+// outputStats are the counters of a batchWriter. They are updated
+// atomically and can be read at any time with batchWriter.Stats.
+type outputStats struct {
+	Bytes      uint64
+	Lines      uint64
+	Flushes    uint64
+	FlushNs    uint64
+	MaxFlushNs uint64
+	Errors     uint64
+}
+
+func newBatchWriter(w io.Writer, size int, interval time.Duration) *batchWriter {
+	bw := &batchWriter{
+		w:        w,
+		size:     size,
+		interval: interval,
+		buf:      make([]byte, 0, size+4096),
+		free:     make(chan []byte, 2),
+		done:     make(chan struct{}),
+		start:    time.Now(),
+	}
+	bw.free <- make([]byte, 0, size+4096)
+
+	bw.wg.Add(1)
+	go bw.flusher()
+
+	return bw
+}
+
+// Write appends one or more complete lines to the current batch. It
+// never fails, errors of the underlying writer are counted in Stats.
+func (bw *batchWriter) Write(p []byte) (int, error) {
+	bw.mu.Lock()
+	bw.buf = append(bw.buf, p...)
+	atomic.AddUint64(&bw.stats.Lines, 1)
+	if len(bw.buf) >= bw.size {
+		bw.flushLocked()
+	} else {
+		bw.mu.Unlock()
+	}
+	return len(p), nil
+}
+
+// Flush writes out the pending batch, if any.
+func (bw *batchWriter) Flush() {
+	bw.mu.Lock()
+	if len(bw.buf) == 0 {
+		bw.mu.Unlock()
+		return
+	}
+	bw.flushLocked()
+}
+
+// flushLocked swaps the current batch with a free buffer and writes it.
+// It must be called with mu held and releases it.
+func (bw *batchWriter) flushLocked() {
+	batch := bw.buf
+	bw.buf = <-bw.free
+
+	bw.writeMu.Lock()
+	bw.mu.Unlock()
+
+	start := time.Now()
+	n, err := bw.w.Write(batch)
+	elapsed := uint64(time.Since(start))
+
+	atomic.AddUint64(&bw.stats.Bytes, uint64(n))
+	atomic.AddUint64(&bw.stats.Flushes, 1)
+	atomic.AddUint64(&bw.stats.FlushNs, elapsed)
+	if elapsed > atomic.LoadUint64(&bw.stats.MaxFlushNs) {
+		atomic.StoreUint64(&bw.stats.MaxFlushNs, elapsed)
+	}
+	if err != nil {
+		atomic.AddUint64(&bw.stats.Errors, 1)
+	}
+
+	bw.free <- batch[:0]
+	bw.writeMu.Unlock()
+}
+
+func (bw *batchWriter) flusher() {
+	defer bw.wg.Done()
+
+	ticker := time.NewTicker(bw.interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-ticker.C:
+			bw.Flush()
+		case <-bw.done:
+			return
+		}
+	}
+}
+
+// Close stops the flush timer and writes out what is left. It is safe to
+// call it more than once.
+func (bw *batchWriter) Close() error {
+	bw.closeOnce.Do(func() {
+		close(bw.done)
+		bw.wg.Wait()
+	})
+	bw.Flush()
+	return nil
+}
+
+// Stats returns a snapshot of the output counters.
+func (bw *batchWriter) Stats() outputStats {
+	return outputStats{
+		Bytes:      atomic.LoadUint64(&bw.stats.Bytes),
+		Lines:      atomic.LoadUint64(&bw.stats.Lines),
+		Flushes:    atomic.LoadUint64(&bw.stats.Flushes),
+		FlushNs:    atomic.LoadUint64(&bw.stats.FlushNs),
+		MaxFlushNs: atomic.LoadUint64(&bw.stats.MaxFlushNs),
+		Errors:     atomic.LoadUint64(&bw.stats.Errors),
+	}
+}
+
+// String formats the counters, including the throughput since the writer
+// was created.
+func (bw *batchWriter) String() string {
+	s := bw.Stats()
+	elapsed := time.Since(bw.start).Seconds()
+
+	var avgFlush time.Duration
+	if s.Flushes > 0 {
+		avgFlush = time.Duration(s.FlushNs / s.Flushes)
+	}
+
+	return fmt.Sprintf("output: %d lines, %d bytes, %.0f lines/s, %.0f bytes/s, %d flushes, avg flush %v, max flush %v, %d errors",
+		s.Lines, s.Bytes, float64(s.Lines)/elapsed, float64(s.Bytes)/elapsed,
+		s.Flushes, avgFlush, time.Duration(s.MaxFlushNs), s.Errors)
+}
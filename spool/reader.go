@@ -0,0 +1,240 @@
+package spool
+
+import (
+	"fmt"
+	"io"
+	"os"
+	"syscall"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+)
+
+// Reader reads the records of a spool directory in the order they were
+// written, following the writer from segment to segment.
+type Reader struct {
+	dir string
+
+	seq uint64
+	mem []byte
+	off int
+}
+
+// Open returns a Reader positioned at the oldest record of dir.
+func Open(dir string) (*Reader, error) {
+	r := &Reader{dir: dir}
+	if _, err := r.nextSegment(); err != nil {
+		return nil, err
+	}
+	return r, nil
+}
+
+// openSegment moves to the segment seq. The current one is kept if it
+// cannot be opened.
+func (r *Reader) openSegment(seq uint64) error {
+	name := segmentName(r.dir, seq)
+	f, err := os.Open(name)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+
+	st, err := f.Stat()
+	if err != nil {
+		return err
+	}
+	if st.Size() < HeaderSize {
+		return errEmpty
+	}
+	mem, err := syscall.Mmap(int(f.Fd()), 0, int(st.Size()), syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		return fmt.Errorf("spool: failed to map %s: %v", name, err)
+	}
+	if err := checkHeader(mem); err != nil {
+		syscall.Munmap(mem)
+		if err == errEmpty {
+			return err
+		}
+		return fmt.Errorf("spool: %s: %v", name, err)
+	}
+
+	r.closeSegment()
+	r.seq = seq
+	r.mem = mem
+	r.off = HeaderSize
+	return nil
+}
+
+func (r *Reader) closeSegment() {
+	if r.mem != nil {
+		syscall.Munmap(r.mem)
+		r.mem = nil
+	}
+}
+
+// nextSegment moves to the segment after the current one, or the oldest
+// one if there is none yet. It returns false if there is none. Segments
+// without a header, left by a crash, are skipped.
+func (r *Reader) nextSegment() (bool, error) {
+	seqs, err := segments(r.dir)
+	if err != nil {
+		return false, err
+	}
+	opened := r.mem != nil
+	for _, seq := range seqs {
+		// segments may have been removed in between
+		if opened && seq <= r.seq {
+			continue
+		}
+		err := r.openSegment(seq)
+		if err == errEmpty || os.IsNotExist(err) {
+			continue
+		}
+		return err == nil, err
+	}
+	return false, nil
+}
+
+// peek returns the committed bytes from the read position on, starting
+// with a whole record, or nil if there are none.
+func (r *Reader) peek() ([]byte, error) {
+	if r.mem == nil {
+		return nil, nil
+	}
+	end := committed(r.mem)
+	if r.off >= end {
+		return nil, nil
+	}
+	rec := r.mem[r.off:end]
+	if len(rec) < stream.RecordHeaderSize {
+		return nil, fmt.Errorf("spool: truncated record in segment %d", r.seq)
+	}
+	size := stream.RecordSize(rec)
+	if size < stream.RecordHeaderSize || size > len(rec) {
+		return nil, fmt.Errorf("spool: bad record length %d in segment %d", size, r.seq)
+	}
+	return rec[:size], nil
+}
+
+// advance moves to the next segment once the current one is sealed and
+// read. It returns false if there is nothing more to read for now.
+func (r *Reader) advance() (bool, error) {
+	// the writer commits before it seals, once sealed the end is final
+	if r.mem != nil && !sealed(r.mem) {
+		return false, nil
+	}
+	if r.mem != nil && r.off < committed(r.mem) {
+		return true, nil
+	}
+	return r.nextSegment()
+}
+
+// Next returns the next record. The payload is only valid until the next
+// call to Next or Seek. Next returns io.EOF when the reader caught up with
+// the writer, it can be called again later for the records written since.
+func (r *Reader) Next() (stream.Record, error) {
+	for {
+		rec, err := r.peek()
+		if err != nil {
+			return stream.Record{}, err
+		}
+		if rec != nil {
+			r.off += len(rec)
+			return stream.Record{Kind: rec[0], Flags: rec[1], Payload: rec[stream.RecordHeaderSize:]}, nil
+		}
+
+		ok, err := r.advance()
+		if err != nil {
+			return stream.Record{}, err
+		}
+		if !ok {
+			return stream.Record{}, io.EOF
+		}
+	}
+}
+
+// Seek positions the reader at the first record stamped at or after ts,
+// in the order of the records. Records are only roughly ordered by time,
+// see -reorder-window, so late ones may follow.
+func (r *Reader) Seek(ts uint64) error {
+	seqs, err := segments(r.dir)
+	if err != nil {
+		return err
+	}
+	if len(seqs) == 0 {
+		return nil
+	}
+
+	// the last segment whose first record is not after ts
+	i := len(seqs) - 1
+	for ; i > 0; i-- {
+		first, err := r.peekFirst(seqs[i])
+		if err == nil && first <= ts {
+			break
+		}
+	}
+	r.closeSegment()
+	if err := r.openSegment(seqs[i]); err != nil {
+		if err != errEmpty {
+			return err
+		}
+		// the oldest segment with a header then
+		if _, err := r.nextSegment(); err != nil || r.mem == nil {
+			return err
+		}
+	}
+
+	// then the last index entry not after ts
+	end := committed(r.mem)
+	for j := indexCount(r.mem) - 1; j >= 0; j-- {
+		t, off := indexEntry(r.mem, j)
+		if t <= ts && off >= HeaderSize && off < end {
+			r.off = off
+			break
+		}
+	}
+
+	// and scan from there
+	for {
+		rec, err := r.peek()
+		if err != nil {
+			return err
+		}
+		if rec == nil {
+			ok, err := r.advance()
+			if err != nil || !ok {
+				return err
+			}
+			continue
+		}
+		if len(rec) >= stream.RecordHeaderSize+8 && stream.RecordTimestamp(rec) >= ts {
+			return nil
+		}
+		r.off += len(rec)
+	}
+}
+
+// peekFirst returns the timestamp of the first record of a segment, from
+// its first index entry.
+func (r *Reader) peekFirst(seq uint64) (uint64, error) {
+	f, err := os.Open(segmentName(r.dir, seq))
+	if err != nil {
+		return 0, err
+	}
+	defer f.Close()
+
+	var header [indexOffset + indexEntrySize]byte
+	if _, err := f.ReadAt(header[:], 0); err != nil {
+		return 0, err
+	}
+	if hostOrder.Uint32(header[indexCountOffset:]) == 0 {
+		return 0, io.EOF
+	}
+	t, _ := indexEntry(header[:], 0)
+	return t, nil
+}
+
+// Close releases the current segment.
+func (r *Reader) Close() error {
+	r.closeSegment()
+	return nil
+}
@@ -0,0 +1,145 @@
+// Package spool stores the records of package stream in a directory of
+// memory-mapped segment files, so that the loader can keep draining the
+// kernel at its own pace while readers tail the segments at theirs.
+//
+// Segments are named after their sequence number and preallocated to the
+// segment size. Each one starts with a 4KiB header:
+//
+//	 0 [4]byte "TCPS"
+//	 4 u32 version
+//	 8 u32 flags, FlagSealed once the writer moved to the next segment
+//	12 u32 number of index entries
+//	16 u64 end of the committed records, from the start of the file
+//	24 u32 bytes of records between index entries
+//	28 u32 reserved
+//	32 index entries, u64 timestamp and u64 offset of a record
+//
+// followed by the records, back to back, with the framing of package
+// stream. The writer publishes a record by moving the committed end past
+// it, after the record and its index entry are in place, so that a reader,
+// or the next run after a crash, never sees a partial record. The header
+// is in host byte order, segments are not meant to move between machines.
+package spool
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"strings"
+	"sync/atomic"
+	"unsafe"
+)
+
+const (
+	Magic   = "TCPS"
+	Version = 1
+
+	// FlagSealed says no more records will be added to the segment.
+	FlagSealed = 1 << 0
+
+	HeaderSize      = 4096
+	indexOffset     = 32
+	indexEntrySize  = 16
+	MaxIndexEntries = (HeaderSize - indexOffset) / indexEntrySize
+
+	segmentSuffix = ".seg"
+	tempSuffix    = ".tmp"
+)
+
+var errCorrupt = errors.New("spool: corrupt segment header")
+
+// errEmpty is the error for a segment without a header, left by a crash
+// of a writer older than the rename into place, or cut short on disk.
+var errEmpty = errors.New("spool: segment has no header")
+
+var hostOrder binary.ByteOrder
+
+func init() {
+	var i int32 = 0x01020304
+	if *(*byte)(unsafe.Pointer(&i)) == 0x04 {
+		hostOrder = binary.LittleEndian
+	} else {
+		hostOrder = binary.BigEndian
+	}
+}
+
+func segmentName(dir string, seq uint64) string {
+	return filepath.Join(dir, fmt.Sprintf("%020d%s", seq, segmentSuffix))
+}
+
+// segments returns the sequence numbers of the segments in dir, oldest
+// first.
+func segments(dir string) ([]uint64, error) {
+	names, err := filepath.Glob(filepath.Join(dir, "*"+segmentSuffix))
+	if err != nil {
+		return nil, err
+	}
+	var seqs []uint64
+	for _, name := range names {
+		seq, err := strconv.ParseUint(strings.TrimSuffix(filepath.Base(name), segmentSuffix), 10, 64)
+		if err == nil {
+			seqs = append(seqs, seq)
+		}
+	}
+	sort.Slice(seqs, func(i, j int) bool { return seqs[i] < seqs[j] })
+	return seqs, nil
+}
+
+// Offsets of the header fields updated while readers look
+const (
+	flagsOffset      = 8
+	indexCountOffset = 12
+	committedOffset  = 16
+)
+
+func headerField32(mem []byte, off int) *uint32 {
+	return (*uint32)(unsafe.Pointer(&mem[off]))
+}
+
+// committed returns the end of the records of the mapped segment mem.
+func committed(mem []byte) int {
+	return int(atomic.LoadUint64((*uint64)(unsafe.Pointer(&mem[committedOffset]))))
+}
+
+func sealed(mem []byte) bool {
+	return atomic.LoadUint32(headerField32(mem, flagsOffset))&FlagSealed != 0
+}
+
+// emptyHeader tells whether header, the start of a segment, was never
+// written.
+func emptyHeader(header []byte) bool {
+	return len(header) < HeaderSize || string(header[:4]) == "\x00\x00\x00\x00"
+}
+
+func checkHeader(mem []byte) error {
+	if emptyHeader(mem) {
+		return errEmpty
+	}
+	if string(mem[:4]) != Magic {
+		return errCorrupt
+	}
+	if v := hostOrder.Uint32(mem[4:]); v != Version {
+		return fmt.Errorf("spool: unsupported segment version %d", v)
+	}
+	if end := committed(mem); end < HeaderSize || end > len(mem) {
+		return errCorrupt
+	}
+	return nil
+}
+
+// indexEntry returns the timestamp and offset of the i-th index entry.
+func indexEntry(mem []byte, i int) (uint64, int) {
+	e := mem[indexOffset+i*indexEntrySize:]
+	return hostOrder.Uint64(e[0:]), int(hostOrder.Uint64(e[8:]))
+}
+
+func indexCount(mem []byte) int {
+	n := int(atomic.LoadUint32(headerField32(mem, indexCountOffset)))
+	if n > MaxIndexEntries {
+		n = MaxIndexEntries
+	}
+	return n
+}
@@ -0,0 +1,298 @@
+package spool
+
+import (
+	"io"
+	"io/ioutil"
+	"os"
+	"syscall"
+	"testing"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+)
+
+// testRecord returns an IPv4 event record stamped ts.
+func testRecord(ts uint64) []byte {
+	e := stream.TCPEventV4{Timestamp: ts, Pid: uint32(ts), DPort: 80, Weight: 1}
+	return stream.AppendTCPEventV4(nil, &e, 0)
+}
+
+var recordSize = len(testRecord(0))
+
+func writeRecords(t *testing.T, w *Writer, timestamps ...uint64) {
+	for _, ts := range timestamps {
+		if _, err := w.Write(testRecord(ts)); err != nil {
+			t.Fatal(err)
+		}
+	}
+}
+
+func span(first, n, step uint64) []uint64 {
+	var ts []uint64
+	for i := uint64(0); i < n; i++ {
+		ts = append(ts, first+i*step)
+	}
+	return ts
+}
+
+// next returns the timestamp of the next record of r, or io.EOF.
+func next(t *testing.T, r *Reader) (uint64, error) {
+	rec, err := r.Next()
+	if err != nil {
+		return 0, err
+	}
+	var e stream.TCPEventV4
+	if err := rec.TCPEventV4(&e); err != nil {
+		t.Fatal(err)
+	}
+	return e.Timestamp, nil
+}
+
+// readAll returns the timestamps of the records of r up to io.EOF.
+func readAll(t *testing.T, r *Reader) []uint64 {
+	var got []uint64
+	for {
+		ts, err := next(t, r)
+		if err == io.EOF {
+			return got
+		}
+		if err != nil {
+			t.Fatal(err)
+		}
+		got = append(got, ts)
+	}
+}
+
+func equal(a, b []uint64) bool {
+	if len(a) != len(b) {
+		return false
+	}
+	for i := range a {
+		if a[i] != b[i] {
+			return false
+		}
+	}
+	return true
+}
+
+func openReader(t *testing.T, dir string) *Reader {
+	r, err := Open(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	return r
+}
+
+// segment size holding perSegment records
+func segmentSize(perSegment int) int {
+	return HeaderSize + perSegment*recordSize
+}
+
+func TestRoundTrip(t *testing.T) {
+	dir := t.TempDir()
+	w, err := Create(dir, segmentSize(70), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := span(1, 200, 1)
+	writeRecords(t, w, want...)
+	if err := w.Close(); err != nil {
+		t.Fatal(err)
+	}
+	if w.Rotations != 2 {
+		t.Errorf("%d rotations, want 2", w.Rotations)
+	}
+
+	r := openReader(t, dir)
+	defer r.Close()
+	if got := readAll(t, r); !equal(got, want) {
+		t.Fatalf("read %v, want %v", got, want)
+	}
+}
+
+func TestPrune(t *testing.T) {
+	dir := t.TempDir()
+	w, err := Create(dir, segmentSize(64), 3)
+	if err != nil {
+		t.Fatal(err)
+	}
+	writeRecords(t, w, span(1, 9*64+25, 1)...)
+	w.Close()
+
+	seqs, err := segments(dir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(seqs) != 3 || seqs[0] != 7 {
+		t.Fatalf("segments %v kept, want 7 to 9", seqs)
+	}
+	r := openReader(t, dir)
+	defer r.Close()
+	if got := readAll(t, r); !equal(got, span(7*64+1, 2*64+25, 1)) {
+		t.Fatalf("read %v, want the records of segments 7 to 9", got)
+	}
+}
+
+func TestSeek(t *testing.T) {
+	dir := t.TempDir()
+	// several index entries per segment, a few segments
+	w, err := Create(dir, segmentSize(4*MaxIndexEntries), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	const n = 3000
+	writeRecords(t, w, span(10, n, 10)...)
+	w.Close()
+	if w.Rotations < 2 {
+		t.Fatalf("%d rotations, want several segments", w.Rotations)
+	}
+
+	r := openReader(t, dir)
+	defer r.Close()
+	for _, c := range []struct{ seek, want uint64 }{
+		{0, 10},
+		{10, 10},
+		{15, 20},
+		{12340, 12340},
+		{12341, 12350},
+		// the first records of the second and the third segment
+		{10 * (4*MaxIndexEntries + 1), 10 * (4*MaxIndexEntries + 1)},
+		{10*(8*MaxIndexEntries+1) - 1, 10 * (8*MaxIndexEntries + 1)},
+		{10 * n, 10 * n},
+	} {
+		if err := r.Seek(c.seek); err != nil {
+			t.Fatal(err)
+		}
+		got, err := next(t, r)
+		if err != nil || got != c.want {
+			t.Errorf("seek to %d: got %d, %v, want %d", c.seek, got, err, c.want)
+		}
+	}
+
+	// past the end
+	if err := r.Seek(10*n + 1); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := r.Next(); err != io.EOF {
+		t.Errorf("got %v past the last record, want EOF", err)
+	}
+}
+
+// crash leaves the current segment of w as a killed writer would.
+func crash(w *Writer) {
+	syscall.Munmap(w.mem)
+	w.f.Close()
+	w.mem = nil
+}
+
+func TestCreateSealsPrevious(t *testing.T) {
+	dir := t.TempDir()
+	w, err := Create(dir, segmentSize(100), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	writeRecords(t, w, 1, 2, 3)
+	crash(w)
+
+	w, err = Create(dir, segmentSize(100), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer w.Close()
+	if w.seq != 1 {
+		t.Errorf("new run writes segment %d, want 1", w.seq)
+	}
+
+	st, err := os.Stat(segmentName(dir, 0))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if st.Size() != int64(HeaderSize+3*recordSize) {
+		t.Errorf("previous segment is %d bytes, want %d", st.Size(), HeaderSize+3*recordSize)
+	}
+	header, err := ioutil.ReadFile(segmentName(dir, 0))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if !sealed(header) {
+		t.Error("previous segment not sealed")
+	}
+
+	writeRecords(t, w, 4)
+	r := openReader(t, dir)
+	defer r.Close()
+	if got := readAll(t, r); !equal(got, []uint64{1, 2, 3, 4}) {
+		t.Fatalf("read %v, want 1 to 4", got)
+	}
+}
+
+// A crash of an older writer may leave a segment without a header, and a
+// later run or reader must get past it.
+func TestEmptySegment(t *testing.T) {
+	dir := t.TempDir()
+	w, err := Create(dir, segmentSize(100), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	writeRecords(t, w, 1, 2)
+	w.Close()
+	if err := ioutil.WriteFile(segmentName(dir, 1), make([]byte, HeaderSize), 0644); err != nil {
+		t.Fatal(err)
+	}
+	if err := ioutil.WriteFile(segmentName(dir, 2)+tempSuffix, nil, 0644); err != nil {
+		t.Fatal(err)
+	}
+
+	r := openReader(t, dir)
+	defer r.Close()
+	if got := readAll(t, r); !equal(got, []uint64{1, 2}) {
+		t.Fatalf("read %v, want 1 and 2", got)
+	}
+
+	w, err = Create(dir, segmentSize(100), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer w.Close()
+	if _, err := os.Stat(segmentName(dir, 1)); !os.IsNotExist(err) {
+		t.Errorf("segment without a header kept: %v", err)
+	}
+	if _, err := os.Stat(segmentName(dir, 2) + tempSuffix); !os.IsNotExist(err) {
+		t.Errorf("temporary segment kept: %v", err)
+	}
+
+	writeRecords(t, w, 3)
+	if got := readAll(t, r); !equal(got, []uint64{3}) {
+		t.Fatalf("read %v after the restart, want 3", got)
+	}
+}
+
+func TestTail(t *testing.T) {
+	dir := t.TempDir()
+	w, err := Create(dir, segmentSize(64), 0)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer w.Close()
+	r := openReader(t, dir)
+	defer r.Close()
+
+	if _, err := r.Next(); err != io.EOF {
+		t.Fatalf("got %v from an empty spool, want EOF", err)
+	}
+	writeRecords(t, w, 1, 2)
+	if got := readAll(t, r); !equal(got, []uint64{1, 2}) {
+		t.Fatalf("read %v, want 1 and 2", got)
+	}
+	if _, err := r.Next(); err != io.EOF {
+		t.Fatalf("got %v once caught up, want EOF", err)
+	}
+
+	// the writer rotates twice meanwhile
+	writeRecords(t, w, span(3, 150, 1)...)
+	if got := readAll(t, r); !equal(got, span(3, 150, 1)) {
+		t.Fatalf("read %v, want 3 to 152", got)
+	}
+	if w.Rotations != 2 {
+		t.Errorf("%d rotations, want 2", w.Rotations)
+	}
+}
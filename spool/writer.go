@@ -0,0 +1,269 @@
+package spool
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"sync/atomic"
+	"syscall"
+	"unsafe"
+
+	"github.com/kinvolk/gobpf-elf-loader/stream"
+)
+
+// Writer appends records to the segments of a directory.
+type Writer struct {
+	dir         string
+	segmentSize int
+	maxSegments int
+
+	seq       uint64
+	f         *os.File
+	mem       []byte
+	end       int
+	interval  int
+	nextIndex int
+	indexed   int
+
+	// Rotations counts the segments filled, Dropped the records larger
+	// than a segment.
+	Rotations uint64
+	Dropped   uint64
+}
+
+// Create starts a new segment in dir, after the ones already there.
+// Segments are preallocated to segmentSize bytes, at most maxSegments of
+// them are kept, 0 keeping them all.
+func Create(dir string, segmentSize, maxSegments int) (*Writer, error) {
+	if segmentSize < 2*HeaderSize {
+		return nil, fmt.Errorf("spool: segment size %d too small", segmentSize)
+	}
+	if err := os.MkdirAll(dir, 0755); err != nil {
+		return nil, err
+	}
+	seqs, err := segments(dir)
+	if err != nil {
+		return nil, err
+	}
+
+	w := &Writer{
+		dir:         dir,
+		segmentSize: segmentSize,
+		maxSegments: maxSegments,
+		interval:    (segmentSize - HeaderSize) / MaxIndexEntries,
+	}
+	// segments of a crashed run not renamed into place yet
+	if temps, err := filepath.Glob(filepath.Join(dir, "*"+segmentSuffix+tempSuffix)); err == nil {
+		for _, name := range temps {
+			os.Remove(name)
+		}
+	}
+	if len(seqs) > 0 {
+		// never append to a segment of a previous run, it may have been
+		// cut short
+		w.seq = seqs[len(seqs)-1] + 1
+	}
+	for len(seqs) > 0 {
+		name := segmentName(dir, seqs[len(seqs)-1])
+		err := sealSegment(name)
+		if err != errEmpty {
+			if err != nil {
+				return nil, fmt.Errorf("spool: %s: %v", name, err)
+			}
+			break
+		}
+		// nothing to keep, the one before was sealed when it filled up
+		if err := os.Remove(name); err != nil {
+			return nil, err
+		}
+		seqs = seqs[:len(seqs)-1]
+	}
+	if err := w.open(); err != nil {
+		return nil, err
+	}
+	return w, nil
+}
+
+// sealSegment marks a segment left open, e.g. by a crash, as complete. It
+// returns errEmpty for a segment without a header.
+func sealSegment(name string) error {
+	f, err := os.OpenFile(name, os.O_RDWR, 0)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+
+	var header [HeaderSize]byte
+	n, err := f.ReadAt(header[:], 0)
+	if emptyHeader(header[:n]) {
+		return errEmpty
+	}
+	if err != nil {
+		return err
+	}
+	if err := checkHeaderSize(header[:]); err != nil {
+		return err
+	}
+	flags := hostOrder.Uint32(header[flagsOffset:]) | FlagSealed
+	hostOrder.PutUint32(header[flagsOffset:], flags)
+	if _, err := f.WriteAt(header[flagsOffset:flagsOffset+4], flagsOffset); err != nil {
+		return err
+	}
+	return f.Truncate(int64(hostOrder.Uint64(header[committedOffset:])))
+}
+
+// checkHeaderSize is checkHeader for a header read on its own.
+func checkHeaderSize(header []byte) error {
+	if string(header[:4]) != Magic {
+		return errCorrupt
+	}
+	if end := hostOrder.Uint64(header[committedOffset:]); end < HeaderSize {
+		return errCorrupt
+	}
+	return nil
+}
+
+// open creates the segment w.seq. It is built under a temporary name and
+// linked into place once its header is written, readers and the next run
+// never see a segment without one.
+func (w *Writer) open() error {
+	name := segmentName(w.dir, w.seq)
+	tmp := name + tempSuffix
+	f, err := os.OpenFile(tmp, os.O_RDWR|os.O_CREATE|os.O_TRUNC, 0644)
+	if err != nil {
+		return err
+	}
+	fail := func(err error) error {
+		f.Close()
+		os.Remove(tmp)
+		return err
+	}
+
+	// allocate the blocks now, a write fault on a full disk would be a
+	// SIGBUS
+	if err := syscall.Fallocate(int(f.Fd()), 0, 0, int64(w.segmentSize)); err != nil {
+		if err := f.Truncate(int64(w.segmentSize)); err != nil {
+			return fail(err)
+		}
+	}
+	mem, err := syscall.Mmap(int(f.Fd()), 0, w.segmentSize, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		return fail(fmt.Errorf("spool: failed to map %s: %v", name, err))
+	}
+
+	copy(mem, Magic)
+	hostOrder.PutUint32(mem[4:], Version)
+	hostOrder.PutUint32(mem[24:], uint32(w.interval))
+	atomic.StoreUint64((*uint64)(unsafe.Pointer(&mem[committedOffset])), HeaderSize)
+
+	// a link, unlike a rename, fails if the segment exists already
+	if err := os.Link(tmp, name); err != nil {
+		syscall.Munmap(mem)
+		return fail(err)
+	}
+	os.Remove(tmp)
+
+	w.f = f
+	w.mem = mem
+	w.end = HeaderSize
+	w.nextIndex = HeaderSize
+	w.indexed = 0
+	return nil
+}
+
+// seal finishes the current segment and gives back its unused space.
+func (w *Writer) seal() error {
+	atomic.StoreUint32(headerField32(w.mem, flagsOffset), FlagSealed)
+	err := syscall.Munmap(w.mem)
+	w.mem = nil
+	if terr := w.f.Truncate(int64(w.end)); err == nil {
+		err = terr
+	}
+	if cerr := w.f.Close(); err == nil {
+		err = cerr
+	}
+	return err
+}
+
+func (w *Writer) rotate() error {
+	if err := w.seal(); err != nil {
+		return err
+	}
+	w.seq++
+	atomic.AddUint64(&w.Rotations, 1)
+
+	if w.maxSegments > 0 {
+		seqs, err := segments(w.dir)
+		if err == nil {
+			// the new segment is not created yet
+			for len(seqs) >= w.maxSegments {
+				os.Remove(segmentName(w.dir, seqs[0]))
+				seqs = seqs[1:]
+			}
+		}
+	}
+	return w.open()
+}
+
+// Write appends the records in p, which must hold whole records, as one
+// or more consecutive writes of package stream's framing.
+func (w *Writer) Write(p []byte) (int, error) {
+	if w.mem == nil {
+		return 0, errors.New("spool: writer closed")
+	}
+
+	n := 0
+	for len(p) >= stream.RecordHeaderSize {
+		size := stream.RecordSize(p)
+		if size < stream.RecordHeaderSize || size > len(p) {
+			return n, fmt.Errorf("spool: bad record length %d", size)
+		}
+		if err := w.append(p[:size]); err != nil {
+			return n, err
+		}
+		n += size
+		p = p[size:]
+	}
+	return n, nil
+}
+
+func (w *Writer) append(rec []byte) error {
+	if HeaderSize+len(rec) > w.segmentSize {
+		atomic.AddUint64(&w.Dropped, 1)
+		return nil
+	}
+	if w.end+len(rec) > w.segmentSize {
+		if err := w.rotate(); err != nil {
+			return err
+		}
+	}
+
+	copy(w.mem[w.end:], rec)
+	if w.end >= w.nextIndex && w.indexed < MaxIndexEntries && len(rec) >= stream.RecordHeaderSize+8 {
+		// all record kinds start with their timestamp
+		e := w.mem[indexOffset+w.indexed*indexEntrySize:]
+		hostOrder.PutUint64(e[0:], stream.RecordTimestamp(rec))
+		hostOrder.PutUint64(e[8:], uint64(w.end))
+		w.indexed++
+		atomic.StoreUint32(headerField32(w.mem, indexCountOffset), uint32(w.indexed))
+		w.nextIndex = w.end + w.interval
+	}
+	w.end += len(rec)
+	atomic.StoreUint64((*uint64)(unsafe.Pointer(&w.mem[committedOffset])), uint64(w.end))
+	return nil
+}
+
+// Close seals the current segment.
+func (w *Writer) Close() error {
+	if w.mem == nil {
+		return nil
+	}
+	return w.seal()
+}
+
+// String formats the writer's counters.
+func (w *Writer) String() string {
+	return fmt.Sprintf("spool: segment %d, %d rotations, %d records dropped",
+		w.seq, atomic.LoadUint64(&w.Rotations), atomic.LoadUint64(&w.Dropped))
+}
@@ -0,0 +1,61 @@
+package main
+
+import (
+	"fmt"
+	"strings"
+	"sync"
+	"time"
+)
+
+// startupTimer records how long each phase of the startup took. Phases
+// may overlap, see -fast-start.
+type startupTimer struct {
+	mu     sync.Mutex
+	start  time.Time
+	phases []startupPhase
+}
+
+type startupPhase struct {
+	name       string
+	start, end time.Duration
+}
+
+func newStartupTimer() *startupTimer {
+	return &startupTimer{start: time.Now()}
+}
+
+// Begin starts the phase name and returns the function ending it.
+func (st *startupTimer) Begin(name string) func() {
+	start := time.Since(st.start)
+	return func() {
+		end := time.Since(st.start)
+		st.mu.Lock()
+		st.phases = append(st.phases, startupPhase{name, start, end})
+		st.mu.Unlock()
+	}
+}
+
+// String formats the phases ended so far, in the order they started, with
+// the time they started at and the total time since the timer was created.
+func (st *startupTimer) String() string {
+	st.mu.Lock()
+	defer st.mu.Unlock()
+
+	phases := make([]startupPhase, len(st.phases))
+	copy(phases, st.phases)
+	for i := 1; i < len(phases); i++ {
+		for j := i; j > 0 && phases[j].start < phases[j-1].start; j-- {
+			phases[j], phases[j-1] = phases[j-1], phases[j]
+		}
+	}
+
+	parts := make([]string, len(phases))
+	for i, p := range phases {
+		parts[i] = fmt.Sprintf("%s %v (at %v)", p.name, roundMillis(p.end-p.start), roundMillis(p.start))
+	}
+	return fmt.Sprintf("startup: %s, ready after %v", strings.Join(parts, ", "), roundMillis(time.Since(st.start)))
+}
+
+func roundMillis(d time.Duration) time.Duration {
+	return (d + 50*time.Microsecond) / (100 * time.Microsecond) * (100 * time.Microsecond)
+}
@@ -0,0 +1,98 @@
+package main
+
+import (
+	"fmt"
+	"io"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/kinvolk/gobpf-elf-loader/tracer"
+)
+
+// statsReporter periodically prints the rates of the event sources along
+// with the backlog of the pipeline, to tell an idle system from a
+// saturated one.
+type statsReporter struct {
+	w        io.Writer
+	interval time.Duration
+	tracer   *tracer.Tracer
+
+	last     []tracer.SourceStats
+	lastTime time.Time
+
+	stop chan struct{}
+	wg   sync.WaitGroup
+}
+
+func newStatsReporter(w io.Writer, interval time.Duration, t *tracer.Tracer) *statsReporter {
+	return &statsReporter{
+		w:        w,
+		interval: interval,
+		tracer:   t,
+		stop:     make(chan struct{}),
+	}
+}
+
+func perSecond(n uint64, d time.Duration) uint64 {
+	return uint64(float64(n) / d.Seconds())
+}
+
+// report prints one line with the rates since the previous call.
+func (sr *statsReporter) report() {
+	now := time.Now()
+	stats := sr.tracer.Stats()
+	elapsed := now.Sub(sr.lastTime)
+	if elapsed <= 0 {
+		return
+	}
+
+	var samples, bytes, lost uint64
+	parts := make([]string, len(stats))
+	for i, st := range stats {
+		prev := sr.last[i]
+		samples += st.Samples - prev.Samples
+		bytes += st.Bytes - prev.Bytes
+		lost += st.Lost - prev.Lost
+		parts[i] = fmt.Sprintf("%s (%s) %d events/s %d wakeups/s %d lost/s %d pending bytes %d held",
+			st.Map, st.Kind,
+			perSecond(st.Samples-prev.Samples, elapsed),
+			perSecond(st.Wakeups-prev.Wakeups, elapsed),
+			perSecond(st.Lost-prev.Lost, elapsed),
+			st.Pending, st.Held)
+	}
+
+	fmt.Fprintf(sr.w, "stats: %d events/s %d bytes/s %d lost/s backlog %d | %s\n",
+		perSecond(samples, elapsed), perSecond(bytes, elapsed), perSecond(lost, elapsed),
+		sr.tracer.Backlog(), strings.Join(parts, " | "))
+
+	sr.last = stats
+	sr.lastTime = now
+}
+
+func (sr *statsReporter) Start() {
+	sr.last = sr.tracer.Stats()
+	sr.lastTime = time.Now()
+
+	sr.wg.Add(1)
+	go func() {
+		defer sr.wg.Done()
+
+		ticker := time.NewTicker(sr.interval)
+		defer ticker.Stop()
+
+		for {
+			select {
+			case <-ticker.C:
+				sr.report()
+			case <-sr.stop:
+				return
+			}
+		}
+	}()
+}
+
+func (sr *statsReporter) Stop() {
+	close(sr.stop)
+	sr.wg.Wait()
+}
@@ -0,0 +1,110 @@
+package stream
+
+import (
+	"bufio"
+	"bytes"
+	"compress/flate"
+	"errors"
+	"fmt"
+	"io"
+)
+
+// Reader decodes the records of a stream.
+type Reader struct {
+	r          *bufio.Reader
+	compressed bool
+
+	fr     io.ReadCloser
+	stored []byte
+	block  []byte
+	off    int
+}
+
+// NewReader reads and checks the stream header.
+func NewReader(r io.Reader) (*Reader, error) {
+	sr := &Reader{r: bufio.NewReaderSize(r, 64*1024)}
+
+	var header [HeaderSize]byte
+	if _, err := io.ReadFull(sr.r, header[:]); err != nil {
+		return nil, err
+	}
+	if string(header[:4]) != Magic {
+		return nil, errors.New("stream: bad magic")
+	}
+	if v := le.Uint16(header[4:]); v != Version {
+		return nil, fmt.Errorf("stream: unsupported version %d", v)
+	}
+	sr.compressed = le.Uint16(header[6:])&FlagCompressed != 0
+	return sr, nil
+}
+
+func (sr *Reader) readBlock() error {
+	var header [BlockHeaderSize]byte
+	if _, err := io.ReadFull(sr.r, header[:]); err != nil {
+		// a stream may end after any block
+		return err
+	}
+	storedLen := int(le.Uint32(header[0:]))
+	rawLen := int(le.Uint32(header[4:]))
+	if storedLen > MaxBlockSize || rawLen > MaxBlockSize {
+		return fmt.Errorf("stream: block of %d bytes too large", rawLen)
+	}
+	if !sr.compressed && storedLen != rawLen {
+		return errors.New("stream: corrupt block header")
+	}
+
+	if cap(sr.block) < rawLen {
+		sr.block = make([]byte, rawLen)
+	}
+	sr.block = sr.block[:rawLen]
+	sr.off = 0
+
+	if !sr.compressed {
+		_, err := io.ReadFull(sr.r, sr.block)
+		return unexpectedEOF(err)
+	}
+
+	if cap(sr.stored) < storedLen {
+		sr.stored = make([]byte, storedLen)
+	}
+	sr.stored = sr.stored[:storedLen]
+	if _, err := io.ReadFull(sr.r, sr.stored); err != nil {
+		return unexpectedEOF(err)
+	}
+	src := bytes.NewReader(sr.stored)
+	if sr.fr == nil {
+		sr.fr = flate.NewReader(src)
+	} else {
+		sr.fr.(flate.Resetter).Reset(src, nil)
+	}
+	_, err := io.ReadFull(sr.fr, sr.block)
+	return unexpectedEOF(err)
+}
+
+func unexpectedEOF(err error) error {
+	if err == io.EOF {
+		return io.ErrUnexpectedEOF
+	}
+	return err
+}
+
+// Next returns the next record. It returns io.EOF at the end of the
+// stream.
+func (sr *Reader) Next() (Record, error) {
+	for sr.off == len(sr.block) {
+		if err := sr.readBlock(); err != nil {
+			return Record{}, err
+		}
+	}
+
+	rest := sr.block[sr.off:]
+	if len(rest) < RecordHeaderSize {
+		return Record{}, errors.New("stream: truncated record header")
+	}
+	size := int(le.Uint16(rest[2:]))
+	if size < RecordHeaderSize || size > len(rest) {
+		return Record{}, fmt.Errorf("stream: bad record length %d", size)
+	}
+	sr.off += size
+	return Record{Kind: rest[0], Flags: rest[1], Payload: rest[RecordHeaderSize:size]}, nil
+}
@@ -0,0 +1,279 @@
+// Package stream reads and writes the binary output of gobpf-elf-loader,
+// selected with -output-format binary. It lets collectors get the event
+// fields without parsing the text lines back.
+//
+// A stream is a header followed by length-prefixed blocks of records. All
+// integers are little endian, addresses are in network byte order:
+//
+//	header: [4]byte "TCPT", u16 version, u16 flags
+//	block:  u32 stored length, u32 raw length, stored bytes
+//	record: u8 kind, u8 flags, u16 length of the record, payload
+//
+// With FlagCompressed, the stored bytes of each block are deflated on
+// their own, so a block can be decoded without the ones before it. Records
+// never span blocks. Their length includes the 4 byte record header, so
+// that readers can skip kinds they do not know.
+package stream
+
+import (
+	"encoding/binary"
+	"errors"
+)
+
+const (
+	Magic   = "TCPT"
+	Version = 1
+
+	// FlagCompressed says the blocks are compressed with DEFLATE.
+	FlagCompressed = 1 << 0
+
+	HeaderSize       = 8
+	BlockHeaderSize  = 8
+	RecordHeaderSize = 4
+
+	// MaxBlockSize bounds the blocks readers accept.
+	MaxBlockSize = 64 << 20
+)
+
+// Record kinds
+const (
+	KindTCPEventV4 = 1
+	KindTCPEventV6 = 2
+	KindFlow       = 3
+	KindLatency    = 4
+)
+
+// Record flags
+const (
+	// RecordLate marks events older than one written before them, see
+	// -reorder-window. It is never set with -unordered.
+	RecordLate = 1 << 0
+)
+
+// Record sizes, headers included
+const (
+	TCPEventV4Size = RecordHeaderSize + 60
+	TCPEventV6Size = RecordHeaderSize + 84
+	FlowSize       = RecordHeaderSize + 36
+	LatencySize    = RecordHeaderSize + 24
+)
+
+// ErrShortRecord is returned when decoding a record smaller than its kind.
+var ErrShortRecord = errors.New("stream: short record")
+
+var le = binary.LittleEndian
+
+// TCPEventV4 is a connect, accept or close of an IPv4 socket.
+type TCPEventV4 struct {
+	Timestamp uint64
+	CPU       uint64
+	Type      uint32 // 1 connect, 2 accept, 3 close
+	Pid       uint32
+	Comm      [16]byte
+	SAddr     [4]byte
+	DAddr     [4]byte
+	SPort     uint16
+	DPort     uint16
+	NetNS     uint32
+	// Weight is the number of events this one stands for when the kernel
+	// samples or rate limits them.
+	Weight uint32
+}
+
+// TCPEventV6 is the IPv6 counterpart of TCPEventV4.
+type TCPEventV6 struct {
+	Timestamp uint64
+	CPU       uint64
+	Type      uint32
+	Pid       uint32
+	Comm      [16]byte
+	SAddr     [16]byte
+	DAddr     [16]byte
+	SPort     uint16
+	DPort     uint16
+	NetNS     uint32
+	Weight    uint32
+}
+
+// Flow is the number of IPv4 connects of a flow during a collection
+// interval, from objects aggregating in the kernel.
+type Flow struct {
+	Timestamp uint64
+	Pid       uint32
+	SAddr     [4]byte
+	DAddr     [4]byte
+	NetNS     uint32
+	DPort     uint16
+	Count     uint64
+}
+
+// Latency is the number of connects to a destination that took from 2^Slot
+// to 2^(Slot+1) ns during a collection interval.
+type Latency struct {
+	Timestamp uint64
+	NetNS     uint32
+	DPort     uint16
+	Slot      uint8
+	Count     uint64
+}
+
+func appendRecordHeader(buf []byte, kind, flags uint8, size int) []byte {
+	return append(buf, kind, flags, byte(size), byte(size>>8))
+}
+
+func appendU16(buf []byte, v uint16) []byte {
+	return append(buf, byte(v), byte(v>>8))
+}
+
+func appendU32(buf []byte, v uint32) []byte {
+	return append(buf, byte(v), byte(v>>8), byte(v>>16), byte(v>>24))
+}
+
+func appendU64(buf []byte, v uint64) []byte {
+	return appendU32(appendU32(buf, uint32(v)), uint32(v>>32))
+}
+
+// AppendTCPEventV4 appends the record of e to buf.
+func AppendTCPEventV4(buf []byte, e *TCPEventV4, flags uint8) []byte {
+	buf = appendRecordHeader(buf, KindTCPEventV4, flags, TCPEventV4Size)
+	buf = appendU64(buf, e.Timestamp)
+	buf = appendU64(buf, e.CPU)
+	buf = appendU32(buf, e.Type)
+	buf = appendU32(buf, e.Pid)
+	buf = append(buf, e.Comm[:]...)
+	buf = append(buf, e.SAddr[:]...)
+	buf = append(buf, e.DAddr[:]...)
+	buf = appendU16(buf, e.SPort)
+	buf = appendU16(buf, e.DPort)
+	buf = appendU32(buf, e.NetNS)
+	return appendU32(buf, e.Weight)
+}
+
+// AppendTCPEventV6 appends the record of e to buf.
+func AppendTCPEventV6(buf []byte, e *TCPEventV6, flags uint8) []byte {
+	buf = appendRecordHeader(buf, KindTCPEventV6, flags, TCPEventV6Size)
+	buf = appendU64(buf, e.Timestamp)
+	buf = appendU64(buf, e.CPU)
+	buf = appendU32(buf, e.Type)
+	buf = appendU32(buf, e.Pid)
+	buf = append(buf, e.Comm[:]...)
+	buf = append(buf, e.SAddr[:]...)
+	buf = append(buf, e.DAddr[:]...)
+	buf = appendU16(buf, e.SPort)
+	buf = appendU16(buf, e.DPort)
+	buf = appendU32(buf, e.NetNS)
+	return appendU32(buf, e.Weight)
+}
+
+// AppendFlow appends the record of f to buf.
+func AppendFlow(buf []byte, f *Flow) []byte {
+	buf = appendRecordHeader(buf, KindFlow, 0, FlowSize)
+	buf = appendU64(buf, f.Timestamp)
+	buf = appendU32(buf, f.Pid)
+	buf = append(buf, f.SAddr[:]...)
+	buf = append(buf, f.DAddr[:]...)
+	buf = appendU32(buf, f.NetNS)
+	buf = appendU16(buf, f.DPort)
+	buf = appendU16(buf, 0)
+	return appendU64(buf, f.Count)
+}
+
+// RecordSize returns the length of the record at the start of b, header
+// included. b must hold at least the record header.
+func RecordSize(b []byte) int {
+	return int(le.Uint16(b[2:]))
+}
+
+// RecordTimestamp returns the timestamp of the record at the start of b,
+// all kinds start with it. b must hold at least 12 bytes.
+func RecordTimestamp(b []byte) uint64 {
+	return le.Uint64(b[RecordHeaderSize:])
+}
+
+// AppendLatency appends the record of l to buf.
+func AppendLatency(buf []byte, l *Latency) []byte {
+	buf = appendRecordHeader(buf, KindLatency, 0, LatencySize)
+	buf = appendU64(buf, l.Timestamp)
+	buf = appendU32(buf, l.NetNS)
+	buf = appendU16(buf, l.DPort)
+	buf = append(buf, l.Slot, 0)
+	return appendU64(buf, l.Count)
+}
+
+// Record is one record of a stream. Payload is only valid until the next
+// call to Reader.Next.
+type Record struct {
+	Kind    uint8
+	Flags   uint8
+	Payload []byte
+}
+
+// TCPEventV4 decodes a record of kind KindTCPEventV4.
+func (r *Record) TCPEventV4(e *TCPEventV4) error {
+	p := r.Payload
+	if len(p) < TCPEventV4Size-RecordHeaderSize {
+		return ErrShortRecord
+	}
+	e.Timestamp = le.Uint64(p[0:8])
+	e.CPU = le.Uint64(p[8:16])
+	e.Type = le.Uint32(p[16:20])
+	e.Pid = le.Uint32(p[20:24])
+	copy(e.Comm[:], p[24:40])
+	copy(e.SAddr[:], p[40:44])
+	copy(e.DAddr[:], p[44:48])
+	e.SPort = le.Uint16(p[48:50])
+	e.DPort = le.Uint16(p[50:52])
+	e.NetNS = le.Uint32(p[52:56])
+	e.Weight = le.Uint32(p[56:60])
+	return nil
+}
+
+// TCPEventV6 decodes a record of kind KindTCPEventV6.
+func (r *Record) TCPEventV6(e *TCPEventV6) error {
+	p := r.Payload
+	if len(p) < TCPEventV6Size-RecordHeaderSize {
+		return ErrShortRecord
+	}
+	e.Timestamp = le.Uint64(p[0:8])
+	e.CPU = le.Uint64(p[8:16])
+	e.Type = le.Uint32(p[16:20])
+	e.Pid = le.Uint32(p[20:24])
+	copy(e.Comm[:], p[24:40])
+	copy(e.SAddr[:], p[40:56])
+	copy(e.DAddr[:], p[56:72])
+	e.SPort = le.Uint16(p[72:74])
+	e.DPort = le.Uint16(p[74:76])
+	e.NetNS = le.Uint32(p[76:80])
+	e.Weight = le.Uint32(p[80:84])
+	return nil
+}
+
+// Flow decodes a record of kind KindFlow.
+func (r *Record) Flow(f *Flow) error {
+	p := r.Payload
+	if len(p) < FlowSize-RecordHeaderSize {
+		return ErrShortRecord
+	}
+	f.Timestamp = le.Uint64(p[0:8])
+	f.Pid = le.Uint32(p[8:12])
+	copy(f.SAddr[:], p[12:16])
+	copy(f.DAddr[:], p[16:20])
+	f.NetNS = le.Uint32(p[20:24])
+	f.DPort = le.Uint16(p[24:26])
+	f.Count = le.Uint64(p[28:36])
+	return nil
+}
+
+// Latency decodes a record of kind KindLatency.
+func (r *Record) Latency(l *Latency) error {
+	p := r.Payload
+	if len(p) < LatencySize-RecordHeaderSize {
+		return ErrShortRecord
+	}
+	l.Timestamp = le.Uint64(p[0:8])
+	l.NetNS = le.Uint32(p[8:12])
+	l.DPort = le.Uint16(p[12:14])
+	l.Slot = p[14]
+	l.Count = le.Uint64(p[16:24])
+	return nil
+}
@@ -0,0 +1,267 @@
+package stream
+
+import (
+	"bytes"
+	"io"
+	"io/ioutil"
+	"testing"
+)
+
+func testEventV4(i int) TCPEventV4 {
+	e := TCPEventV4{
+		Timestamp: uint64(1000 + i),
+		CPU:       uint64(i % 8),
+		Type:      1,
+		Pid:       uint32(4242 + i),
+		SAddr:     [4]byte{127, 0, 0, 1},
+		DAddr:     [4]byte{10, 1, 2, byte(i)},
+		SPort:     uint16(30000 + i),
+		DPort:     80,
+		NetNS:     4026531993,
+		Weight:    1,
+	}
+	copy(e.Comm[:], "curl")
+	return e
+}
+
+// testBlocks returns the blocks of one record of every kind each, and the
+// records in order.
+func testBlocks() ([][]byte, []Record) {
+	var blocks [][]byte
+	var records []Record
+	for i := 0; i < 3; i++ {
+		var block []byte
+		e := testEventV4(i)
+		block = AppendTCPEventV4(block, &e, 0)
+		e6 := TCPEventV6{Timestamp: uint64(2000 + i), Type: 2, DPort: 443, Weight: 7}
+		e6.DAddr[0], e6.DAddr[15] = 0xfe, byte(i)
+		block = AppendTCPEventV6(block, &e6, RecordLate)
+		f := Flow{Timestamp: uint64(3000 + i), Pid: 1, DPort: 22, Count: uint64(i)}
+		block = AppendFlow(block, &f)
+		l := Latency{Timestamp: uint64(4000 + i), DPort: 80, Slot: 12, Count: 5}
+		block = AppendLatency(block, &l)
+		blocks = append(blocks, block)
+
+		for off := 0; off < len(block); off += RecordSize(block[off:]) {
+			size := RecordSize(block[off:])
+			records = append(records, Record{
+				Kind:    block[off],
+				Flags:   block[off+1],
+				Payload: block[off+RecordHeaderSize : off+size],
+			})
+		}
+	}
+	return blocks, records
+}
+
+func writeStream(t testing.TB, compress bool, blocks [][]byte) []byte {
+	var out bytes.Buffer
+	w, err := NewWriter(&out, compress)
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, block := range blocks {
+		if _, err := w.Write(block); err != nil {
+			t.Fatal(err)
+		}
+	}
+	return out.Bytes()
+}
+
+func TestRoundTrip(t *testing.T) {
+	blocks, want := testBlocks()
+	for _, compress := range []bool{false, true} {
+		data := writeStream(t, compress, blocks)
+		r, err := NewReader(bytes.NewReader(data))
+		if err != nil {
+			t.Fatal(err)
+		}
+
+		for i, w := range want {
+			rec, err := r.Next()
+			if err != nil {
+				t.Fatalf("compress %v: record %d: %v", compress, i, err)
+			}
+			if rec.Kind != w.Kind || rec.Flags != w.Flags || !bytes.Equal(rec.Payload, w.Payload) {
+				t.Fatalf("compress %v: record %d is %+v, want %+v", compress, i, rec, w)
+			}
+		}
+		if _, err := r.Next(); err != io.EOF {
+			t.Fatalf("compress %v: got %v at the end of the stream, want EOF", compress, err)
+		}
+	}
+}
+
+func TestDecode(t *testing.T) {
+	_, records := testBlocks()
+
+	var e TCPEventV4
+	if err := records[0].TCPEventV4(&e); err != nil {
+		t.Fatal(err)
+	}
+	if want := testEventV4(0); e != want {
+		t.Errorf("got %+v, want %+v", e, want)
+	}
+
+	var e6 TCPEventV6
+	if err := records[1].TCPEventV6(&e6); err != nil {
+		t.Fatal(err)
+	}
+	if e6.Timestamp != 2000 || e6.DAddr[0] != 0xfe || e6.DPort != 443 || e6.Weight != 7 {
+		t.Errorf("got %+v", e6)
+	}
+	if records[1].Flags&RecordLate == 0 {
+		t.Error("late flag lost")
+	}
+
+	var f Flow
+	if err := records[2].Flow(&f); err != nil {
+		t.Fatal(err)
+	}
+	if f.Timestamp != 3000 || f.DPort != 22 {
+		t.Errorf("got %+v", f)
+	}
+
+	var l Latency
+	if err := records[3].Latency(&l); err != nil {
+		t.Fatal(err)
+	}
+	if l.Timestamp != 4000 || l.Slot != 12 || l.Count != 5 {
+		t.Errorf("got %+v", l)
+	}
+
+	short := Record{Kind: KindTCPEventV4, Payload: records[0].Payload[:10]}
+	if err := short.TCPEventV4(&e); err != ErrShortRecord {
+		t.Errorf("got %v for a short record, want ErrShortRecord", err)
+	}
+}
+
+// A stream cut anywhere but between blocks is an error, never a clean end
+// nor garbage records.
+func TestTruncated(t *testing.T) {
+	blocks, records := testBlocks()
+	perBlock := len(records) / len(blocks)
+	for _, compress := range []bool{false, true} {
+		data := writeStream(t, compress, blocks)
+
+		// the ends of the blocks
+		ends := map[int]int{}
+		off := HeaderSize
+		for i, block := range writeBlocks(t, compress, blocks) {
+			off += len(block)
+			ends[off] = (i + 1) * perBlock
+		}
+
+		for n := 0; n < len(data); n++ {
+			r, err := NewReader(bytes.NewReader(data[:n]))
+			if n < HeaderSize {
+				if err == nil {
+					t.Fatalf("compress %v: header cut at %d accepted", compress, n)
+				}
+				continue
+			}
+			if err != nil {
+				t.Fatal(err)
+			}
+
+			got := 0
+			for {
+				_, err = r.Next()
+				if err != nil {
+					break
+				}
+				got++
+			}
+			if want, clean := ends[n]; clean || n == HeaderSize {
+				if err != io.EOF || got != want {
+					t.Fatalf("compress %v: cut at %d: got %d records and %v, want %d and EOF", compress, n, got, err, want)
+				}
+			} else if err == io.EOF {
+				t.Fatalf("compress %v: cut at %d inside a block read as a clean end", compress, n)
+			}
+		}
+	}
+}
+
+// writeBlocks returns the framed blocks of blocks, without the header.
+func writeBlocks(t testing.TB, compress bool, blocks [][]byte) [][]byte {
+	var framed [][]byte
+	for _, block := range blocks {
+		data := writeStream(t, compress, [][]byte{block})
+		framed = append(framed, data[HeaderSize:])
+	}
+	return framed
+}
+
+func TestBadHeader(t *testing.T) {
+	data := writeStream(t, false, nil)
+	bad := append([]byte("XXXX"), data[4:]...)
+	if _, err := NewReader(bytes.NewReader(bad)); err == nil {
+		t.Error("bad magic accepted")
+	}
+	bad = append([]byte(nil), data...)
+	bad[4] = Version + 1
+	if _, err := NewReader(bytes.NewReader(bad)); err == nil {
+		t.Error("unknown version accepted")
+	}
+}
+
+// benchBlock is a block of 256 IPv4 events, as the loader writes them.
+func benchBlock() []byte {
+	var block []byte
+	for i := 0; i < 256; i++ {
+		e := testEventV4(i)
+		block = AppendTCPEventV4(block, &e, 0)
+	}
+	return block
+}
+
+func benchmarkWrite(b *testing.B, compress bool) {
+	block := benchBlock()
+	w, err := NewWriter(ioutil.Discard, compress)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.SetBytes(int64(len(block)))
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		w.Write(block)
+	}
+}
+
+func BenchmarkWrite(b *testing.B)           { benchmarkWrite(b, false) }
+func BenchmarkWriteCompressed(b *testing.B) { benchmarkWrite(b, true) }
+
+func benchmarkRead(b *testing.B, compress bool) {
+	const blocks = 64
+	block := benchBlock()
+	framed := make([][]byte, blocks)
+	for i := range framed {
+		framed[i] = block
+	}
+	data := writeStream(b, compress, framed)
+	src := bytes.NewReader(data)
+	var r *Reader
+	var e TCPEventV4
+	b.SetBytes(int64(len(block)))
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if i%blocks == 0 {
+			src.Reset(data)
+			var err error
+			if r, err = NewReader(src); err != nil {
+				b.Fatal(err)
+			}
+		}
+		for n := 0; n < len(block)/TCPEventV4Size; n++ {
+			rec, err := r.Next()
+			if err != nil {
+				b.Fatal(err)
+			}
+			rec.TCPEventV4(&e)
+		}
+	}
+}
+
+func BenchmarkRead(b *testing.B)           { benchmarkRead(b, false) }
+func BenchmarkReadCompressed(b *testing.B) { benchmarkRead(b, true) }
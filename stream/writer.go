@@ -0,0 +1,70 @@
+package stream
+
+import (
+	"bytes"
+	"compress/flate"
+	"io"
+)
+
+// Writer frames the records written to it into blocks.
+type Writer struct {
+	w        io.Writer
+	compress bool
+
+	fw       *flate.Writer
+	deflated bytes.Buffer
+	block    []byte
+}
+
+// NewWriter writes the stream header to w and returns a Writer for the
+// blocks. With compress, each block is deflated.
+func NewWriter(w io.Writer, compress bool) (*Writer, error) {
+	sw := &Writer{w: w, compress: compress}
+
+	var flags uint16
+	if compress {
+		flags |= FlagCompressed
+		fw, err := flate.NewWriter(&sw.deflated, flate.BestSpeed)
+		if err != nil {
+			return nil, err
+		}
+		sw.fw = fw
+	}
+
+	header := append([]byte(Magic), 0, 0, 0, 0)
+	le.PutUint16(header[4:], Version)
+	le.PutUint16(header[6:], flags)
+	if _, err := w.Write(header); err != nil {
+		return nil, err
+	}
+	return sw, nil
+}
+
+// Write writes p, which must hold whole records, as one block.
+func (sw *Writer) Write(p []byte) (int, error) {
+	if len(p) == 0 {
+		return 0, nil
+	}
+
+	stored := p
+	if sw.compress {
+		sw.deflated.Reset()
+		sw.fw.Reset(&sw.deflated)
+		sw.fw.Write(p)
+		if err := sw.fw.Close(); err != nil {
+			return 0, err
+		}
+		stored = sw.deflated.Bytes()
+	}
+
+	// one write per block, so that blocks are not interleaved on a
+	// shared socket
+	sw.block = append(sw.block[:0], 0, 0, 0, 0, 0, 0, 0, 0)
+	le.PutUint32(sw.block[0:], uint32(len(stored)))
+	le.PutUint32(sw.block[4:], uint32(len(p)))
+	sw.block = append(sw.block, stored...)
+	if _, err := sw.w.Write(sw.block); err != nil {
+		return 0, err
+	}
+	return len(p), nil
+}
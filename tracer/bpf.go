@@ -0,0 +1,89 @@
+package tracer
+
+import (
+	"syscall"
+	"unsafe"
+)
+
+// Parts of the bpf(2) interface gobpf does not wrap.
+
+const (
+	bpfMapLookupElem  = 1
+	bpfMapDeleteElem  = 3
+	bpfMapGetNextKey  = 4
+	bpfObjGetInfoByFd = 15
+)
+
+const (
+	bpfMapTypePerfEventArray = 4
+	bpfMapTypePercpuHash     = 5
+	bpfMapTypeRingBuf        = 27
+)
+
+// bpfMapElemAttr is the BPF_MAP_*_ELEM and BPF_MAP_GET_NEXT_KEY flavour of
+// union bpf_attr.
+type bpfMapElemAttr struct {
+	mapFd uint32
+	_     uint32
+	key   uint64
+	value uint64 // or next_key
+	flags uint64
+}
+
+func bpfMapCall(cmd int, fd int, key, value unsafe.Pointer) error {
+	attr := bpfMapElemAttr{
+		mapFd: uint32(fd),
+		key:   uint64(uintptr(key)),
+		value: uint64(uintptr(value)),
+	}
+	_, _, errno := syscall.Syscall(sysBPF, uintptr(cmd), uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+func bpfMapLookupElemFd(fd int, key, value unsafe.Pointer) error {
+	return bpfMapCall(bpfMapLookupElem, fd, key, value)
+}
+
+func bpfMapDeleteElemFd(fd int, key unsafe.Pointer) error {
+	return bpfMapCall(bpfMapDeleteElem, fd, key, nil)
+}
+
+// bpfMapGetNextKeyFd stores in next the key following key, or the first
+// key if key is nil. It returns ENOENT past the last key.
+func bpfMapGetNextKeyFd(fd int, key, next unsafe.Pointer) error {
+	return bpfMapCall(bpfMapGetNextKey, fd, key, next)
+}
+
+// bpfMapInfo mirrors the beginning of struct bpf_map_info.
+type bpfMapInfo struct {
+	Type       uint32
+	ID         uint32
+	KeySize    uint32
+	ValueSize  uint32
+	MaxEntries uint32
+	MapFlags   uint32
+	Name       [16]byte
+	_          [64]byte
+}
+
+func bpfMapGetInfo(fd int) (*bpfMapInfo, error) {
+	var info bpfMapInfo
+	attr := struct {
+		fd      uint32
+		infoLen uint32
+		info    uint64
+	}{
+		fd:      uint32(fd),
+		infoLen: uint32(unsafe.Sizeof(info)),
+		info:    uint64(uintptr(unsafe.Pointer(&info))),
+	}
+
+	_, _, errno := syscall.Syscall(sysBPF, bpfObjGetInfoByFd, uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+	if errno != 0 {
+		return nil, errno
+	}
+	return &info, nil
+}
@@ -0,0 +1,4 @@
+package tracer
+
+// sysBPF is the number of the bpf(2) system call, missing from package syscall
+const sysBPF = 321
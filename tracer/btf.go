@@ -0,0 +1,268 @@
+package tracer
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io/ioutil"
+)
+
+const (
+	btfMagic       = 0xeb9f
+	BTFVmlinuxPath = "/sys/kernel/btf/vmlinux"
+
+	btfKindInt       = 1
+	btfKindPtr       = 2
+	btfKindArray     = 3
+	btfKindStruct    = 4
+	btfKindUnion     = 5
+	btfKindEnum      = 6
+	btfKindFwd       = 7
+	btfKindTypedef   = 8
+	btfKindVolatile  = 9
+	btfKindConst     = 10
+	btfKindRestrict  = 11
+	btfKindFunc      = 12
+	btfKindFuncProto = 13
+	btfKindVar       = 14
+	btfKindDatasec   = 15
+	btfKindFloat     = 16
+	btfKindDeclTag   = 17
+	btfKindTypeTag   = 18
+	btfKindEnum64    = 19
+)
+
+type btfMember struct {
+	name   string
+	typ    uint32
+	offset uint32 // in bits
+}
+
+type btfType struct {
+	name    string
+	kind    uint32
+	typ     uint32 // for modifiers and typedefs
+	members []btfMember
+}
+
+// btfSpec is the subset of a BTF blob needed to compute member offsets.
+type btfSpec struct {
+	types []btfType // indexed by type id, 0 is void
+}
+
+func loadBTF(path string) (*btfSpec, error) {
+	buf, err := ioutil.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	return parseBTF(buf)
+}
+
+func parseBTF(buf []byte) (*btfSpec, error) {
+	if len(buf) < 24 {
+		return nil, fmt.Errorf("btf: header too short")
+	}
+
+	var bo binary.ByteOrder = binary.LittleEndian
+	if binary.LittleEndian.Uint16(buf) != btfMagic {
+		bo = binary.BigEndian
+		if bo.Uint16(buf) != btfMagic {
+			return nil, fmt.Errorf("btf: bad magic")
+		}
+	}
+
+	hdrLen := bo.Uint32(buf[4:])
+	typeOff := bo.Uint32(buf[8:])
+	typeLen := bo.Uint32(buf[12:])
+	strOff := bo.Uint32(buf[16:])
+	strLen := bo.Uint32(buf[20:])
+
+	if uint64(hdrLen)+uint64(typeOff)+uint64(typeLen) > uint64(len(buf)) ||
+		uint64(hdrLen)+uint64(strOff)+uint64(strLen) > uint64(len(buf)) {
+		return nil, fmt.Errorf("btf: sections out of bounds")
+	}
+	types := buf[hdrLen+typeOff : hdrLen+typeOff+typeLen]
+	strs := buf[hdrLen+strOff : hdrLen+strOff+strLen]
+
+	str := func(off uint32) string {
+		if off >= uint32(len(strs)) {
+			return ""
+		}
+		end := off
+		for end < uint32(len(strs)) && strs[end] != 0 {
+			end++
+		}
+		return string(strs[off:end])
+	}
+
+	spec := &btfSpec{types: []btfType{{}}}
+	for len(types) > 0 {
+		if len(types) < 12 {
+			return nil, fmt.Errorf("btf: truncated type")
+		}
+		nameOff := bo.Uint32(types[0:])
+		info := bo.Uint32(types[4:])
+		sizeOrType := bo.Uint32(types[8:])
+		types = types[12:]
+
+		vlen := int(info & 0xffff)
+		kind := (info >> 24) & 0x1f
+		kindFlag := info>>31 != 0
+
+		t := btfType{name: str(nameOff), kind: kind, typ: sizeOrType}
+
+		var extra int
+		switch kind {
+		case btfKindInt, btfKindVar, btfKindDeclTag:
+			extra = 4
+		case btfKindArray:
+			extra = 12
+		case btfKindStruct, btfKindUnion:
+			extra = 12 * vlen
+			if len(types) < extra {
+				return nil, fmt.Errorf("btf: truncated members")
+			}
+			for i := 0; i < vlen; i++ {
+				m := types[12*i:]
+				offset := bo.Uint32(m[8:])
+				if kindFlag {
+					// the upper 8 bits hold the bitfield size
+					offset &= 0xffffff
+				}
+				t.members = append(t.members, btfMember{
+					name:   str(bo.Uint32(m[0:])),
+					typ:    bo.Uint32(m[4:]),
+					offset: offset,
+				})
+			}
+		case btfKindEnum, btfKindFuncProto:
+			extra = 8 * vlen
+		case btfKindDatasec, btfKindEnum64:
+			extra = 12 * vlen
+		case btfKindPtr, btfKindFwd, btfKindTypedef, btfKindVolatile,
+			btfKindConst, btfKindRestrict, btfKindFunc, btfKindFloat, btfKindTypeTag:
+		default:
+			return nil, fmt.Errorf("btf: unknown kind %d", kind)
+		}
+		if len(types) < extra {
+			return nil, fmt.Errorf("btf: truncated type data")
+		}
+		types = types[extra:]
+
+		spec.types = append(spec.types, t)
+	}
+
+	return spec, nil
+}
+
+// resolve skips typedefs and type modifiers. It returns nil for an id out
+// of range or a loop of typedefs.
+func (s *btfSpec) resolve(id uint32) *btfType {
+	for hops := 0; int(id) < len(s.types) && hops < len(s.types); hops++ {
+		t := &s.types[id]
+		switch t.kind {
+		case btfKindTypedef, btfKindVolatile, btfKindConst, btfKindRestrict, btfKindTypeTag:
+			id = t.typ
+		default:
+			return t
+		}
+	}
+	return nil
+}
+
+// findStruct returns the struct named name.
+func (s *btfSpec) findStruct(name string) (*btfType, error) {
+	for i := range s.types {
+		if s.types[i].kind == btfKindStruct && s.types[i].name == name && s.types[i].members != nil {
+			return &s.types[i], nil
+		}
+	}
+	return nil, fmt.Errorf("btf: no struct %s", name)
+}
+
+// btfMaxNesting bounds the anonymous structs and unions memberOffset looks
+// into, a malformed blob may nest one in itself.
+const btfMaxNesting = 32
+
+// memberOffset returns the byte offset of member name in t, looking into
+// anonymous structs and unions.
+func (s *btfSpec) memberOffset(t *btfType, name string) (uint64, *btfType, bool) {
+	return s.nestedMemberOffset(t, name, 0)
+}
+
+func (s *btfSpec) nestedMemberOffset(t *btfType, name string, depth int) (uint64, *btfType, bool) {
+	if depth > btfMaxNesting {
+		return 0, nil, false
+	}
+	for _, m := range t.members {
+		if m.name == name {
+			return uint64(m.offset / 8), s.resolve(m.typ), true
+		}
+		if m.name == "" {
+			inner := s.resolve(m.typ)
+			if inner == nil || (inner.kind != btfKindStruct && inner.kind != btfKindUnion) {
+				continue
+			}
+			if off, mt, ok := s.nestedMemberOffset(inner, name, depth+1); ok {
+				return uint64(m.offset/8) + off, mt, true
+			}
+		}
+	}
+	return 0, nil, false
+}
+
+// offsetOf returns the byte offset of the dotted path of members in the
+// struct structName.
+func (s *btfSpec) offsetOf(structName string, path ...string) (uint64, error) {
+	t, err := s.findStruct(structName)
+	if err != nil {
+		return 0, err
+	}
+
+	var total uint64
+	for _, name := range path {
+		if t == nil {
+			return 0, fmt.Errorf("btf: %s.%v is not a struct member", structName, path)
+		}
+		off, mt, ok := s.memberOffset(t, name)
+		if !ok {
+			return 0, fmt.Errorf("btf: no member %s in %s", name, structName)
+		}
+		total += off
+		t = mt
+	}
+	return total, nil
+}
+
+// btfStructOffsets computes from the kernel's BTF the offsets guessOffsets
+// would otherwise find by trial: those of the fields kprobes read from
+// struct sock. struct sock_common is the first member of struct sock, so
+// its offsets are relative to the socket too.
+func btfStructOffsets(path string) (*structOffsets, error) {
+	spec, err := loadBTF(path)
+	if err != nil {
+		return nil, err
+	}
+
+	var offsets structOffsets
+	fields := []struct {
+		dst    *uint64
+		st     string
+		member []string
+	}{
+		{&offsets.OffsetSaddr, "sock_common", []string{"skc_rcv_saddr"}},
+		{&offsets.OffsetDaddr, "sock_common", []string{"skc_daddr"}},
+		{&offsets.OffsetFamily, "sock_common", []string{"skc_family"}},
+		{&offsets.OffsetSport, "inet_sock", []string{"inet_sport"}},
+		{&offsets.OffsetDport, "sock_common", []string{"skc_dport"}},
+		{&offsets.OffsetNetns, "sock_common", []string{"skc_net"}},
+		{&offsets.OffsetIno, "net", []string{"ns", "inum"}},
+		{&offsets.OffsetDaddrIPv6, "sock_common", []string{"skc_v6_daddr"}},
+	}
+	for _, f := range fields {
+		if *f.dst, err = spec.offsetOf(f.st, f.member...); err != nil {
+			return nil, err
+		}
+	}
+
+	return &offsets, nil
+}
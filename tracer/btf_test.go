@@ -0,0 +1,276 @@
+package tracer
+
+import (
+	"encoding/binary"
+	"io/ioutil"
+	"path/filepath"
+	"strings"
+	"testing"
+)
+
+// btfBuilder writes a little endian BTF blob, type by type.
+type btfBuilder struct {
+	types []byte
+	strs  []byte
+	n     uint32
+	offs  []int // of each type in types, by id-1
+}
+
+type btfTestMember struct {
+	name   string
+	typ    uint32
+	offset uint32 // in bits, with the bitfield size in the upper 8 for kind_flag
+}
+
+func newBTFBuilder() *btfBuilder {
+	return &btfBuilder{strs: []byte{0}}
+}
+
+func (b *btfBuilder) str(s string) uint32 {
+	if s == "" {
+		return 0
+	}
+	off := uint32(len(b.strs))
+	b.strs = append(append(b.strs, s...), 0)
+	return off
+}
+
+func (b *btfBuilder) put(v ...uint32) {
+	for _, x := range v {
+		var buf [4]byte
+		binary.LittleEndian.PutUint32(buf[:], x)
+		b.types = append(b.types, buf[:]...)
+	}
+}
+
+// add appends a type and returns its id.
+func (b *btfBuilder) add(name string, kind uint32, kindFlag bool, vlen int, sizeOrType uint32) uint32 {
+	info := kind<<24 | uint32(vlen)
+	if kindFlag {
+		info |= 1 << 31
+	}
+	b.offs = append(b.offs, len(b.types))
+	b.put(b.str(name), info, sizeOrType)
+	b.n++
+	return b.n
+}
+
+// setType sets the type a pointer, typedef or modifier id refers to.
+func (b *btfBuilder) setType(id, typ uint32) {
+	binary.LittleEndian.PutUint32(b.types[b.offs[id-1]+8:], typ)
+}
+
+func (b *btfBuilder) integer(name string, size uint32) uint32 {
+	id := b.add(name, btfKindInt, false, 0, size)
+	b.put(size * 8)
+	return id
+}
+
+func (b *btfBuilder) typedef(name string, typ uint32) uint32 {
+	return b.add(name, btfKindTypedef, false, 0, typ)
+}
+
+func (b *btfBuilder) composite(kind uint32, name string, kindFlag bool, size uint32, members ...btfTestMember) uint32 {
+	id := b.add(name, kind, kindFlag, len(members), size)
+	for _, m := range members {
+		b.put(b.str(m.name), m.typ, m.offset)
+	}
+	return id
+}
+
+func (b *btfBuilder) blob() []byte {
+	buf := make([]byte, 24)
+	binary.LittleEndian.PutUint16(buf[0:], btfMagic)
+	buf[2] = 1 // version
+	binary.LittleEndian.PutUint32(buf[4:], 24)
+	binary.LittleEndian.PutUint32(buf[8:], 0)
+	binary.LittleEndian.PutUint32(buf[12:], uint32(len(b.types)))
+	binary.LittleEndian.PutUint32(buf[16:], uint32(len(b.types)))
+	binary.LittleEndian.PutUint32(buf[20:], uint32(len(b.strs)))
+	return append(append(buf, b.types...), b.strs...)
+}
+
+// sockBTF describes the kernel structs btfStructOffsets reads, laid out as
+// in a 5.x kernel: the addresses and ports of struct sock_common are in
+// unions of an anonymous struct with a wider field, its bitfields make it
+// kind_flag, and the types are behind chains of typedefs and modifiers.
+func sockBTF() []byte {
+	b := newBTFBuilder()
+	u8 := b.integer("unsigned char", 1)
+	u16 := b.integer("unsigned short", 2)
+	u32 := b.integer("unsigned int", 4)
+	u64 := b.integer("long long unsigned int", 8)
+	be16 := b.typedef("__be16", b.typedef("__u16", u16))
+	be32 := b.typedef("__be32", b.typedef("__u32", u32))
+	addrpair := b.typedef("__addrpair", u64)
+	portpair := b.typedef("__portpair", u32)
+
+	addrs := b.composite(btfKindStruct, "", false, 8,
+		btfTestMember{"skc_daddr", be32, 0},
+		btfTestMember{"skc_rcv_saddr", be32, 32})
+	addrUnion := b.composite(btfKindUnion, "", false, 8,
+		btfTestMember{"skc_addrpair", addrpair, 0},
+		btfTestMember{"", addrs, 0})
+	ports := b.composite(btfKindStruct, "", false, 4,
+		btfTestMember{"skc_dport", be16, 0},
+		btfTestMember{"skc_num", u16, 16})
+	portUnion := b.composite(btfKindUnion, "", false, 4,
+		btfTestMember{"skc_portpair", portpair, 0},
+		btfTestMember{"", ports, 0})
+
+	netPtr := b.add("", btfKindPtr, false, 0, 0) // to struct net, set below
+	possibleNet := b.typedef("possible_net_t",
+		b.composite(btfKindStruct, "", false, 8, btfTestMember{"net", netPtr, 0}))
+	in6 := b.composite(btfKindStruct, "in6_addr", false, 16, btfTestMember{"s6_addr32", u32, 0})
+
+	// const volatile struct sock_common, as a member of struct sock
+	sockCommon := b.composite(btfKindStruct, "sock_common", true, 136,
+		btfTestMember{"", addrUnion, 0},
+		btfTestMember{"skc_hash", u32, 64},
+		btfTestMember{"", portUnion, 96},
+		btfTestMember{"skc_family", u16, 128},
+		btfTestMember{"skc_state", b.add("", btfKindVolatile, false, 0, u8), 144},
+		btfTestMember{"skc_reuse", u8, 4<<24 | 152},
+		btfTestMember{"skc_reuseport", u8, 1<<24 | 156},
+		btfTestMember{"skc_net", possibleNet, 48 * 8},
+		btfTestMember{"skc_v6_daddr", in6, 56 * 8})
+	sockCommonConst := b.add("", btfKindConst, false, 0, b.add("", btfKindVolatile, false, 0, sockCommon))
+	sock := b.composite(btfKindStruct, "sock", false, 760,
+		btfTestMember{"__sk_common", sockCommonConst, 0})
+	b.composite(btfKindStruct, "inet_sock", false, 800,
+		btfTestMember{"sk", sock, 0},
+		btfTestMember{"inet_saddr", be32, 760 * 8},
+		btfTestMember{"inet_sport", be16, 782 * 8})
+
+	// a forward declaration, findStruct skips it
+	b.add("net", btfKindFwd, false, 0, 0)
+	nsCommon := b.composite(btfKindStruct, "ns_common", false, 24,
+		btfTestMember{"stashed", u64, 0},
+		btfTestMember{"ops", u64, 64},
+		btfTestMember{"inum", u32, 128})
+	net := b.composite(btfKindStruct, "net", false, 4096,
+		btfTestMember{"passive", u32, 0},
+		btfTestMember{"ns", b.typedef("ns_common_t", nsCommon), 120 * 8})
+	b.setType(netPtr, net)
+
+	return b.blob()
+}
+
+func TestBTFStructOffsets(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "vmlinux")
+	if err := ioutil.WriteFile(path, sockBTF(), 0644); err != nil {
+		t.Fatal(err)
+	}
+	offsets, err := btfStructOffsets(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	want := structOffsets{
+		OffsetSaddr:     4,
+		OffsetDaddr:     0,
+		OffsetSport:     782,
+		OffsetDport:     12,
+		OffsetNetns:     48,
+		OffsetIno:       136,
+		OffsetFamily:    16,
+		OffsetDaddrIPv6: 56,
+	}
+	if *offsets != want {
+		t.Errorf("got %+v, want %+v", *offsets, want)
+	}
+}
+
+func TestBTFBitfields(t *testing.T) {
+	spec, err := parseBTF(sockBTF())
+	if err != nil {
+		t.Fatal(err)
+	}
+	for _, c := range []struct {
+		member string
+		want   uint64
+	}{
+		{"skc_state", 18},
+		{"skc_reuse", 19},
+		{"skc_reuseport", 19},
+		{"skc_net", 48},
+	} {
+		got, err := spec.offsetOf("sock_common", c.member)
+		if err != nil || got != c.want {
+			t.Errorf("%s: got %d, %v, want %d", c.member, got, err, c.want)
+		}
+	}
+}
+
+func TestBTFMissingMember(t *testing.T) {
+	spec, err := parseBTF(sockBTF())
+	if err != nil {
+		t.Fatal(err)
+	}
+	if _, err := spec.offsetOf("sock_common", "skc_bogus"); err == nil {
+		t.Error("no error for a missing member")
+	}
+	if _, err := spec.offsetOf("tcp_sock", "snd_cwnd"); err == nil {
+		t.Error("no error for a missing struct")
+	}
+	// skc_family is no struct
+	if _, err := spec.offsetOf("sock_common", "skc_family", "x"); err == nil {
+		t.Error("no error for a member of an integer")
+	}
+}
+
+func TestBTFMalformed(t *testing.T) {
+	valid := sockBTF()
+
+	badMagic := append([]byte(nil), valid...)
+	badMagic[0], badMagic[1] = 0x12, 0x34
+	if _, err := parseBTF(badMagic); err == nil || !strings.Contains(err.Error(), "magic") {
+		t.Errorf("bad magic: got %v", err)
+	}
+
+	// the string section runs past the end of the blob
+	truncated := valid[:len(valid)-10]
+	if _, err := parseBTF(truncated); err == nil {
+		t.Error("no error for a truncated string section")
+	}
+
+	// a type section ending in the middle of the members of a struct
+	b := newBTFBuilder()
+	u32 := b.integer("u32", 4)
+	b.composite(btfKindStruct, "s", false, 8, btfTestMember{"a", u32, 0}, btfTestMember{"b", u32, 32})
+	b.types = b.types[:len(b.types)-6]
+	if _, err := parseBTF(b.blob()); err == nil {
+		t.Error("no error for truncated members")
+	}
+
+	// any prefix of a valid blob, with the header pointing past its end
+	for n := 0; n < len(valid); n++ {
+		if _, err := parseBTF(valid[:n]); err == nil {
+			t.Errorf("no error for the first %d bytes of %d", n, len(valid))
+		}
+	}
+}
+
+// Loops of typedefs or of anonymous members must not hang or overflow the
+// stack.
+func TestBTFLoops(t *testing.T) {
+	b := newBTFBuilder()
+	u32 := b.integer("u32", 4)
+	loop := b.typedef("loop", b.n+2) // to itself through the next typedef
+	b.typedef("pool", loop)
+	self := b.composite(btfKindStruct, "", false, 8, btfTestMember{"", b.n + 1, 0})
+	b.composite(btfKindStruct, "s", false, 16,
+		btfTestMember{"", loop, 0},
+		btfTestMember{"", self, 0},
+		btfTestMember{"x", u32, 64})
+
+	spec, err := parseBTF(b.blob())
+	if err != nil {
+		t.Fatal(err)
+	}
+	if off, err := spec.offsetOf("s", "x"); err != nil || off != 8 {
+		t.Errorf("got %d, %v, want 8", off, err)
+	}
+	if _, err := spec.offsetOf("s", "y"); err == nil {
+		t.Error("no error for a missing member")
+	}
+}
@@ -0,0 +1,192 @@
+package tracer
+
+import (
+	"fmt"
+	"sync/atomic"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// pidCommMax is the size of the comm cache when pid_comm cannot tell its
+// own, PID_COMM_MAX in kernel/trace_output_kern.c.
+const pidCommMax = 16384
+
+// commRecheck is the number of short samples of a pid after which its comm
+// is looked up in pid_comm again, in case the event carrying its new comm
+// was lost.
+const commRecheck = 64
+
+// setOmitComm makes the kernel program leave the comm out of the events of
+// the processes it already sent one for, see comm_config.
+func setOmitComm(b *elf.Module, omit bool) error {
+	mp := b.Map("comm_config")
+	if mp == nil {
+		if omit {
+			return fmt.Errorf("object has no comm_config map, cannot omit the comm")
+		}
+		return nil
+	}
+
+	var cfg struct {
+		omit uint32
+		_    uint32
+	}
+	if omit {
+		cfg.omit = 1
+	}
+	var zero uint32
+	if err := b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&cfg), 0); err != nil {
+		return fmt.Errorf("failed to update comm_config: %v", err)
+	}
+	return nil
+}
+
+// commCache is a Sink putting back the comm of the samples in the short
+// layout before handing them to sink, so that sinks only ever see the
+// compact one. The first event of a process carries its comm, which is
+// kept by pid. The kernel side forgets the comm of a process on exec and
+// exit, the next event of the pid carries the new comm and replaces the
+// old one here too. That event may be lost when the ring is full, so the
+// comm of a pid is checked against pid_comm again every commRecheck short
+// samples. A pid not seen yet, because it was evicted or the samples came
+// out of order, is looked up in pid_comm.
+//
+// Samples runs in the pipeline consumer only, the cache needs no locking
+// and the records rebuilt share one arena reused from batch to batch.
+type commCache struct {
+	sink  Sink
+	fd    int // of pid_comm, -1 without
+	max   int
+	comms map[uint32]commEntry
+
+	arena   []byte
+	samples [][]byte
+
+	restored uint64 // short samples given their comm back
+	lookups  uint64 // ... of which from pid_comm
+	unknown  uint64 // ... for which pid_comm had no comm either
+	rechecks uint64 // lookups of comms cached already
+	changed  uint64 // ... which found a comm other than the cached one
+}
+
+type commEntry struct {
+	comm  [16]byte
+	short int // samples restored since the comm was last refreshed
+}
+
+func newCommCache(b *elf.Module, sink Sink) *commCache {
+	c := &commCache{sink: sink, fd: -1, max: pidCommMax}
+	if mp := b.Map("pid_comm"); mp != nil {
+		c.fd = mp.Fd()
+		if info, err := bpfMapGetInfo(c.fd); err == nil && info.MaxEntries > 0 {
+			c.max = int(info.MaxEntries)
+		}
+	}
+	c.comms = make(map[uint32]commEntry)
+	return c
+}
+
+// remember stores comm as the one of pid, as carried by a full sample or
+// found in pid_comm.
+func (c *commCache) remember(pid uint32, comm []byte) {
+	var e commEntry
+	copy(e.comm[:], comm)
+	if _, ok := c.comms[pid]; !ok && len(c.comms) >= c.max {
+		// the kernel side holds as many, make room for one, the pid
+		// dropped is looked up if it shows up again
+		for old := range c.comms {
+			delete(c.comms, old)
+			break
+		}
+	}
+	c.comms[pid] = e
+}
+
+// lookup reads the comm of pid from pid_comm.
+func (c *commCache) lookup(pid uint32) ([16]byte, bool) {
+	var v [16]byte
+	if c.fd < 0 || bpfMapLookupElemFd(c.fd, unsafe.Pointer(&pid), unsafe.Pointer(&v)) != nil {
+		return v, false
+	}
+	return v, true
+}
+
+// comm returns the comm of pid for a short sample.
+func (c *commCache) comm(pid uint32) [16]byte {
+	e, ok := c.comms[pid]
+	if !ok {
+		atomic.AddUint64(&c.lookups, 1)
+		v, found := c.lookup(pid)
+		if !found {
+			atomic.AddUint64(&c.unknown, 1)
+			return v
+		}
+		c.remember(pid, v[:])
+		return v
+	}
+
+	if e.short++; e.short >= commRecheck {
+		atomic.AddUint64(&c.rechecks, 1)
+		e.short = 0
+		// not in pid_comm means the next sample of pid carries its
+		// comm, keep the cached one until then
+		if v, found := c.lookup(pid); found && v != e.comm {
+			atomic.AddUint64(&c.changed, 1)
+			e.comm = v
+		}
+	}
+	c.comms[pid] = e
+	return e.comm
+}
+
+func (c *commCache) Samples(f Family, samples [][]byte) {
+	orig, size, short := tcpEventV4Size, tcpEventV4CompactSize, tcpEventV4ShortSize
+	if f == FamilyIPv6 {
+		orig, size, short = tcpEventV6Size, tcpEventV6CompactSize, tcpEventV6ShortSize
+	}
+
+	// room for all samples up front, the records already handed out must
+	// not move
+	if need := len(samples) * size; cap(c.arena) < need {
+		c.arena = make([]byte, 0, need)
+	}
+	arena := c.arena[:0]
+	out := c.samples[:0]
+	for _, sample := range samples {
+		// the length tells the layouts apart first, as in
+		// DecodeTCPEventV4: in the original one, byte 8 is the low byte of
+		// the cpu and no version
+		if len(sample) < short || len(sample) >= orig {
+			out = append(out, sample)
+			continue
+		}
+		pid := ByteOrder.Uint32(sample[16:20])
+		switch {
+		case len(sample) < size && sample[8] == tcpEventVersionShort:
+			off := len(arena)
+			arena = arena[:off+size]
+			rec := arena[off : off+size : off+size]
+			copy(rec[:20], sample[:20])
+			rec[8] = tcpEventVersionCompact
+			comm := c.comm(pid)
+			copy(rec[20:36], comm[:])
+			copy(rec[36:], sample[20:short])
+			atomic.AddUint64(&c.restored, 1)
+			sample = rec
+		case len(sample) >= size && sample[8] == tcpEventVersionCompact:
+			c.remember(pid, sample[20:36])
+		}
+		out = append(out, sample)
+	}
+	c.arena = arena
+	c.samples = out
+	c.sink.Samples(f, out)
+}
+
+// String formats the counters of the cache.
+func (c *commCache) String() string {
+	return fmt.Sprintf("comm: restored=%d lookups=%d unknown=%d rechecks=%d changed=%d",
+		atomic.LoadUint64(&c.restored), atomic.LoadUint64(&c.lookups), atomic.LoadUint64(&c.unknown),
+		atomic.LoadUint64(&c.rechecks), atomic.LoadUint64(&c.changed))
+}
@@ -0,0 +1,122 @@
+package tracer
+
+import (
+	"bytes"
+	"testing"
+)
+
+// commSamples returns a compact IPv4 sample of pid with comm, and the same
+// event in the short layout.
+func commSamples(pid uint32, comm string) (full, short []byte) {
+	full = make([]byte, tcpEventV4CompactSize)
+	compactHeader(full)
+	ByteOrder.PutUint32(full[16:20], pid)
+	var name [16]byte
+	copy(name[:], comm)
+	copy(full[20:36], name[:])
+	ByteOrder.PutUint32(full[36:40], 0x0100007f)
+	ByteOrder.PutUint16(full[44:46], 80)
+
+	short = make([]byte, tcpEventV4ShortSize)
+	copy(short[:20], full[:20])
+	short[8] = tcpEventVersionShort
+	copy(short[20:], full[36:])
+	return full, short
+}
+
+func TestCommCache(t *testing.T) {
+	var got [][]byte
+	c := &commCache{
+		sink: SinkFunc(func(f Family, samples [][]byte) {
+			for _, s := range samples {
+				got = append(got, append([]byte(nil), s...))
+			}
+		}),
+		fd:    -1,
+		max:   2,
+		comms: make(map[uint32]commEntry),
+	}
+
+	curl, curlShort := commSamples(1, "curl")
+	wget, wgetShort := commSamples(2, "wget")
+	_, nc := commSamples(3, "nc")
+	c.Samples(FamilyIPv4, [][]byte{curl, curlShort, wget, wgetShort})
+	if len(got) != 4 {
+		t.Fatalf("got %d samples, want 4", len(got))
+	}
+	if !bytes.Equal(got[1], curl) || !bytes.Equal(got[3], wget) {
+		t.Fatalf("short samples restored as %q and %q", got[1], got[3])
+	}
+
+	// a new pid evicts one entry only
+	c.remember(3, []byte("nc"))
+	if len(c.comms) != 2 {
+		t.Fatalf("%d comms cached, want 2", len(c.comms))
+	}
+	if _, ok := c.comms[3]; !ok {
+		t.Fatal("new comm not cached")
+	}
+
+	// without pid_comm an unknown pid gets no comm
+	delete(c.comms, 3)
+	got = nil
+	c.Samples(FamilyIPv4, [][]byte{nc})
+	if comm := got[0][20:36]; !bytes.Equal(comm, make([]byte, 16)) {
+		t.Errorf("got comm %q for an unknown pid", comm)
+	}
+	if c.unknown != 1 {
+		t.Errorf("%d unknown comms counted, want 1", c.unknown)
+	}
+}
+
+func TestCommCacheRecheck(t *testing.T) {
+	c := &commCache{fd: -1, max: pidCommMax, comms: make(map[uint32]commEntry)}
+	c.remember(1, []byte("curl"))
+	for i := 0; i < 2*commRecheck; i++ {
+		c.comm(1)
+	}
+	if c.rechecks != 2 {
+		t.Errorf("got %d rechecks, want 2", c.rechecks)
+	}
+	// a full sample refreshes the comm
+	c.comm(1)
+	c.remember(1, []byte("curl"))
+	if e := c.comms[1]; e.short != 0 {
+		t.Errorf("%d short samples since the refresh, want 0", e.short)
+	}
+}
+
+// Samples of the original layout pass through untouched, even from the
+// CPUs whose number has a version in its low byte.
+func TestCommCacheOriginalLayout(t *testing.T) {
+	var got [][]byte
+	c := &commCache{
+		sink:  SinkFunc(func(f Family, samples [][]byte) { got = samples }),
+		fd:    -1,
+		max:   pidCommMax,
+		comms: make(map[uint32]commEntry),
+	}
+	for _, tc := range []struct {
+		f    Family
+		size int
+	}{
+		{FamilyIPv4, tcpEventV4Size},
+		{FamilyIPv4, tcpEventV4Size + 4}, // padded perf sample
+		{FamilyIPv6, tcpEventV6Size + 4},
+	} {
+		for _, cpu := range []uint64{tcpEventVersionCompact, tcpEventVersionShort} {
+			sample := make([]byte, tc.size)
+			ByteOrder.PutUint64(sample[8:16], cpu)
+			ByteOrder.PutUint32(sample[20:24], 1)
+			copy(sample[24:40], "curl")
+			want := append([]byte(nil), sample...)
+			c.Samples(tc.f, [][]byte{sample})
+			if len(got) != 1 || !bytes.Equal(got[0], want) {
+				t.Errorf("%d byte sample from cpu %d changed to %v", tc.size, cpu, got)
+			}
+		}
+	}
+	if len(c.comms) != 0 || c.restored != 0 {
+		t.Errorf("original samples taken for compact or short ones")
+	}
+}
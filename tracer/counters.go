@@ -0,0 +1,69 @@
+package tracer
+
+import (
+	"fmt"
+	"strings"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// probeCounterNames are the counters of the probe_counters per-CPU array,
+// in the order of enum probe_counter in kernel/trace_output_kern.c.
+var probeCounterNames = []string{
+	"kprobe_calls",
+	"kretprobe_calls",
+	"missed_entry",
+	"connect_failed",
+	"filtered",
+	"events_sent",
+	"events_dropped",
+	"entry_dropped",
+	"sampled_out",
+	"rate_limited",
+	"comm_omitted",
+}
+
+// readPerCPUCounters returns the sum over all CPUs of each of the first n
+// u64 counters of the BPF_MAP_TYPE_PERCPU_ARRAY mp.
+func readPerCPUCounters(mp *elf.Map, n int) ([]uint64, error) {
+	cpus, err := PossibleCPUs()
+	if err != nil {
+		return nil, err
+	}
+
+	// the kernel copies one 8-byte aligned value per possible CPU
+	sums := make([]uint64, n)
+	w := NewMapWalker(mp.Fd(), 4, 8*cpus)
+	err = w.Walk(false, func(key, value []byte) {
+		i := int(ByteOrder.Uint32(key))
+		if i >= n {
+			return
+		}
+		for cpu := 0; cpu < cpus; cpu++ {
+			sums[i] += ByteOrder.Uint64(value[8*cpu:])
+		}
+	})
+	if err != nil {
+		return nil, fmt.Errorf("failed to read counters: %v", err)
+	}
+	return sums, nil
+}
+
+// probeCounters formats the probe counters of the module, if it has them.
+func probeCounters(b *elf.Module) (string, error) {
+	mp := b.Map("probe_counters")
+	if mp == nil {
+		return "", nil
+	}
+
+	sums, err := readPerCPUCounters(mp, len(probeCounterNames))
+	if err != nil {
+		return "", err
+	}
+
+	fields := make([]string, len(sums))
+	for i, v := range sums {
+		fields[i] = fmt.Sprintf("%s=%d", probeCounterNames[i], v)
+	}
+	return "probes: " + strings.Join(fields, " "), nil
+}
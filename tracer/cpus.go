@@ -0,0 +1,100 @@
+package tracer
+
+import (
+	"fmt"
+	"io/ioutil"
+	"strconv"
+	"strings"
+)
+
+// parseCPUList parses the kernel's cpu list format, e.g. "0-3,8,10-11".
+func parseCPUList(s string) ([]int, error) {
+	var cpus []int
+	s = strings.TrimSpace(s)
+	if s == "" {
+		return cpus, nil
+	}
+	for _, r := range strings.Split(s, ",") {
+		bounds := strings.SplitN(r, "-", 2)
+		first, err := strconv.Atoi(bounds[0])
+		if err != nil {
+			return nil, fmt.Errorf("invalid cpu list %q: %v", s, err)
+		}
+		last := first
+		if len(bounds) == 2 {
+			last, err = strconv.Atoi(bounds[1])
+			if err != nil {
+				return nil, fmt.Errorf("invalid cpu list %q: %v", s, err)
+			}
+		}
+		for cpu := first; cpu <= last; cpu++ {
+			cpus = append(cpus, cpu)
+		}
+	}
+	return cpus, nil
+}
+
+func readCPUList(path string) ([]int, error) {
+	buf, err := ioutil.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	return parseCPUList(string(buf))
+}
+
+// PossibleCPUs returns the number of CPU slots the kernel may ever use,
+// which is what bpf_get_smp_processor_id() and BPF_F_CURRENT_CPU index.
+func PossibleCPUs() (int, error) {
+	cpus, err := readCPUList("/sys/devices/system/cpu/possible")
+	if err != nil {
+		return 0, err
+	}
+	if len(cpus) == 0 {
+		return 0, fmt.Errorf("no possible cpus")
+	}
+	return cpus[len(cpus)-1] + 1, nil
+}
+
+// onlineCPUs returns the ids of the CPUs currently online.
+func onlineCPUs() ([]int, error) {
+	return readCPUList("/sys/devices/system/cpu/online")
+}
+
+// threadCount returns the number of threads on the system, from the
+// running/total field of /proc/loadavg.
+func threadCount() (int, error) {
+	buf, err := ioutil.ReadFile("/proc/loadavg")
+	if err != nil {
+		return 0, err
+	}
+	fields := strings.Fields(string(buf))
+	if len(fields) < 4 {
+		return 0, fmt.Errorf("unexpected /proc/loadavg format")
+	}
+	i := strings.IndexByte(fields[3], '/')
+	if i < 0 {
+		return 0, fmt.Errorf("unexpected /proc/loadavg format")
+	}
+	return strconv.Atoi(fields[3][i+1:])
+}
+
+const (
+	connectsockPerCPU = 64
+	connectsockMax    = 1 << 20
+)
+
+// connectsockSize picks the size of the connectsock map, which holds one
+// entry per thread between the entry and the return of tcp_v4_connect.
+// Threads can sleep in there, so the cpu count alone is not a bound: take
+// the larger of a per-cpu allowance and twice the current thread count,
+// for headroom when more threads are started.
+func connectsockSize(cpus int) int {
+	size := cpus * connectsockPerCPU
+	if threads, err := threadCount(); err == nil && 2*threads > size {
+		size = 2 * threads
+	}
+	if size > connectsockMax {
+		size = connectsockMax
+	}
+	return size
+}
@@ -0,0 +1,168 @@
+package tracer
+
+import (
+	"fmt"
+)
+
+// Sizes of the records as emitted by the kernel side, see TCPEventV4 and
+// TCPEventV6 for the layout.
+const (
+	tcpEventV4Size = 56
+	tcpEventV6Size = 80
+)
+
+// The compact layout, versioned by the byte following the timestamp:
+//
+//	 0 u64 timestamp
+//	 8 u8  version (tcpEventVersionCompact)
+//	 9 u8  type
+//	10 u16 sport
+//	12 u32 cpu
+//	16 u32 pid
+//	20 [16] comm
+//	36 saddr, u32 or [16]byte
+//	   daddr, u32 or [16]byte
+//	   u16 dport, u16 weight, u32 netns
+//
+// weight is the number of events the record stands for, 0 from objects
+// built before sampling, which counts as 1.
+// It drops the padding and the 64 bit cpu of the original layout, so that
+// an IPv4 record fits in 64 bytes of perf ring instead of 72, and an IPv6
+// one in 88 instead of 96. It is told apart from the original layout by
+// its size, which is always smaller.
+const (
+	tcpEventVersionCompact = 2
+
+	tcpEventV4CompactSize = 52
+	tcpEventV6CompactSize = 76
+)
+
+// The short layout is the compact one without comm, sent with
+// Options.OmitComm once the kernel side has the comm of the process:
+//
+//	 0 u64 timestamp
+//	 8 u8  version (tcpEventVersionShort)
+//	 9 u8  type
+//	10 u16 sport
+//	12 u32 cpu
+//	16 u32 pid
+//	20 saddr, daddr, dport, weight and netns as in the compact layout
+//
+// The decoders do not know it, commCache turns it back into the compact
+// layout before the Sink sees it.
+const (
+	tcpEventVersionShort = 3
+
+	tcpEventV4ShortSize = 36
+	tcpEventV6ShortSize = 60
+)
+
+// DecodeTCPEventV4 reads a TCPEventV4 straight out of a perf sample using
+// fixed field offsets. For the original layout, it is equivalent to
+// binary.Read with ByteOrder of all fields but Weight, yet does not
+// allocate nor go through reflection.
+func DecodeTCPEventV4(data []byte, event *TCPEventV4) error {
+	if len(data) < tcpEventV4Size {
+		return decodeTCPEventV4Compact(data, event)
+	}
+	data = data[:tcpEventV4Size]
+
+	event.Timestamp = ByteOrder.Uint64(data[0:8])
+	event.Cpu = ByteOrder.Uint64(data[8:16])
+	event.Type = ByteOrder.Uint32(data[16:20])
+	event.Pid = ByteOrder.Uint32(data[20:24])
+	copy(event.Comm[:], data[24:40])
+	event.SAddr = ByteOrder.Uint32(data[40:44])
+	event.DAddr = ByteOrder.Uint32(data[44:48])
+	event.SPort = ByteOrder.Uint16(data[48:50])
+	event.DPort = ByteOrder.Uint16(data[50:52])
+	event.NetNS = ByteOrder.Uint32(data[52:56])
+	event.Weight = 1
+
+	return nil
+}
+
+// DecodeTCPEventV6 is the IPv6 counterpart of DecodeTCPEventV4.
+func DecodeTCPEventV6(data []byte, event *TCPEventV6) error {
+	if len(data) < tcpEventV6Size {
+		return decodeTCPEventV6Compact(data, event)
+	}
+	data = data[:tcpEventV6Size]
+
+	event.Timestamp = ByteOrder.Uint64(data[0:8])
+	event.Cpu = ByteOrder.Uint64(data[8:16])
+	event.Type = ByteOrder.Uint32(data[16:20])
+	event.Pid = ByteOrder.Uint32(data[20:24])
+	copy(event.Comm[:], data[24:40])
+	event.SAddrH = ByteOrder.Uint64(data[40:48])
+	event.SAddrL = ByteOrder.Uint64(data[48:56])
+	event.DAddrH = ByteOrder.Uint64(data[56:64])
+	event.DAddrL = ByteOrder.Uint64(data[64:72])
+	event.SPort = ByteOrder.Uint16(data[72:74])
+	event.DPort = ByteOrder.Uint16(data[74:76])
+	event.NetNS = ByteOrder.Uint32(data[76:80])
+	event.Weight = 1
+
+	return nil
+}
+
+func checkCompact(data []byte, size int) error {
+	if len(data) < size {
+		return fmt.Errorf("short sample: got %d bytes, need %d", len(data), size)
+	}
+	if data[8] != tcpEventVersionCompact {
+		return fmt.Errorf("unknown event version %d", data[8])
+	}
+	return nil
+}
+
+func compactWeight(w uint16) uint32 {
+	if w == 0 {
+		return 1
+	}
+	return uint32(w)
+}
+
+func decodeTCPEventV4Compact(data []byte, event *TCPEventV4) error {
+	if err := checkCompact(data, tcpEventV4CompactSize); err != nil {
+		return err
+	}
+	data = data[:tcpEventV4CompactSize]
+
+	event.Timestamp = ByteOrder.Uint64(data[0:8])
+	event.Type = uint32(data[9])
+	event.SPort = ByteOrder.Uint16(data[10:12])
+	event.Cpu = uint64(ByteOrder.Uint32(data[12:16]))
+	event.Pid = ByteOrder.Uint32(data[16:20])
+	copy(event.Comm[:], data[20:36])
+	event.SAddr = ByteOrder.Uint32(data[36:40])
+	event.DAddr = ByteOrder.Uint32(data[40:44])
+	event.DPort = ByteOrder.Uint16(data[44:46])
+	event.Weight = compactWeight(ByteOrder.Uint16(data[46:48]))
+	event.NetNS = ByteOrder.Uint32(data[48:52])
+
+	return nil
+}
+
+func decodeTCPEventV6Compact(data []byte, event *TCPEventV6) error {
+	if err := checkCompact(data, tcpEventV6CompactSize); err != nil {
+		return err
+	}
+	data = data[:tcpEventV6CompactSize]
+
+	event.Timestamp = ByteOrder.Uint64(data[0:8])
+	event.Type = uint32(data[9])
+	event.SPort = ByteOrder.Uint16(data[10:12])
+	event.Cpu = uint64(ByteOrder.Uint32(data[12:16]))
+	event.Pid = ByteOrder.Uint32(data[16:20])
+	copy(event.Comm[:], data[20:36])
+	event.SAddrH = ByteOrder.Uint64(data[36:44])
+	event.SAddrL = ByteOrder.Uint64(data[44:52])
+	event.DAddrH = ByteOrder.Uint64(data[52:60])
+	event.DAddrL = ByteOrder.Uint64(data[60:68])
+	event.DPort = ByteOrder.Uint16(data[68:70])
+	event.Weight = compactWeight(ByteOrder.Uint16(data[70:72]))
+	event.NetNS = ByteOrder.Uint32(data[72:76])
+
+	return nil
+}
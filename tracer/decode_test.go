@@ -0,0 +1,193 @@
+package tracer
+
+import (
+	"bytes"
+	"encoding/binary"
+	"math/rand"
+	"testing"
+)
+
+// The original layout is what binary.Read makes of the samples, but for
+// the Weight it does not have.
+func TestDecodeOriginalLayout(t *testing.T) {
+	if size := binary.Size(TCPEventV4{}) - 4; size != tcpEventV4Size {
+		t.Fatalf("TCPEventV4 without Weight is %d bytes, want %d", size, tcpEventV4Size)
+	}
+	if size := binary.Size(TCPEventV6{}) - 4; size != tcpEventV6Size {
+		t.Fatalf("TCPEventV6 without Weight is %d bytes, want %d", size, tcpEventV6Size)
+	}
+
+	rnd := rand.New(rand.NewSource(1))
+	for i := 0; i < 1000; i++ {
+		// longer than both layouts, as perf samples padded to 8 bytes are
+		data := make([]byte, tcpEventV6Size+4)
+		rnd.Read(data)
+
+		var want4, got4 TCPEventV4
+		if err := binary.Read(bytes.NewBuffer(data), ByteOrder, &want4); err != nil {
+			t.Fatal(err)
+		}
+		want4.Weight = 1
+		if err := DecodeTCPEventV4(data, &got4); err != nil {
+			t.Fatal(err)
+		}
+		if got4 != want4 {
+			t.Fatalf("DecodeTCPEventV4(%x) = %+v, want %+v", data, got4, want4)
+		}
+
+		var want6, got6 TCPEventV6
+		if err := binary.Read(bytes.NewBuffer(data), ByteOrder, &want6); err != nil {
+			t.Fatal(err)
+		}
+		want6.Weight = 1
+		if err := DecodeTCPEventV6(data, &got6); err != nil {
+			t.Fatal(err)
+		}
+		if got6 != want6 {
+			t.Fatalf("DecodeTCPEventV6(%x) = %+v, want %+v", data, got6, want6)
+		}
+	}
+}
+
+// compactHeader fills the fields both compact layouts have.
+func compactHeader(data []byte) {
+	ByteOrder.PutUint64(data[0:8], 12345)
+	data[8] = tcpEventVersionCompact
+	data[9] = uint8(EventAccept)
+	ByteOrder.PutUint16(data[10:12], 4242)
+	ByteOrder.PutUint32(data[12:16], 7)
+	ByteOrder.PutUint32(data[16:20], 99)
+	copy(data[20:36], "curl")
+}
+
+func TestDecodeCompactLayout(t *testing.T) {
+	data := make([]byte, tcpEventV4CompactSize)
+	compactHeader(data)
+	ByteOrder.PutUint32(data[36:40], 0x0100007f)
+	ByteOrder.PutUint32(data[40:44], 0x0200007f)
+	ByteOrder.PutUint16(data[44:46], 80)
+	ByteOrder.PutUint32(data[48:52], 4026531993)
+
+	var e TCPEventV4
+	if err := DecodeTCPEventV4(data, &e); err != nil {
+		t.Fatal(err)
+	}
+	want := TCPEventV4{
+		Timestamp: 12345,
+		Cpu:       7,
+		Type:      uint32(EventAccept),
+		Pid:       99,
+		SAddr:     0x0100007f,
+		DAddr:     0x0200007f,
+		SPort:     4242,
+		DPort:     80,
+		NetNS:     4026531993,
+		Weight:    1, // 0 in the record
+	}
+	copy(want.Comm[:], "curl")
+	if e != want {
+		t.Fatalf("got %+v, want %+v", e, want)
+	}
+
+	ByteOrder.PutUint16(data[46:48], 40)
+	if err := DecodeTCPEventV4(data, &e); err != nil {
+		t.Fatal(err)
+	}
+	if e.Weight != 40 {
+		t.Fatalf("got weight %d, want 40", e.Weight)
+	}
+
+	data6 := make([]byte, tcpEventV6CompactSize)
+	compactHeader(data6)
+	for i := 36; i < 68; i++ {
+		data6[i] = byte(i)
+	}
+	ByteOrder.PutUint16(data6[68:70], 443)
+	ByteOrder.PutUint32(data6[72:76], 4026531993)
+
+	var e6 TCPEventV6
+	if err := DecodeTCPEventV6(data6, &e6); err != nil {
+		t.Fatal(err)
+	}
+	want6 := TCPEventV6{
+		Timestamp: 12345,
+		Cpu:       7,
+		Type:      uint32(EventAccept),
+		Pid:       99,
+		SAddrH:    ByteOrder.Uint64(data6[36:44]),
+		SAddrL:    ByteOrder.Uint64(data6[44:52]),
+		DAddrH:    ByteOrder.Uint64(data6[52:60]),
+		DAddrL:    ByteOrder.Uint64(data6[60:68]),
+		SPort:     4242,
+		DPort:     443,
+		NetNS:     4026531993,
+		Weight:    1,
+	}
+	copy(want6.Comm[:], "curl")
+	if e6 != want6 {
+		t.Fatalf("got %+v, want %+v", e6, want6)
+	}
+
+	ByteOrder.PutUint16(data6[70:72], 7)
+	if err := DecodeTCPEventV6(data6, &e6); err != nil {
+		t.Fatal(err)
+	}
+	if e6.Weight != 7 {
+		t.Fatalf("got weight %d, want 7", e6.Weight)
+	}
+}
+
+func TestDecodeCompactErrors(t *testing.T) {
+	var e TCPEventV4
+	data := make([]byte, tcpEventV4CompactSize)
+	compactHeader(data)
+	if err := DecodeTCPEventV4(data[:tcpEventV4CompactSize-1], &e); err == nil {
+		t.Error("short sample decoded")
+	}
+	data[8] = tcpEventVersionShort
+	if err := DecodeTCPEventV4(data, &e); err == nil {
+		t.Error("unknown version decoded")
+	}
+}
+
+var benchSample = func() []byte {
+	data := make([]byte, tcpEventV4Size)
+	rand.New(rand.NewSource(1)).Read(data)
+	return data
+}()
+
+func BenchmarkDecodeTCPEventV4(b *testing.B) {
+	var e TCPEventV4
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		DecodeTCPEventV4(benchSample, &e)
+	}
+}
+
+func BenchmarkDecodeTCPEventV4BinaryRead(b *testing.B) {
+	var e TCPEventV4
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		binary.Read(bytes.NewBuffer(benchSample), ByteOrder, &e)
+	}
+}
+
+func BenchmarkDecodeTCPEventV6(b *testing.B) {
+	data := make([]byte, tcpEventV6Size)
+	copy(data, benchSample)
+	var e TCPEventV6
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		DecodeTCPEventV6(data, &e)
+	}
+}
+
+func BenchmarkDecodeTCPEventV6BinaryRead(b *testing.B) {
+	data := make([]byte, tcpEventV6Size)
+	copy(data, benchSample)
+	var e TCPEventV6
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		binary.Read(bytes.NewBuffer(data), ByteOrder, &e)
+	}
+}
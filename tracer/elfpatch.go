@@ -0,0 +1,116 @@
+package tracer
+
+import (
+	"debug/elf"
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"strings"
+)
+
+// Offsets of the fields in struct bpf_map_def, see kernel/bpf_helpers.h
+const (
+	mapDefTypeOffset       = 0
+	mapDefMaxEntriesOffset = 12
+	mapDefMinSize          = 16
+)
+
+// mapResize records a max_entries rewrite done by resizeMaps.
+type mapResize struct {
+	Name string
+	Type uint32
+	From uint32
+	To   uint32
+}
+
+// resizeMaps rewrites .max_entries of the maps defined in the ELF object
+// fileName, before gobpf gets to create them. sizeOf returns the wanted
+// size of a map given its name and type, or 0 to leave it alone.
+// The patched object is written to a temporary file whose name is returned
+// along with the list of changed maps; when nothing needs to change the
+// original name is returned. The caller removes the temporary file once the
+// module is loaded.
+func resizeMaps(fileName string, sizeOf func(name string, typ uint32) uint32) (string, []mapResize, error) {
+	f, err := elf.Open(fileName)
+	if err != nil {
+		return "", nil, err
+	}
+	defer f.Close()
+
+	type patch struct {
+		offset int64
+		value  uint32
+	}
+	var patches []patch
+	var resized []mapResize
+
+	for _, section := range f.Sections {
+		if !strings.HasPrefix(section.Name, "maps/") || section.Type != elf.SHT_PROGBITS {
+			continue
+		}
+		data, err := section.Data()
+		if err != nil {
+			return "", nil, fmt.Errorf("failed to read section %s: %v", section.Name, err)
+		}
+		if len(data) < mapDefMinSize {
+			continue
+		}
+
+		name := strings.TrimPrefix(section.Name, "maps/")
+		typ := f.ByteOrder.Uint32(data[mapDefTypeOffset:])
+		maxEntries := f.ByteOrder.Uint32(data[mapDefMaxEntriesOffset:])
+		size := sizeOf(name, typ)
+		if size == 0 || maxEntries == size {
+			continue
+		}
+
+		patches = append(patches, patch{
+			offset: int64(section.Offset) + mapDefMaxEntriesOffset,
+			value:  size,
+		})
+		resized = append(resized, mapResize{
+			Name: name,
+			Type: typ,
+			From: maxEntries,
+			To:   size,
+		})
+	}
+
+	if len(patches) == 0 {
+		return fileName, nil, nil
+	}
+
+	in, err := os.Open(fileName)
+	if err != nil {
+		return "", nil, err
+	}
+	defer in.Close()
+
+	out, err := ioutil.TempFile("", "gobpf-elf-loader-")
+	if err != nil {
+		return "", nil, err
+	}
+	if _, err := io.Copy(out, in); err != nil {
+		out.Close()
+		os.Remove(out.Name())
+		return "", nil, err
+	}
+
+	for _, p := range patches {
+		var buf [4]byte
+		f.ByteOrder.PutUint32(buf[:], p.value)
+		if _, err := out.WriteAt(buf[:], p.offset); err != nil {
+			out.Close()
+			os.Remove(out.Name())
+			return "", nil, err
+		}
+	}
+
+	if err := out.Close(); err != nil {
+		os.Remove(out.Name())
+		return "", nil, err
+	}
+
+	return out.Name(), resized, nil
+}
@@ -0,0 +1,120 @@
+package tracer
+
+import (
+	"encoding/binary"
+	"unsafe"
+)
+
+// EventType is the Type of an event, what the process did.
+type EventType uint32
+
+const (
+	_ EventType = iota
+	EventConnect
+	EventAccept
+	EventClose
+)
+
+func (e EventType) String() string {
+	switch e {
+	case EventConnect:
+		return "connect"
+	case EventAccept:
+		return "accept"
+	case EventClose:
+		return "close"
+	default:
+		return "unknown"
+	}
+}
+
+// TCPEventV4 is an event of an IPv4 connection. The addresses and ports
+// are in network byte order, as read by the kernel side.
+type TCPEventV4 struct {
+	// Timestamp must be the first field, the sorting depends on it
+	Timestamp uint64
+
+	Cpu   uint64
+	Type  uint32
+	Pid   uint32
+	Comm  [16]byte
+	SAddr uint32
+	DAddr uint32
+	SPort uint16
+	DPort uint16
+	NetNS uint32
+
+	// Weight is the number of events this one stands for, more than 1
+	// when the kernel side samples or rate limits. Not in the original
+	// layout.
+	Weight uint32
+}
+
+// TCPEventV6 is the IPv6 counterpart of TCPEventV4. The addresses are
+// split in two 64-bit halves filled from memory in host byte order.
+type TCPEventV6 struct {
+	// Timestamp must be the first field, the sorting depends on it
+	Timestamp uint64
+
+	Cpu    uint64
+	Type   uint32
+	Pid    uint32
+	Comm   [16]byte
+	SAddrH uint64
+	SAddrL uint64
+	DAddrH uint64
+	DAddrL uint64
+	SPort  uint16
+	DPort  uint16
+	NetNS  uint32
+
+	// Weight, see TCPEventV4
+	Weight uint32
+}
+
+// ByteOrder is the byte order of the host, in which the maps and the
+// samples are laid out.
+var ByteOrder binary.ByteOrder
+
+// In lack of binary.HostEndian ...
+func init() {
+	var i int32 = 0x01020304
+	u := unsafe.Pointer(&i)
+	pb := (*byte)(u)
+	b := *pb
+	if b == 0x04 {
+		ByteOrder = binary.LittleEndian
+	} else {
+		ByteOrder = binary.BigEndian
+	}
+}
+
+// Family tells the event maps apart, and so the layout of their samples.
+type Family int
+
+const (
+	FamilyIPv4 Family = iota
+	FamilyIPv6
+)
+
+// familyMaps are the names of the event maps, indexed by Family.
+var familyMaps = []string{
+	FamilyIPv4: "tcp_event_ipv4",
+	FamilyIPv6: "tcp_event_ipv6",
+}
+
+func (f Family) String() string {
+	switch f {
+	case FamilyIPv4:
+		return "ipv4"
+	case FamilyIPv6:
+		return "ipv6"
+	default:
+		return "unknown"
+	}
+}
+
+// MapName returns the name of the map the events of f are read from.
+func (f Family) MapName() string {
+	return familyMaps[f]
+}
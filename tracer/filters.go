@@ -0,0 +1,203 @@
+package tracer
+
+import (
+	"bufio"
+	"fmt"
+	"io"
+	"os"
+	"strconv"
+	"strings"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// Filter actions, they match FILTER_ALLOW and FILTER_DENY in
+// kernel/trace_output_kern.c.
+const (
+	filterAllow uint8 = 1
+	filterDeny  uint8 = 2
+)
+
+// filterFields are the values the kernel program filters on, with their
+// map. The order is the one of struct filter_config.
+var filterFields = []struct {
+	name    string
+	mapName string
+}{
+	{"netns", "filter_netns"},
+	{"pid", "filter_pid"},
+	{"dport", "filter_dport"},
+}
+
+// filterConfig mirrors struct filter_config: whether the map of a field
+// holds allowed values, only letting those through.
+type filterConfig struct {
+	allow [3]uint32
+}
+
+// FilterRules are the actions per value of each field of filterFields.
+type FilterRules [3]map[uint32]uint8
+
+// ParseFilterRules reads one rule per line, "allow|deny netns|pid|dport
+// value". Empty lines and lines starting with # are ignored. A value both
+// allowed and denied is denied.
+func ParseFilterRules(r io.Reader) (FilterRules, error) {
+	var rules FilterRules
+	for i := range rules {
+		rules[i] = make(map[uint32]uint8)
+	}
+
+	scanner := bufio.NewScanner(r)
+	for line := 1; scanner.Scan(); line++ {
+		text := strings.TrimSpace(scanner.Text())
+		if text == "" || strings.HasPrefix(text, "#") {
+			continue
+		}
+
+		words := strings.Fields(text)
+		if len(words) != 3 {
+			return rules, fmt.Errorf("line %d: expected \"allow|deny field value\"", line)
+		}
+
+		var action uint8
+		switch words[0] {
+		case "allow":
+			action = filterAllow
+		case "deny":
+			action = filterDeny
+		default:
+			return rules, fmt.Errorf("line %d: unknown action %q", line, words[0])
+		}
+
+		field := -1
+		for i, f := range filterFields {
+			if f.name == words[1] {
+				field = i
+			}
+		}
+		if field < 0 {
+			return rules, fmt.Errorf("line %d: unknown field %q", line, words[1])
+		}
+
+		bits := 32
+		if filterFields[field].name == "dport" {
+			bits = 16
+		}
+		value, err := strconv.ParseUint(words[2], 10, bits)
+		if err != nil {
+			return rules, fmt.Errorf("line %d: %v", line, err)
+		}
+
+		if rules[field][uint32(value)] != filterDeny {
+			rules[field][uint32(value)] = action
+		}
+	}
+	return rules, scanner.Err()
+}
+
+// LoadFilterRules reads the rules of the file fileName, see
+// ParseFilterRules.
+func LoadFilterRules(fileName string) (FilterRules, error) {
+	f, err := os.Open(fileName)
+	if err != nil {
+		return FilterRules{}, err
+	}
+	defer f.Close()
+
+	rules, err := ParseFilterRules(f)
+	if err != nil {
+		return rules, fmt.Errorf("%s: %v", fileName, err)
+	}
+	return rules, nil
+}
+
+// applyFilterRules replaces the filters of the running program with rules.
+// The values of rules are added first, then the allow lists are switched
+// to what rules need, then the stale values are removed. Meanwhile a stale
+// deny only filters out more, and a stale allow only lets through what the
+// old rules did, so that an update never lets through events that both
+// the old and the new rules filter out.
+func applyFilterRules(b *elf.Module, rules FilterRules) error {
+	configMap := b.Map("filter_config")
+	if configMap == nil {
+		for i, f := range filterFields {
+			if len(rules[i]) > 0 {
+				return fmt.Errorf("object has no %s map, cannot filter on %s", f.mapName, f.name)
+			}
+		}
+		return nil
+	}
+
+	var zero uint32
+	var next filterConfig
+	for i := range rules {
+		for _, action := range rules[i] {
+			if action == filterAllow {
+				next.allow[i] = 1
+				break
+			}
+		}
+	}
+
+	maps := make([]*elf.Map, len(filterFields))
+	for i, f := range filterFields {
+		mp := b.Map(f.mapName)
+		if mp == nil {
+			return fmt.Errorf("object has no %s map", f.mapName)
+		}
+		maps[i] = mp
+
+		for value, action := range rules[i] {
+			if err := b.UpdateElement(mp, unsafe.Pointer(&value), unsafe.Pointer(&action), 0); err != nil {
+				return fmt.Errorf("failed to update %s: %v", f.mapName, err)
+			}
+		}
+	}
+
+	if err := b.UpdateElement(configMap, unsafe.Pointer(&zero), unsafe.Pointer(&next), 0); err != nil {
+		return fmt.Errorf("failed to update filter_config: %v", err)
+	}
+
+	for i, f := range filterFields {
+		mp := maps[i]
+		var stale []uint32
+		w := NewMapWalker(mp.Fd(), 4, 1)
+		err := w.Walk(false, func(key, value []byte) {
+			if _, ok := rules[i][ByteOrder.Uint32(key)]; !ok {
+				stale = append(stale, ByteOrder.Uint32(key))
+			}
+		})
+		if err != nil {
+			return fmt.Errorf("failed to read %s: %v", f.mapName, err)
+		}
+		for _, value := range stale {
+			if err := b.DeleteElement(mp, unsafe.Pointer(&value)); err != nil {
+				return fmt.Errorf("failed to update %s: %v", f.mapName, err)
+			}
+		}
+	}
+	return nil
+}
+
+// String formats the rules as the number of values per field and action.
+func (rules FilterRules) String() string {
+	parts := make([]string, 0, len(filterFields))
+	for i, f := range filterFields {
+		var allowed, denied int
+		for _, action := range rules[i] {
+			if action == filterAllow {
+				allowed++
+			} else {
+				denied++
+			}
+		}
+		if allowed+denied > 0 {
+			parts = append(parts, fmt.Sprintf("%s %d allowed %d denied", f.name, allowed, denied))
+		}
+	}
+	if len(parts) == 0 {
+		return "none"
+	}
+	return strings.Join(parts, ", ")
+}
@@ -0,0 +1,260 @@
+package tracer
+
+import (
+	"bytes"
+	"fmt"
+	"io"
+	"math/rand"
+	"net"
+	"os"
+	"strings"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// guessBatchSize is the number of candidate offsets tested per connect,
+// GUESS_BATCH in kernel/offset_guess_kern.c.
+const guessBatchSize = 32
+
+// tcpTracerStatusBatch is the layout of tcptracer_status in objects
+// guessing a batch of offsets per connect, like kernel/offset_guess_kern.o.
+// It extends tcpTracerStatus: instead of reading the field at a single
+// offset, the kprobe reads it at each of the ncandidates offsets in
+// candidates and stores what it found in the matching slot of values,
+// then sets status to checked. For guessNetns the candidates are offsets
+// of the inode number in struct net, offsetNetns being fixed; a failure to
+// read the net pointer is reported in err.
+type tcpTracerStatusBatch struct {
+	tcpTracerStatus
+	candidates  [guessBatchSize]uint16
+	ncandidates uint16
+	_           [6]byte
+	values      [guessBatchSize][16]byte
+}
+
+// supportsBatchedGuessing tells whether the status map has the extended
+// layout of tcpTracerStatusBatch.
+func supportsBatchedGuessing(mp *elf.Map) bool {
+	info, err := bpfMapGetInfo(mp.Fd())
+	if err != nil {
+		return false
+	}
+	return info.ValueSize == uint32(unsafe.Sizeof(tcpTracerStatusBatch{}))
+}
+
+// guessProber runs the connects of the batched guessing.
+type guessProber interface {
+	// probe writes status to tcptracer_status, makes a connect and reads
+	// status back. The connect is an IPv6 one to daddrIPv6 for
+	// guessDaddrIPv6, else an IPv4 one whose source port is returned, in
+	// network byte order.
+	probe(status *tcpTracerStatusBatch, daddrIPv6 [4]uint32) (uint16, error)
+}
+
+// moduleProber probes through the tcptracer_status map mp of b, the
+// IPv4 connects going to bindAddress.
+type moduleProber struct {
+	b           *elf.Module
+	mp          *elf.Map
+	bindAddress string
+}
+
+func (p *moduleProber) probe(status *tcpTracerStatusBatch, daddrIPv6 [4]uint32) (uint16, error) {
+	var zero uint64
+	if err := p.b.UpdateElement(p.mp, unsafe.Pointer(&zero), unsafe.Pointer(status), 0); err != nil {
+		return 0, fmt.Errorf("error: %v", err)
+	}
+
+	var sport uint16
+	if status.what == guessDaddrIPv6 {
+		// the kretprobe runs once connect(2) returns, there is no
+		// need to wait for the SYN to be answered
+		conn, err := net.DialTimeout("tcp6", fmt.Sprintf("[%s]:9092", ipFromUint32Arr(daddrIPv6)), 100*time.Millisecond)
+		if err == nil {
+			conn.Close()
+		}
+	} else {
+		var err error
+		if sport, err = connectV4(p.bindAddress); err != nil {
+			return 0, err
+		}
+	}
+
+	if err := p.b.LookupElement(p.mp, unsafe.Pointer(&zero), unsafe.Pointer(status)); err != nil {
+		return 0, fmt.Errorf("error: %v", err)
+	}
+	return sport, nil
+}
+
+// guessOffsetsBatched finds the same offsets as guessOffsets, but every
+// connect resolves up to guessBatchSize candidate offsets at once. dport
+// is the port of the listener in network byte order, netns the inode of
+// the own network namespace.
+func guessOffsetsBatched(p guessProber, dport uint16, netns uint32, log io.Writer) (*structOffsets, error) {
+	status := tcpTracerStatusBatch{}
+	status.pidTgid = uint64(os.Getpid()<<32 | syscall.Gettid())
+
+	// host byte order encodings of the values the kernel will read
+	var saddr, daddr, family, dportBuf, netnsBuf [4]byte
+	ByteOrder.PutUint32(saddr[:], 0x0100007F) // 127.0.0.1
+	ByteOrder.PutUint32(daddr[:], 0x0200007F) // 127.0.0.2
+	ByteOrder.PutUint16(family[:], syscall.AF_INET)
+	ByteOrder.PutUint16(dportBuf[:], dport)
+	ByteOrder.PutUint32(netnsBuf[:], netns)
+
+	// search tries the offsets in [first, limit) guessBatchSize at a
+	// time and returns the first one at which the kernel read what the
+	// connect expects. An err of the kprobe means there is no struct net at
+	// offsetNetns for guessNetns, nothing is found then.
+	search := func(what guessWhat, first, limit uint64, want func(sport uint16, daddrIPv6 [4]uint32) []byte) (uint64, bool, error) {
+		for base := first; base < limit; base += guessBatchSize {
+			n := uint64(guessBatchSize)
+			if base+n > limit {
+				n = limit - base
+			}
+			status.status = checking
+			status.what = what
+			status.err = 0
+			status.ncandidates = uint16(n)
+			for i := uint64(0); i < n; i++ {
+				status.candidates[i] = uint16(base + i)
+			}
+
+			var daddrIPv6 [4]uint32
+			if what == guessDaddrIPv6 {
+				daddrIPv6 = randomIPv6()
+			}
+			sport, err := p.probe(&status, daddrIPv6)
+			if err != nil {
+				return 0, false, err
+			}
+			if status.status != checked {
+				return 0, false, fmt.Errorf("offset guessing probe did not run for field %d", what)
+			}
+			if status.err != 0 {
+				return 0, false, nil
+			}
+
+			expected := want(sport, daddrIPv6)
+			for i := uint64(0); i < n; i++ {
+				if bytes.Equal(status.values[i][:len(expected)], expected) {
+					return base + i, true, nil
+				}
+			}
+		}
+		return 0, false, nil
+	}
+
+	fixed := func(b []byte) func(uint16, [4]uint32) []byte {
+		return func(uint16, [4]uint32) []byte { return b }
+	}
+
+	offsets := &structOffsets{}
+	guess := func(name string, offset *uint64, what guessWhat, first, limit uint64, want func(uint16, [4]uint32) []byte) error {
+		o, found, err := search(what, first, limit, want)
+		if err != nil {
+			return err
+		}
+		if !found {
+			return fmt.Errorf("overflow while guessing %s, bailing out!", name)
+		}
+		*offset = o
+		fmt.Fprintf(log, "%s found: %d\n", name, o)
+		return nil
+	}
+
+	if err := guess("offsetSaddr", &offsets.OffsetSaddr, guessSaddr, 0, 200, fixed(saddr[:4])); err != nil {
+		return nil, err
+	}
+	if err := guess("offsetDaddr", &offsets.OffsetDaddr, guessDaddr, 0, 200, fixed(daddr[:4])); err != nil {
+		return nil, err
+	}
+	if err := guess("offsetFamily", &offsets.OffsetFamily, guessFamily, 0, 200, fixed(family[:2])); err != nil {
+		return nil, err
+	}
+	// the sport ((struct inet_sock)->inet_sport) is after the family field
+	err := guess("offsetSport", &offsets.OffsetSport, guessSport, offsets.OffsetFamily, 2000, func(sport uint16, _ [4]uint32) []byte {
+		var buf [2]byte
+		ByteOrder.PutUint16(buf[:], sport)
+		return buf[:]
+	})
+	if err != nil {
+		return nil, err
+	}
+	if err := guess("offsetDport", &offsets.OffsetDport, guessDport, 0, 200, fixed(dportBuf[:2])); err != nil {
+		return nil, err
+	}
+
+	// the inode number is searched in the struct net at each offsetNetns
+	for offsets.OffsetNetns = 0; ; offsets.OffsetNetns++ {
+		if offsets.OffsetNetns >= 200 {
+			return nil, fmt.Errorf("overflow while guessing offsetNetns, bailing out!")
+		}
+		status.offsetNetns = offsets.OffsetNetns
+		o, found, err := search(guessNetns, 0, 200, fixed(netnsBuf[:4]))
+		if err != nil {
+			return nil, err
+		}
+		if found {
+			offsets.OffsetIno = o
+			break
+		}
+	}
+	fmt.Fprintln(log, "offsetNetns found:", offsets.OffsetNetns)
+	fmt.Fprintln(log, "offsetIno found:", offsets.OffsetIno)
+
+	err = guess("offsetDaddrIPv6", &offsets.OffsetDaddrIPv6, guessDaddrIPv6, 0, 200, func(_ uint16, daddrIPv6 [4]uint32) []byte {
+		return ipFromUint32Arr(daddrIPv6)
+	})
+	if err != nil {
+		return nil, err
+	}
+	return offsets, nil
+}
+
+// randomIPv6 returns a random global unicast address, 2000::/3: one that
+// tcp_v6_connect stores in the socket before it fails for want of a
+// route, unlike a multicast or an IPv4-mapped one.
+func randomIPv6() [4]uint32 {
+	var a [4]uint32
+	for i := range a {
+		a[i] = rand.Uint32()
+	}
+	ip := (*[16]byte)(unsafe.Pointer(&a[0]))
+	ip[0] = 0x20 | ip[0]&0x1f
+	return a
+}
+
+// guessWithObject guesses the offsets with the batched guessing object
+// fileName, kernel/offset_guess_kern.o, loaded next to the tracer's for
+// the time of the guessing. The IPv4 connects go to the listener at
+// bindAddress.
+func guessWithObject(fileName, bindAddress string, dport uint16, netns uint32, log io.Writer) (*structOffsets, error) {
+	b := elf.NewModule(fileName)
+	if b == nil {
+		return nil, fmt.Errorf("System doesn't support BPF")
+	}
+	if err := b.Load(); err != nil {
+		return nil, err
+	}
+	defer b.Close()
+
+	mp := b.Map("tcptracer_status")
+	if mp == nil || !supportsBatchedGuessing(mp) {
+		return nil, fmt.Errorf("%s has no tcptracer_status map for batched guessing", fileName)
+	}
+	var failed []string
+	for p := range b.IterKprobes() {
+		if err := b.EnableKprobe(p.Name); err != nil {
+			failed = append(failed, fmt.Sprintf("%s: %v", p.Name, err))
+		}
+	}
+	if len(failed) > 0 {
+		return nil, fmt.Errorf("failed to enable kprobes: %s", strings.Join(failed, ", "))
+	}
+
+	return guessOffsetsBatched(&moduleProber{b: b, mp: mp, bindAddress: bindAddress}, dport, netns, log)
+}
@@ -0,0 +1,129 @@
+package tracer
+
+import (
+	"io/ioutil"
+	"testing"
+	"unsafe"
+)
+
+// fakeSock plays kernel/offset_guess_kern.c on a made up struct sock, with
+// the fields at known offsets.
+type fakeSock struct {
+	t     *testing.T
+	sock  []byte
+	nets  map[uint64][]byte // struct net by offset of the pointer to it
+	netns uint32
+	dport uint16
+
+	probes int
+}
+
+const (
+	fakeDaddr     = 0
+	fakeSaddr     = 4
+	fakeDport     = 12
+	fakeFamily    = 16
+	fakeNetns     = 48
+	fakeDaddrIPv6 = 56
+	fakeSport     = 1414
+	fakeIno       = 100
+)
+
+func newFakeSock(t *testing.T) *fakeSock {
+	s := &fakeSock{t: t, sock: make([]byte, 2048), nets: map[uint64][]byte{}, netns: 4026531993, dport: htons(9091)}
+	ByteOrder.PutUint32(s.sock[fakeDaddr:], 0x0200007F)
+	ByteOrder.PutUint32(s.sock[fakeSaddr:], 0x0100007F)
+	ByteOrder.PutUint16(s.sock[fakeDport:], s.dport)
+	ByteOrder.PutUint16(s.sock[fakeFamily:], 2)
+	// a struct net without the inode before the right one
+	s.nets[fakeNetns-8] = make([]byte, 256)
+	net := make([]byte, 256)
+	ByteOrder.PutUint32(net[fakeIno:], s.netns)
+	s.nets[fakeNetns] = net
+	return s
+}
+
+func (s *fakeSock) probe(status *tcpTracerStatusBatch, daddrIPv6 [4]uint32) (uint16, error) {
+	s.probes++
+	if status.status != checking || status.ncandidates > guessBatchSize {
+		s.t.Fatalf("probe with status %d and %d candidates", status.status, status.ncandidates)
+	}
+
+	// a new connect, a new source port and IPv6 destination
+	sport := htons(uint16(40000 + s.probes))
+	ByteOrder.PutUint16(s.sock[fakeSport:], sport)
+	copy(s.sock[fakeDaddrIPv6:], (*[16]byte)(unsafe.Pointer(&daddrIPv6[0]))[:])
+
+	mem := s.sock
+	if status.what == guessNetns {
+		net, ok := s.nets[status.offsetNetns]
+		if !ok {
+			status.err = 1
+			status.status = checked
+			return sport, nil
+		}
+		mem = net
+	}
+	for i := 0; i < int(status.ncandidates); i++ {
+		var v [16]byte
+		if off := int(status.candidates[i]); off < len(mem) {
+			copy(v[:], mem[off:])
+		}
+		status.values[i] = v
+	}
+	status.status = checked
+	return sport, nil
+}
+
+func TestGuessOffsetsBatched(t *testing.T) {
+	s := newFakeSock(t)
+	offsets, err := guessOffsetsBatched(s, s.dport, s.netns, ioutil.Discard)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	want := structOffsets{
+		OffsetSaddr:     fakeSaddr,
+		OffsetDaddr:     fakeDaddr,
+		OffsetSport:     fakeSport,
+		OffsetDport:     fakeDport,
+		OffsetNetns:     fakeNetns,
+		OffsetIno:       fakeIno,
+		OffsetFamily:    fakeFamily,
+		OffsetDaddrIPv6: fakeDaddrIPv6,
+	}
+	if *offsets != want {
+		t.Errorf("got %+v, want %+v", *offsets, want)
+	}
+
+	// one connect per candidate is about 11000 here: the offsets, plus
+	// 200 for each offsetNetns tried before the right one
+	if s.probes > 120 {
+		t.Errorf("%d connects, want at most 120", s.probes)
+	}
+}
+
+func TestGuessOffsetsBatchedOverflow(t *testing.T) {
+	s := newFakeSock(t)
+	// no struct net anywhere
+	s.nets = map[uint64][]byte{}
+	if _, err := guessOffsetsBatched(s, s.dport, s.netns, ioutil.Discard); err == nil {
+		t.Fatal("no error without a netns")
+	}
+}
+
+func TestRandomIPv6(t *testing.T) {
+	for i := 0; i < 1000; i++ {
+		a := randomIPv6()
+		if ip := ipFromUint32Arr(a); ip[0]&0xe0 != 0x20 {
+			t.Fatalf("%v is not global unicast", ip)
+		}
+	}
+}
+
+// the _Static_assert of struct tcptracer_status in kernel/offset_guess_kern.c
+func TestStatusBatchSize(t *testing.T) {
+	if size := unsafe.Sizeof(tcpTracerStatusBatch{}); size != 712 {
+		t.Errorf("tcpTracerStatusBatch is %d bytes, want 712", size)
+	}
+}
@@ -0,0 +1,182 @@
+package tracer
+
+import (
+	"syscall"
+	"unsafe"
+)
+
+const (
+	bpfMapLookupBatch          = 24
+	bpfMapLookupAndDeleteBatch = 25
+
+	// ENOTSUPP, kernel internal but returned by bpf(2) for maps without
+	// batch support
+	errnoENOTSUPP = syscall.Errno(524)
+
+	mapBatchSize = 4096
+)
+
+// bpfMapBatchAttr is the batch flavour of union bpf_attr.
+type bpfMapBatchAttr struct {
+	inBatch   uint64
+	outBatch  uint64
+	keys      uint64
+	values    uint64
+	count     uint32
+	mapFd     uint32
+	elemFlags uint64
+	flags     uint64
+}
+
+func bpfMapBatch(cmd int, fd int, inBatch, outBatch, keys, values unsafe.Pointer, count *uint32) error {
+	attr := bpfMapBatchAttr{
+		inBatch:  uint64(uintptr(inBatch)),
+		outBatch: uint64(uintptr(outBatch)),
+		keys:     uint64(uintptr(keys)),
+		values:   uint64(uintptr(values)),
+		count:    *count,
+		mapFd:    uint32(fd),
+	}
+	_, _, errno := syscall.Syscall(sysBPF, uintptr(cmd), uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+	*count = attr.count
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+// MapWalker reads all entries of a map, with BPF_MAP_LOOKUP_BATCH or
+// BPF_MAP_LOOKUP_AND_DELETE_BATCH where the kernel supports them (5.6+,
+// hash and array maps) and one key at a time otherwise. valueSize is
+// the size of the value as copied by the kernel, i.e. for per-CPU maps
+// the 8-byte aligned value size times the number of possible CPUs.
+type MapWalker struct {
+	fd        int
+	keySize   int
+	valueSize int
+
+	batchUnsupported bool
+	batchSize        int
+	keys             []byte
+	values           []byte
+	inBatch          []byte
+	outBatch         []byte
+
+	// for the iterative path
+	keyList []byte
+	key     []byte
+}
+
+// NewMapWalker returns a MapWalker for the map of file descriptor fd.
+func NewMapWalker(fd, keySize, valueSize int) *MapWalker {
+	// the batch token is a bucket index for hash maps and a key for the
+	// others, make room for both
+	tokenSize := keySize
+	if tokenSize < 8 {
+		tokenSize = 8
+	}
+	return &MapWalker{
+		fd:        fd,
+		keySize:   keySize,
+		valueSize: valueSize,
+		batchSize: mapBatchSize,
+		inBatch:   make([]byte, tokenSize),
+		outBatch:  make([]byte, tokenSize),
+		key:       make([]byte, keySize),
+	}
+}
+
+// Walk calls fn for every entry of the map, deleting them if del is set.
+// key and value are only valid during the call.
+func (w *MapWalker) Walk(del bool, fn func(key, value []byte)) error {
+	if !w.batchUnsupported {
+		err := w.walkBatch(del, fn)
+		if err == nil {
+			return nil
+		}
+		if err != syscall.EINVAL && err != errnoENOTSUPP && err != syscall.EOPNOTSUPP {
+			return err
+		}
+		w.batchUnsupported = true
+	}
+	return w.walkIter(del, fn)
+}
+
+func (w *MapWalker) walkBatch(del bool, fn func(key, value []byte)) error {
+	cmd := bpfMapLookupBatch
+	if del {
+		cmd = bpfMapLookupAndDeleteBatch
+	}
+
+	var in unsafe.Pointer
+	for {
+		if len(w.keys) < w.batchSize*w.keySize {
+			w.keys = make([]byte, w.batchSize*w.keySize)
+			w.values = make([]byte, w.batchSize*w.valueSize)
+		}
+
+		count := uint32(w.batchSize)
+		err := bpfMapBatch(cmd, w.fd, in, unsafe.Pointer(&w.outBatch[0]),
+			unsafe.Pointer(&w.keys[0]), unsafe.Pointer(&w.values[0]), &count)
+		if err == syscall.ENOSPC && count == 0 {
+			// a hash bucket holds more entries than fit in a batch
+			w.batchSize *= 2
+			continue
+		}
+		if err != nil && err != syscall.ENOENT {
+			return err
+		}
+
+		for i := 0; i < int(count); i++ {
+			fn(w.keys[i*w.keySize:(i+1)*w.keySize], w.values[i*w.valueSize:(i+1)*w.valueSize])
+		}
+
+		if err == syscall.ENOENT {
+			return nil
+		}
+
+		copy(w.inBatch, w.outBatch)
+		in = unsafe.Pointer(&w.inBatch[0])
+	}
+}
+
+func (w *MapWalker) walkIter(del bool, fn func(key, value []byte)) error {
+	// collect the keys first, deleting while iterating would restart the
+	// iteration of hash maps
+	w.keyList = w.keyList[:0]
+	var prev unsafe.Pointer
+	for {
+		n := len(w.keyList)
+		w.keyList = append(w.keyList, w.key...)
+		err := bpfMapGetNextKeyFd(w.fd, prev, unsafe.Pointer(&w.keyList[n]))
+		if err == syscall.ENOENT {
+			w.keyList = w.keyList[:n]
+			break
+		}
+		if err != nil {
+			return err
+		}
+		copy(w.key, w.keyList[n:])
+		prev = unsafe.Pointer(&w.key[0])
+	}
+
+	if len(w.values) < w.valueSize {
+		w.values = make([]byte, w.valueSize)
+	}
+	value := w.values[:w.valueSize]
+	for off := 0; off < len(w.keyList); off += w.keySize {
+		key := w.keyList[off : off+w.keySize]
+		err := bpfMapLookupElemFd(w.fd, unsafe.Pointer(&key[0]), unsafe.Pointer(&value[0]))
+		if err == syscall.ENOENT {
+			continue
+		}
+		if err != nil {
+			return err
+		}
+		if del {
+			bpfMapDeleteElemFd(w.fd, unsafe.Pointer(&key[0]))
+		}
+		fn(key, value)
+	}
+	return nil
+}
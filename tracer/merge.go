@@ -0,0 +1,151 @@
+package tracer
+
+import (
+	"container/heap"
+	"math"
+	"sync/atomic"
+)
+
+// mergeInput is what a perfReader hands to the streamMerger after a poll:
+// the samples it released, in order, and its watermark. The reader will
+// not release samples stamped at or before the watermark anymore, late
+// ones aside.
+type mergeInput struct {
+	stream    int
+	samples   [][]byte
+	watermark uint64
+}
+
+// streamHeap orders the streams with queued samples by the timestamp of
+// their first one.
+type streamHeap struct {
+	queues  [][][]byte
+	streams []int
+}
+
+func (h *streamHeap) Len() int { return len(h.streams) }
+func (h *streamHeap) Less(i, j int) bool {
+	return sampleTimestamp(h.queues[h.streams[i]][0]) < sampleTimestamp(h.queues[h.streams[j]][0])
+}
+func (h *streamHeap) Swap(i, j int) { h.streams[i], h.streams[j] = h.streams[j], h.streams[i] }
+
+func (h *streamHeap) Push(x interface{}) {
+	h.streams = append(h.streams, x.(int))
+}
+
+func (h *streamHeap) Pop() interface{} {
+	n := len(h.streams)
+	x := h.streams[n-1]
+	h.streams = h.streams[:n-1]
+	return x
+}
+
+// streamMerger merges the timestamp ordered streams of several perfReaders
+// with a k-way heap merge. A sample is released once every stream's
+// watermark has passed it, so the merge adds the delay of the slowest
+// reader on top of the reorder window.
+type streamMerger struct {
+	emit  func(sample []byte)
+	flush func()
+
+	in         chan mergeInput
+	heads      streamHeap
+	watermarks []uint64
+	queued     int64 // for Len
+
+	done chan struct{}
+}
+
+func newStreamMerger(streams int, emit func(sample []byte), flush func()) *streamMerger {
+	return &streamMerger{
+		emit:       emit,
+		flush:      flush,
+		in:         make(chan mergeInput, streams),
+		heads:      streamHeap{queues: make([][][]byte, streams)},
+		watermarks: make([]uint64, streams),
+		done:       make(chan struct{}),
+	}
+}
+
+// Push queues the samples of a stream and moves its watermark.
+func (sm *streamMerger) Push(stream int, samples [][]byte, watermark uint64) {
+	atomic.AddInt64(&sm.queued, int64(len(samples)))
+	sm.in <- mergeInput{stream, samples, watermark}
+}
+
+// Len returns the number of samples waiting to be merged.
+func (sm *streamMerger) Len() int {
+	return int(atomic.LoadInt64(&sm.queued))
+}
+
+func (sm *streamMerger) add(m mergeInput) {
+	if len(m.samples) > 0 {
+		q := sm.heads.queues[m.stream]
+		sm.heads.queues[m.stream] = append(q, m.samples...)
+		if len(q) == 0 {
+			heap.Push(&sm.heads, m.stream)
+		}
+	}
+	if m.watermark > sm.watermarks[m.stream] {
+		sm.watermarks[m.stream] = m.watermark
+	}
+}
+
+// release emits, in order, the queued samples stamped at or before limit.
+func (sm *streamMerger) release(limit uint64) {
+	n := 0
+	for sm.heads.Len() > 0 {
+		stream := sm.heads.streams[0]
+		q := sm.heads.queues[stream]
+		if sampleTimestamp(q[0]) > limit {
+			break
+		}
+
+		sm.emit(q[0])
+		n++
+		q[0] = nil
+		if len(q) == 1 {
+			sm.heads.queues[stream] = q[:0]
+			heap.Pop(&sm.heads)
+		} else {
+			sm.heads.queues[stream] = q[1:]
+			heap.Fix(&sm.heads, 0)
+		}
+	}
+	if n > 0 {
+		atomic.AddInt64(&sm.queued, -int64(n))
+		sm.flush()
+	}
+}
+
+func (sm *streamMerger) limit() uint64 {
+	limit := uint64(0)
+	for i, w := range sm.watermarks {
+		if i == 0 || w < limit {
+			limit = w
+		}
+	}
+	return limit
+}
+
+func (sm *streamMerger) Start() {
+	go func() {
+		defer close(sm.done)
+
+		for m := range sm.in {
+			sm.add(m)
+			// release once per burst of inputs
+			if len(sm.in) == 0 {
+				sm.release(sm.limit())
+			}
+		}
+		sm.release(math.MaxUint64)
+	}()
+}
+
+// Stop releases everything queued. The readers must have pushed their last
+// samples.
+func (sm *streamMerger) Stop() {
+	close(sm.in)
+	<-sm.done
+}
@@ -0,0 +1,286 @@
+package tracer
+
+import (
+	"bytes"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"io/ioutil"
+	"math/rand"
+	"net"
+	"os"
+	"path/filepath"
+	"syscall"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// nt_gnu_build_id, the note type holding the build id in /sys/kernel/notes
+const ntGNUBuildID = 3
+
+// structOffsets are the offsets in struct sock that guessOffsets finds.
+// They only depend on the running kernel.
+type structOffsets struct {
+	OffsetSaddr     uint64 `json:"offsetSaddr"`
+	OffsetDaddr     uint64 `json:"offsetDaddr"`
+	OffsetSport     uint64 `json:"offsetSport"`
+	OffsetDport     uint64 `json:"offsetDport"`
+	OffsetNetns     uint64 `json:"offsetNetns"`
+	OffsetIno       uint64 `json:"offsetIno"`
+	OffsetFamily    uint64 `json:"offsetFamily"`
+	OffsetDaddrIPv6 uint64 `json:"offsetDaddrIPv6"`
+}
+
+// cachedOffsets is the content of an offset cache file.
+type cachedOffsets struct {
+	Release string `json:"release"`
+	BuildID string `json:"buildID"`
+
+	structOffsets
+}
+
+// setOffsets stores offsets in the status map and marks them ready.
+func setOffsets(b *elf.Module, mp *elf.Map, offsets *structOffsets) error {
+	var zero uint64
+	var status tcpTracerStatus
+	status.offsetSaddr = offsets.OffsetSaddr
+	status.offsetDaddr = offsets.OffsetDaddr
+	status.offsetSport = offsets.OffsetSport
+	status.offsetDport = offsets.OffsetDport
+	status.offsetNetns = offsets.OffsetNetns
+	status.offsetIno = offsets.OffsetIno
+	status.offsetFamily = offsets.OffsetFamily
+	status.offsetDaddrIPv6 = offsets.OffsetDaddrIPv6
+	status.what = guessDaddrIPv6 + 1
+	status.status = ready
+
+	if err := b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0); err != nil {
+		return fmt.Errorf("error: %v", err)
+	}
+	return nil
+}
+
+func kernelRelease() (string, error) {
+	var uts syscall.Utsname
+	if err := syscall.Uname(&uts); err != nil {
+		return "", err
+	}
+	var buf []byte
+	for _, c := range uts.Release {
+		if c == 0 {
+			break
+		}
+		buf = append(buf, byte(c))
+	}
+	return string(buf), nil
+}
+
+// kernelBuildID returns the GNU build id of the running kernel, read from
+// the ELF notes the kernel exports in /sys/kernel/notes.
+func kernelBuildID() (string, error) {
+	notes, err := ioutil.ReadFile("/sys/kernel/notes")
+	if err != nil {
+		return "", err
+	}
+
+	align4 := func(n uint32) uint32 { return (n + 3) &^ 3 }
+	for len(notes) >= 12 {
+		nameSize := ByteOrder.Uint32(notes[0:4])
+		descSize := ByteOrder.Uint32(notes[4:8])
+		typ := ByteOrder.Uint32(notes[8:12])
+		notes = notes[12:]
+
+		if uint32(len(notes)) < align4(nameSize)+descSize {
+			break
+		}
+		name := notes[:nameSize]
+		desc := notes[align4(nameSize) : align4(nameSize)+descSize]
+		if typ == ntGNUBuildID && bytes.Equal(bytes.TrimRight(name, "\x00"), []byte("GNU")) {
+			return hex.EncodeToString(desc), nil
+		}
+
+		next := align4(nameSize) + align4(descSize)
+		if uint32(len(notes)) < next {
+			break
+		}
+		notes = notes[next:]
+	}
+	return "", fmt.Errorf("no build id in /sys/kernel/notes")
+}
+
+// offsetCachePath returns the cache file for the running kernel in dir.
+func offsetCachePath(dir string) (string, string, string, error) {
+	release, err := kernelRelease()
+	if err != nil {
+		return "", "", "", err
+	}
+	buildID, err := kernelBuildID()
+	if err != nil {
+		return "", "", "", err
+	}
+	return filepath.Join(dir, fmt.Sprintf("offsets-%s-%s.json", release, buildID)), release, buildID, nil
+}
+
+func loadCachedOffsets(dir string) (*cachedOffsets, error) {
+	path, release, buildID, err := offsetCachePath(dir)
+	if err != nil {
+		return nil, err
+	}
+	buf, err := ioutil.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+
+	var offsets cachedOffsets
+	if err := json.Unmarshal(buf, &offsets); err != nil {
+		return nil, fmt.Errorf("invalid offset cache %s: %v", path, err)
+	}
+	if offsets.Release != release || offsets.BuildID != buildID {
+		return nil, fmt.Errorf("offset cache %s is for another kernel", path)
+	}
+	return &offsets, nil
+}
+
+// saveCachedOffsets stores the offsets found in the status map. The file
+// is written to a temporary name first so readers never see a partial one.
+func saveCachedOffsets(dir string, b *elf.Module, mp *elf.Map) error {
+	path, release, buildID, err := offsetCachePath(dir)
+	if err != nil {
+		return err
+	}
+
+	var zero uint64
+	var status tcpTracerStatus
+	if err := b.LookupElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status)); err != nil {
+		return err
+	}
+	if status.status != ready {
+		return fmt.Errorf("offsets are not ready")
+	}
+
+	offsets := cachedOffsets{
+		Release: release,
+		BuildID: buildID,
+		structOffsets: structOffsets{
+			OffsetSaddr:     status.offsetSaddr,
+			OffsetDaddr:     status.offsetDaddr,
+			OffsetSport:     status.offsetSport,
+			OffsetDport:     status.offsetDport,
+			OffsetNetns:     status.offsetNetns,
+			OffsetIno:       status.offsetIno,
+			OffsetFamily:    status.offsetFamily,
+			OffsetDaddrIPv6: status.offsetDaddrIPv6,
+		},
+	}
+	buf, err := json.MarshalIndent(&offsets, "", "\t")
+	if err != nil {
+		return err
+	}
+
+	if err := os.MkdirAll(dir, 0755); err != nil {
+		return err
+	}
+	tmp, err := ioutil.TempFile(dir, ".offsets-")
+	if err != nil {
+		return err
+	}
+	if _, err := tmp.Write(buf); err != nil {
+		tmp.Close()
+		os.Remove(tmp.Name())
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		os.Remove(tmp.Name())
+		return err
+	}
+	return os.Rename(tmp.Name(), path)
+}
+
+// applyCachedOffsets loads offsets into the status map and checks them
+// with one connect per field, in the same way guessOffsets tests a
+// candidate. The status is set to ready only if every field reads back
+// what is expected.
+func applyCachedOffsets(b *elf.Module, mp *elf.Map, offsets *structOffsets, bindAddress string, dport uint16, netns uint32) error {
+	var zero uint64
+	var status tcpTracerStatus
+	status.pidTgid = uint64(os.Getpid()<<32 | syscall.Gettid())
+	status.offsetSaddr = offsets.OffsetSaddr
+	status.offsetDaddr = offsets.OffsetDaddr
+	status.offsetSport = offsets.OffsetSport
+	status.offsetDport = offsets.OffsetDport
+	status.offsetNetns = offsets.OffsetNetns
+	status.offsetIno = offsets.OffsetIno
+	status.offsetFamily = offsets.OffsetFamily
+	status.offsetDaddrIPv6 = offsets.OffsetDaddrIPv6
+
+	fields := []struct {
+		what   guessWhat
+		offset uint64
+	}{
+		{guessSaddr, offsets.OffsetSaddr},
+		{guessDaddr, offsets.OffsetDaddr},
+		{guessFamily, offsets.OffsetFamily},
+		{guessSport, offsets.OffsetSport},
+		{guessDport, offsets.OffsetDport},
+		{guessNetns, offsets.OffsetIno},
+		{guessDaddrIPv6, offsets.OffsetDaddrIPv6},
+	}
+
+	for _, f := range fields {
+		status.status = checking
+		status.what = f.what
+		status.err = 0
+
+		if err := b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0); err != nil {
+			return fmt.Errorf("error: %v", err)
+		}
+
+		var sport uint16
+		var daddrIPv6 [4]uint32
+		if f.what == guessDaddrIPv6 {
+			for i := range daddrIPv6 {
+				daddrIPv6[i] = rand.Uint32()
+			}
+			conn, err := net.Dial("tcp6", fmt.Sprintf("[%s]:9092", ipFromUint32Arr(daddrIPv6)))
+			if err == nil {
+				conn.Close()
+			}
+		} else {
+			var err error
+			if sport, err = connectV4(bindAddress); err != nil {
+				return err
+			}
+		}
+
+		if err := b.LookupElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status)); err != nil {
+			return fmt.Errorf("error: %v", err)
+		}
+		if status.status != checked || status.err != 0 {
+			return fmt.Errorf("cached offset %d for field %d cannot be read", f.offset, f.what)
+		}
+
+		var ok bool
+		switch f.what {
+		case guessSaddr:
+			ok = status.saddr == 0x0100007F
+		case guessDaddr:
+			ok = status.daddr == 0x0200007F
+		case guessFamily:
+			ok = status.family == syscall.AF_INET
+		case guessSport:
+			ok = status.sport == sport
+		case guessDport:
+			ok = status.dport == dport
+		case guessNetns:
+			ok = status.netns == netns
+		case guessDaddrIPv6:
+			ok = compareIPv6(status.daddrIPv6, daddrIPv6)
+		}
+		if !ok {
+			return fmt.Errorf("cached offset %d for field %d does not match", f.offset, f.what)
+		}
+	}
+
+	return setOffsets(b, mp, offsets)
+}
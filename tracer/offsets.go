@@ -0,0 +1,394 @@
+package tracer
+
+import (
+	"encoding/binary"
+	"fmt"
+	"io"
+	"math/rand"
+	"net"
+	"os"
+	"runtime"
+	"strconv"
+	"strings"
+	"syscall"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+type tcpTracerState uint64
+
+const (
+	uninitialized tcpTracerState = iota
+	checking
+	checked
+	ready
+)
+
+type guessWhat uint64
+
+const (
+	guessSaddr guessWhat = iota
+	guessDaddr
+	guessFamily
+	guessSport
+	guessDport
+	guessNetns
+	guessDaddrIPv6
+)
+
+type tcpTracerStatus struct {
+	status          tcpTracerState
+	pidTgid         uint64
+	what            guessWhat
+	offsetSaddr     uint64
+	offsetDaddr     uint64
+	offsetSport     uint64
+	offsetDport     uint64
+	offsetNetns     uint64
+	offsetIno       uint64
+	offsetFamily    uint64
+	offsetDaddrIPv6 uint64
+	err             byte
+	saddr           uint32
+	daddr           uint32
+	sport           uint16
+	dport           uint16
+	netns           uint32
+	family          uint16
+	daddrIPv6       [4]uint32
+}
+
+// listen accepts no connections but keeps url open for the connects of
+// the guessing until finish is closed. The result of the listen is sent
+// to listening, the connects must wait for it.
+func listen(url, netType string, finish chan struct{}, listening chan<- error, log io.Writer) {
+	l, err := net.Listen(netType, url)
+	if err != nil {
+		listening <- fmt.Errorf("error listening: %v", err)
+		return
+	}
+	fmt.Fprintln(log, "Listening on "+url)
+	listening <- nil
+	select {
+	case <-finish:
+		l.Close()
+		return
+	}
+}
+
+func compareIPv6(a, b [4]uint32) bool {
+	for i := 0; i < 4; i++ {
+		if a[i] != b[i] {
+			return false
+		}
+	}
+	return true
+}
+
+func ownNetNS() (uint64, error) {
+	var s syscall.Stat_t
+	if err := syscall.Stat("/proc/self/ns/net", &s); err != nil {
+		return 0, err
+	}
+	return s.Ino, nil
+}
+
+func ipFromUint32Arr(ipv6Addr [4]uint32) net.IP {
+	buf := make([]byte, 16)
+	for i := 0; i < 16; i++ {
+		buf[i] = *(*byte)(unsafe.Pointer((uintptr(unsafe.Pointer(&ipv6Addr[0])) + uintptr(i))))
+	}
+	return net.IP(buf)
+}
+
+// connectV4 makes one connection to bindAddress and returns its source
+// port in network byte order.
+func connectV4(bindAddress string) (uint16, error) {
+	conn, err := net.Dial("tcp4", bindAddress)
+	if err != nil {
+		return 0, err
+	}
+
+	// set SO_LINGER to 0 so the connection state after closing is CLOSE
+	// instead of TIME_WAIT, see guessOffsets
+	if tcpConn, ok := conn.(*net.TCPConn); ok {
+		tcpConn.SetLinger(0)
+	}
+	defer conn.Close()
+
+	sport, err := strconv.Atoi(strings.Split(conn.LocalAddr().String(), ":")[1])
+	if err != nil {
+		return 0, err
+	}
+
+	return htons(uint16(sport)), nil
+}
+
+func htons(a uint16) uint16 {
+	arr := make([]byte, 2)
+	binary.BigEndian.PutUint16(arr, a)
+	return ByteOrder.Uint16(arr)
+}
+
+// resolveOffsets fills tcptracer_status with the struct sock offsets. They
+// are read from the kernel's BTF when available, without any guessing;
+// guessOffsets stays for kernels that do not have it. Progress goes to log.
+func resolveOffsets(b *elf.Module, useBTF bool, cacheDir, guessObject string, log io.Writer) error {
+	// objects compiled against the kernel headers, like the sample program
+	// in kernel/, know the offsets already
+	if b.Map("tcptracer_status") == nil {
+		return nil
+	}
+
+	if useBTF {
+		offsets, err := btfStructOffsets(BTFVmlinuxPath)
+		if err == nil {
+			if err := setOffsets(b, b.Map("tcptracer_status"), offsets); err != nil {
+				return err
+			}
+			fmt.Fprintln(log, "offsets resolved from BTF")
+			return nil
+		}
+		if !os.IsNotExist(err) {
+			fmt.Fprintf(log, "not using BTF: %v\n", err)
+		}
+	}
+
+	return guessOffsets(b, cacheDir, guessObject, log)
+}
+
+// guessOffsets finds the offsets of the struct sock fields the kprobes
+// read and stores them in tcptracer_status. If cacheDir is not empty, the
+// offsets found are cached there for the running kernel and reused, after
+// a validation pass, on the next start. If guessObject is not empty, the
+// offsets are guessed with that object, a batch of them per connect, see
+// guessWithObject; the object's own kprobes only test one per connect.
+func guessOffsets(b *elf.Module, cacheDir, guessObject string, log io.Writer) error {
+	listenIP := "127.0.0.2"
+	listenPort := uint16(9091)
+	bindAddress := fmt.Sprintf("%s:%d", listenIP, listenPort)
+
+	// the kprobes only look at the connects of pidTgid, the thread id
+	// must not change under the connects, whichever goroutine runs this
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	finish := make(chan struct{})
+	listening := make(chan error, 1)
+	go listen(bindAddress, "tcp4", finish, listening, log)
+	defer close(finish)
+	if err := <-listening; err != nil {
+		return err
+	}
+
+	currentNetns, err := ownNetNS()
+	if err != nil {
+		return fmt.Errorf("error getting current netns: %v", err)
+	}
+
+	mp := b.Map("tcptracer_status")
+
+	dport := htons(listenPort)
+	netns := uint32(currentNetns)
+
+	if cacheDir != "" {
+		offsets, err := loadCachedOffsets(cacheDir)
+		if err == nil {
+			err = applyCachedOffsets(b, mp, &offsets.structOffsets, bindAddress, dport, netns)
+		}
+		if err == nil {
+			fmt.Fprintln(log, "offsets loaded from cache")
+			return nil
+		}
+		if !os.IsNotExist(err) {
+			fmt.Fprintf(log, "not using offset cache: %v\n", err)
+		}
+	}
+
+	if guessObject != "" {
+		offsets, err := guessWithObject(guessObject, bindAddress, dport, netns, log)
+		if err == nil {
+			if err := setOffsets(b, mp, offsets); err != nil {
+				return err
+			}
+			saveOffsets(cacheDir, b, mp, log)
+			return nil
+		}
+		fmt.Fprintf(log, "guessing one offset per connect: %v\n", err)
+	}
+
+	var zero uint64
+	pidTgid := uint64(os.Getpid()<<32 | syscall.Gettid())
+
+	status := tcpTracerStatus{
+		status:  checking,
+		pidTgid: pidTgid,
+	}
+
+	err = b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0)
+	if err != nil {
+		return fmt.Errorf("error: %v", err)
+	}
+
+	// 127.0.0.1
+	saddr := 0x0100007F
+	// 127.0.0.2
+	daddr := 0x0200007F
+	// will be set later
+	sport := 0
+	family := syscall.AF_INET
+
+	for status.status != ready {
+		var daddrIPv6 [4]uint32
+
+		daddrIPv6[0] = rand.Uint32()
+		daddrIPv6[1] = rand.Uint32()
+		daddrIPv6[2] = rand.Uint32()
+		daddrIPv6[3] = rand.Uint32()
+
+		ip := ipFromUint32Arr(daddrIPv6)
+
+		if status.what != guessDaddrIPv6 {
+			conn, err := net.Dial("tcp4", bindAddress)
+			if err != nil {
+				return fmt.Errorf("error: %v", err)
+			}
+
+			sport, err = strconv.Atoi(strings.Split(conn.LocalAddr().String(), ":")[1])
+			if err != nil {
+				return fmt.Errorf("error: %v", err)
+			}
+
+			sport = int(htons(uint16(sport)))
+
+			// set SO_LINGER to 0 so the connection state after closing is
+			// CLOSE instead of TIME_WAIT. In this way, they will disappear
+			// from the conntrack table after around 10 seconds instead of 2
+			// minutes
+			if tcpConn, ok := conn.(*net.TCPConn); ok {
+				tcpConn.SetLinger(0)
+			} else {
+				panic("not a tcp connection")
+			}
+
+			conn.Close()
+		} else {
+			conn, err := net.Dial("tcp6", fmt.Sprintf("[%s]:9092", ip))
+			if err == nil {
+				conn.Close()
+			}
+		}
+
+		err = b.LookupElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status))
+		if err != nil {
+			return fmt.Errorf("error: %v", err)
+		}
+
+		if status.status == checked {
+			switch status.what {
+			case guessSaddr:
+				if status.saddr == uint32(saddr) {
+					fmt.Fprintln(log, "offsetSaddr found:", status.offsetSaddr)
+					status.what++
+					status.status = checking
+				} else {
+					status.offsetSaddr++
+					status.status = checking
+					status.saddr = uint32(saddr)
+				}
+			case guessDaddr:
+				if status.daddr == uint32(daddr) {
+					fmt.Fprintln(log, "offsetDaddr found:", status.offsetDaddr)
+					status.what++
+					status.status = checking
+				} else {
+					status.offsetDaddr++
+					status.status = checking
+					status.daddr = uint32(daddr)
+				}
+			case guessFamily:
+				if status.family == uint16(family) {
+					fmt.Fprintln(log, "offsetFamily found:", status.offsetFamily)
+					status.what++
+					status.status = checking
+					// we know the sport ((struct inet_sock)->inet_sport) is
+					// after the family field, so we start from there
+					status.offsetSport = status.offsetFamily
+				} else {
+					status.offsetFamily++
+					status.status = checking
+				}
+			case guessSport:
+				if status.sport == uint16(sport) {
+					fmt.Fprintln(log, "offsetSport found:", status.offsetSport)
+					status.what++
+					status.status = checking
+				} else {
+					status.offsetSport++
+					status.status = checking
+				}
+			case guessDport:
+				if status.dport == dport {
+					fmt.Fprintln(log, "offsetDport found:", status.offsetDport)
+					status.what++
+					status.status = checking
+				} else {
+					status.offsetDport++
+					status.status = checking
+				}
+			case guessNetns:
+				if status.netns == netns {
+					fmt.Fprintln(log, "offsetNetns found:", status.offsetNetns)
+					fmt.Fprintln(log, "offsetIno found:", status.offsetIno)
+					status.what++
+					status.status = checking
+				} else {
+					status.offsetIno++
+					// go to the next offsetNetns if we get an error
+					if status.err != 0 || status.offsetIno >= 200 {
+						status.offsetIno = 0
+						status.offsetNetns++
+					}
+					status.status = checking
+				}
+			case guessDaddrIPv6:
+				if compareIPv6(status.daddrIPv6, daddrIPv6) {
+					fmt.Fprintln(log, "offsetDaddrIPv6 found:", status.offsetDaddrIPv6)
+					status.what++
+					status.status = ready
+				} else {
+					status.offsetDaddrIPv6++
+					status.status = checking
+				}
+			default:
+				return fmt.Errorf("Uh, oh!")
+			}
+		}
+
+		err = b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&status), 0)
+		if err != nil {
+			return fmt.Errorf("error: %v", err)
+		}
+
+		if status.offsetSaddr >= 200 || status.offsetDaddr >= 200 ||
+			status.offsetSport >= 2000 || status.offsetDport >= 200 ||
+			status.offsetNetns >= 200 || status.offsetFamily >= 200 ||
+			status.offsetDaddrIPv6 >= 200 {
+			return fmt.Errorf("overflow, bailing out!")
+		}
+	}
+
+	saveOffsets(cacheDir, b, mp, log)
+	return nil
+}
+
+// saveOffsets caches the offsets found in cacheDir, if not empty.
+func saveOffsets(cacheDir string, b *elf.Module, mp *elf.Map, log io.Writer) {
+	if cacheDir == "" {
+		return
+	}
+	if err := saveCachedOffsets(cacheDir, b, mp); err != nil {
+		fmt.Fprintf(log, "failed to save offset cache: %v\n", err)
+	}
+}
@@ -0,0 +1,604 @@
+package tracer
+
+import (
+	"fmt"
+	"math"
+	"os"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+const (
+	perfTypeSoftware      = 1
+	perfCountSwBPFOutput  = 10
+	perfSampleRaw         = 1 << 10
+	perfFlagFdCloexec     = 1 << 3
+	perfAttrFlagWatermark = 1 << 14
+	perfEventIocEnable    = 0x2400
+	perfEventIocDisable   = 0x2401
+	perfRecordLost        = 2
+	perfRecordSample      = 9
+	perfAttrSize          = 112
+	perfDataHeadOffset    = 1024
+	perfDataTailOffset    = 1032
+	perfEventHeaderSize   = 8
+	clockMonotonic        = 1
+	perfPollTimeoutMillis = 100
+)
+
+// perfMapOptions are the tunables of a perfMap.
+type perfMapOptions struct {
+	// PageCount is the size of each per-CPU ring in pages, a power of 2
+	PageCount int
+	// ReorderWindow is how long samples are held to restore their order
+	ReorderWindow time.Duration
+	// ReorderMax is the maximum number of samples held
+	ReorderMax int
+	// WakeupEvents is the number of samples after which a ring wakes up
+	// the poller, 1 when 0. It is ignored if WakeupWatermark is set.
+	WakeupEvents int
+	// WakeupWatermark, when not 0, is the number of bytes after which a
+	// ring wakes up the poller. It must be less than the ring size.
+	WakeupWatermark int
+	// MaxLatency bounds how long samples can sit in the rings without a
+	// wakeup: the rings are read at least this often. 100ms when 0.
+	MaxLatency time.Duration
+	// Readers is the number of goroutines reading the rings, 1 when 0
+	Readers int
+	// Unordered delivers the samples as they are read, without holding
+	// them for reordering nor merging the streams of the readers
+	Unordered bool
+}
+
+// perfEventAttr mirrors struct perf_event_attr up to PERF_ATTR_SIZE_VER5.
+type perfEventAttr struct {
+	Type             uint32
+	Size             uint32
+	Config           uint64
+	SamplePeriod     uint64
+	SampleType       uint64
+	ReadFormat       uint64
+	Flags            uint64
+	WakeupEvents     uint32
+	BpType           uint32
+	BpAddr           uint64
+	BpLen            uint64
+	BranchSampleType uint64
+	SampleRegsUser   uint64
+	SampleStackUser  uint32
+	ClockID          int32
+	SampleRegsIntr   uint64
+	AuxWatermark     uint32
+	SampleMaxStack   uint16
+	_                uint16
+}
+
+// durationMillis converts d to an epoll timeout, at least 1ms.
+// idleTimeoutMillis is how long readers wait for a wakeup. With batched
+// wakeups samples can wait in the rings, they are read at least every
+// maxLatency.
+func idleTimeoutMillis(maxLatency time.Duration) int {
+	if maxLatency > 0 {
+		return durationMillis(maxLatency)
+	}
+	return perfPollTimeoutMillis
+}
+
+func durationMillis(d time.Duration) int {
+	ms := int((d + time.Millisecond - 1) / time.Millisecond)
+	if ms < 1 {
+		ms = 1
+	}
+	return ms
+}
+
+// MonotonicNow returns CLOCK_MONOTONIC, the clock of bpf_ktime_get_ns()
+// and so of the event timestamps.
+func MonotonicNow() uint64 {
+	var ts syscall.Timespec
+	syscall.Syscall(syscall.SYS_CLOCK_GETTIME, clockMonotonic, uintptr(unsafe.Pointer(&ts)), 0)
+	return uint64(ts.Sec)*1000000000 + uint64(ts.Nsec)
+}
+
+// perfRing is the mmapped ring buffer of one CPU's BPF output perf event.
+type perfRing struct {
+	cpu  int
+	fd   int
+	mem  []byte
+	data []byte
+	mask uint64
+
+	// wrapped holds the samples read without a slab that wrap around
+	// the end of the ring
+	wrapped []byte
+
+	// updated by read, loaded by Stats
+	lost    uint64
+	samples uint64
+	bytes   uint64
+}
+
+// openPerfRing opens the BPF output perf event of cpu with a ring of
+// pageCount pages. The poller is woken up every wakeupEvents samples, or
+// every watermark bytes if watermark is not 0.
+func openPerfRing(cpu, pageCount, wakeupEvents, watermark int) (*perfRing, error) {
+	attr := perfEventAttr{
+		Type:         perfTypeSoftware,
+		Size:         perfAttrSize,
+		Config:       perfCountSwBPFOutput,
+		SamplePeriod: 1,
+		SampleType:   perfSampleRaw,
+		WakeupEvents: uint32(wakeupEvents),
+	}
+	if watermark > 0 {
+		// wakeup_events and wakeup_watermark share the same field
+		attr.Flags |= perfAttrFlagWatermark
+		attr.WakeupEvents = uint32(watermark)
+	}
+
+	fd, _, errno := syscall.Syscall6(syscall.SYS_PERF_EVENT_OPEN, uintptr(unsafe.Pointer(&attr)),
+		^uintptr(0) /* pid -1 */, uintptr(cpu), ^uintptr(0) /* group_fd -1 */, perfFlagFdCloexec, 0)
+	if errno != 0 {
+		return nil, fmt.Errorf("perf_event_open on cpu %d: %v", cpu, errno)
+	}
+
+	pageSize := os.Getpagesize()
+	mem, err := syscall.Mmap(int(fd), 0, (pageCount+1)*pageSize, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		syscall.Close(int(fd))
+		return nil, fmt.Errorf("mmap of perf ring on cpu %d: %v", cpu, err)
+	}
+
+	if _, _, errno := syscall.Syscall(syscall.SYS_IOCTL, fd, perfEventIocEnable, 0); errno != 0 {
+		syscall.Munmap(mem)
+		syscall.Close(int(fd))
+		return nil, fmt.Errorf("enabling perf event on cpu %d: %v", cpu, errno)
+	}
+
+	return &perfRing{
+		cpu:  cpu,
+		fd:   int(fd),
+		mem:  mem,
+		data: mem[pageSize:],
+		mask: uint64(pageCount*pageSize - 1),
+	}, nil
+}
+
+func (r *perfRing) close() {
+	syscall.Syscall(syscall.SYS_IOCTL, uintptr(r.fd), perfEventIocDisable, 0)
+	syscall.Munmap(r.mem)
+	syscall.Close(r.fd)
+	r.mem, r.data = nil, nil
+}
+
+// copyOut copies len(dst) bytes starting at ring offset off, taking care of
+// records wrapping around the end of the ring.
+func (r *perfRing) copyOut(dst []byte, off uint64) {
+	off &= r.mask
+	n := copy(dst, r.data[off:])
+	copy(dst[n:], r.data)
+}
+
+// field returns the n bytes at ring offset off, which must not cross the
+// end of the ring.
+func (r *perfRing) field(off uint64, n uint64) []byte {
+	off &= r.mask
+	return r.data[off : off+n]
+}
+
+const sampleSlabSize = 64 * 1024
+
+// sampleSlab hands out sample buffers carved from larger chunks, which
+// saves an allocation per sample. A chunk is left to the GC once all its
+// samples are released.
+type sampleSlab struct {
+	chunk []byte
+}
+
+func (s *sampleSlab) alloc(n int) []byte {
+	if n > len(s.chunk) {
+		if n > sampleSlabSize/16 {
+			return make([]byte, n)
+		}
+		s.chunk = make([]byte, sampleSlabSize)
+	}
+	b := s.chunk[:n:n]
+	s.chunk = s.chunk[n:]
+	return b
+}
+
+// read calls fn for every sample available in the ring and returns the
+// ring space to the kernel. Samples are copied out of the ring into
+// buffers from slab. Without a slab they are only valid until fn returns:
+// they point into the ring itself, unless they wrap around its end.
+func (r *perfRing) read(slab *sampleSlab, fn func(sample []byte)) {
+	head := atomic.LoadUint64((*uint64)(unsafe.Pointer(&r.mem[perfDataHeadOffset])))
+	tail := atomic.LoadUint64((*uint64)(unsafe.Pointer(&r.mem[perfDataTailOffset])))
+
+	// Records are 8 byte aligned and the ring size is a multiple of 8, so
+	// the header and each u32 or u64 field after it are contiguous and
+	// read in place, instead of copied out to buffers that escape through
+	// ByteOrder.
+	var samples, bytes uint64
+	for tail < head {
+		hdr := r.data[tail&r.mask : tail&r.mask+perfEventHeaderSize]
+		typ := ByteOrder.Uint32(hdr[0:4])
+		size := uint64(ByteOrder.Uint16(hdr[6:8]))
+
+		switch typ {
+		case perfRecordSample:
+			n := uint64(ByteOrder.Uint32(r.field(tail+perfEventHeaderSize, 4)))
+			off := tail + perfEventHeaderSize + 4
+			var sample []byte
+			switch {
+			case slab != nil:
+				sample = slab.alloc(int(n))
+				r.copyOut(sample, off)
+			case off&r.mask+n <= uint64(len(r.data)):
+				sample = r.data[off&r.mask : off&r.mask+n : off&r.mask+n]
+			default:
+				if uint64(cap(r.wrapped)) < n {
+					r.wrapped = make([]byte, n)
+				}
+				sample = r.wrapped[:n]
+				r.copyOut(sample, off)
+			}
+			samples++
+			bytes += uint64(len(sample))
+			fn(sample)
+		case perfRecordLost:
+			// struct { header; u64 id; u64 lost; }
+			atomic.AddUint64(&r.lost, ByteOrder.Uint64(r.field(tail+perfEventHeaderSize+8, 8)))
+		}
+
+		tail += size
+	}
+
+	atomic.StoreUint64((*uint64)(unsafe.Pointer(&r.mem[perfDataTailOffset])), tail)
+	if samples > 0 {
+		atomic.AddUint64(&r.samples, samples)
+		atomic.AddUint64(&r.bytes, bytes)
+	}
+}
+
+// pending returns the number of bytes written by the kernel and not read
+// yet.
+func (r *perfRing) pending() uint64 {
+	if r.mem == nil {
+		return 0
+	}
+	head := atomic.LoadUint64((*uint64)(unsafe.Pointer(&r.mem[perfDataHeadOffset])))
+	tail := atomic.LoadUint64((*uint64)(unsafe.Pointer(&r.mem[perfDataTailOffset])))
+	return head - tail
+}
+
+// perfMap reads a BPF_MAP_TYPE_PERF_EVENT_ARRAY map. It takes the place of
+// elf.InitPerfMap so that the size of the per-CPU rings can be chosen and
+// lost samples are accounted for. Like the gobpf poller it delivers samples
+// in timestamp order, through a reorderBuffer.
+//
+// The rings are split between Readers perfReaders. With more than one, each
+// reader orders the samples of its own rings and a streamMerger merges the
+// resulting streams. Unordered readers skip all that and copy the samples
+// from the rings to sinks of their own.
+type perfMap struct {
+	name      string
+	pageCount int
+	rings     []*perfRing
+	readers   []*perfReader
+	merge     *streamMerger
+	window    uint64
+
+	sink        *sampleSink
+	pollTimeout int
+	idleTimeout int
+
+	stop chan struct{}
+	wg   sync.WaitGroup
+}
+
+// perfReader polls a subset of the rings of a perfMap from its own
+// goroutine.
+type perfReader struct {
+	pm      *perfMap
+	id      int
+	rings   []*perfRing
+	epfd    int
+	slab    sampleSlab
+	reorder *reorderBuffer
+
+	// sink of the reader itself, when unordered
+	sink *sampleSink
+
+	// samples released by reorder, for the merger
+	out [][]byte
+
+	// epoll_wait returns with ready rings and samples in reorder, for Stats
+	wakeups uint64
+	held    int64
+}
+
+func initPerfMap(b *elf.Module, mapName string, sink *sampleSink, opts perfMapOptions) (*perfMap, error) {
+	pageCount := opts.PageCount
+	if pageCount <= 0 || pageCount&(pageCount-1) != 0 {
+		return nil, fmt.Errorf("perf ring page count must be a power of 2, got %d", pageCount)
+	}
+	if opts.ReorderMax <= 0 {
+		return nil, fmt.Errorf("reorder buffer size must be positive, got %d", opts.ReorderMax)
+	}
+
+	mp := b.Map(mapName)
+	if mp == nil {
+		return nil, fmt.Errorf("no map with name %s", mapName)
+	}
+
+	cpus, err := onlineCPUs()
+	if err != nil {
+		return nil, fmt.Errorf("failed to get online cpus: %v", err)
+	}
+
+	wakeupEvents := opts.WakeupEvents
+	if wakeupEvents <= 0 {
+		wakeupEvents = 1
+	}
+	if opts.WakeupWatermark < 0 || opts.WakeupWatermark >= pageCount*os.Getpagesize() {
+		return nil, fmt.Errorf("perf wakeup watermark must be less than the ring size of %d bytes, got %d",
+			pageCount*os.Getpagesize(), opts.WakeupWatermark)
+	}
+
+	nreaders := opts.Readers
+	if nreaders <= 0 {
+		nreaders = 1
+	}
+	if nreaders > len(cpus) {
+		nreaders = len(cpus)
+	}
+
+	pm := &perfMap{
+		name:      mapName,
+		pageCount: pageCount,
+		window:    uint64(opts.ReorderWindow),
+		sink:      sink,
+		stop:      make(chan struct{}),
+	}
+
+	pm.idleTimeout = idleTimeoutMillis(opts.MaxLatency)
+
+	// while samples are held, wake up in time to release them
+	pm.pollTimeout = durationMillis(opts.ReorderWindow)
+	if pm.pollTimeout > pm.idleTimeout {
+		pm.pollTimeout = pm.idleTimeout
+	}
+
+	if nreaders > 1 && !opts.Unordered {
+		pm.merge = newStreamMerger(nreaders, sink.Add, sink.Flush)
+	}
+	for i := 0; i < nreaders; i++ {
+		epfd, err := syscall.EpollCreate1(syscall.EPOLL_CLOEXEC)
+		if err != nil {
+			pm.close()
+			return nil, fmt.Errorf("epoll_create1: %v", err)
+		}
+		r := &perfReader{pm: pm, id: i, epfd: epfd}
+		if opts.Unordered {
+			// the sink is copied from right away, straight out
+			// of the rings
+			r.sink = sink
+			if i > 0 {
+				r.sink = sink.fork()
+			}
+			pm.readers = append(pm.readers, r)
+			continue
+		}
+		emit := sink.Add
+		if pm.merge != nil {
+			emit = func(sample []byte) {
+				r.out = append(r.out, sample)
+			}
+		}
+		r.reorder = newReorderBuffer(pm.window, opts.ReorderMax, emit)
+		pm.readers = append(pm.readers, r)
+	}
+
+	for i, cpu := range cpus {
+		ring, err := openPerfRing(cpu, pageCount, wakeupEvents, opts.WakeupWatermark)
+		if err != nil {
+			pm.close()
+			return nil, err
+		}
+		pm.rings = append(pm.rings, ring)
+
+		key := uint32(cpu)
+		value := uint32(ring.fd)
+		if err := b.UpdateElement(mp, unsafe.Pointer(&key), unsafe.Pointer(&value), 0); err != nil {
+			pm.close()
+			return nil, fmt.Errorf("failed to set perf event of cpu %d in map %s: %v", cpu, mapName, err)
+		}
+
+		r := pm.readers[i%nreaders]
+		r.rings = append(r.rings, ring)
+		ev := syscall.EpollEvent{Events: syscall.EPOLLIN, Fd: int32(len(r.rings) - 1)}
+		if err := syscall.EpollCtl(r.epfd, syscall.EPOLL_CTL_ADD, ring.fd, &ev); err != nil {
+			pm.close()
+			return nil, fmt.Errorf("epoll_ctl: %v", err)
+		}
+	}
+
+	return pm, nil
+}
+
+func (pm *perfMap) close() {
+	for _, r := range pm.rings {
+		r.close()
+	}
+	for _, r := range pm.readers {
+		syscall.Close(r.epfd)
+	}
+}
+
+// RingSize returns the size in bytes of the data area of each CPU's ring.
+func (pm *perfMap) RingSize() int {
+	return pm.pageCount * os.Getpagesize()
+}
+
+// Lost returns the number of samples the kernel dropped so far because
+// the rings were full.
+func (pm *perfMap) Lost() uint64 {
+	var lost uint64
+	for _, r := range pm.rings {
+		lost += atomic.LoadUint64(&r.lost)
+	}
+	return lost
+}
+
+// Late returns the number of samples that arrived too late to be put back
+// in order.
+func (pm *perfMap) Late() uint64 {
+	var late uint64
+	for _, r := range pm.readers {
+		if r.reorder != nil {
+			late += r.reorder.Late()
+		}
+	}
+	return late
+}
+
+// poll reads the reader's rings and releases the samples older than the
+// reorder window. It returns whether samples are still held.
+func (r *perfReader) poll() bool {
+	if r.sink != nil {
+		for _, ring := range r.rings {
+			ring.read(nil, r.sink.Add)
+		}
+		r.sink.Flush()
+		return false
+	}
+
+	// Take the time before reading: everything stamped before it minus
+	// the window is in the rings by now.
+	now := MonotonicNow()
+
+	for _, ring := range r.rings {
+		ring.read(&r.slab, r.reorder.Push)
+	}
+	r.reorder.Advance(now)
+
+	if r.pm.merge != nil {
+		// nothing older than the window can come out of this reader
+		// anymore, except late samples
+		var watermark uint64
+		if now > r.pm.window {
+			watermark = now - r.pm.window
+		}
+		r.pm.merge.Push(r.id, r.out, watermark)
+		r.out = nil
+	} else {
+		r.pm.sink.Flush()
+	}
+
+	held := r.reorder.Len()
+	atomic.StoreInt64(&r.held, int64(held))
+	return held > 0
+}
+
+func (r *perfReader) run() {
+	pm := r.pm
+
+	events := make([]syscall.EpollEvent, len(r.rings))
+	timeout := pm.idleTimeout
+	for {
+		select {
+		case <-pm.stop:
+			return
+		default:
+		}
+
+		n, err := syscall.EpollWait(r.epfd, events, timeout)
+		if err != nil && err != syscall.EINTR {
+			fmt.Fprintf(os.Stderr, "perf map %s epoll_wait: %v\n", pm.name, err)
+			return
+		}
+		if n > 0 {
+			atomic.AddUint64(&r.wakeups, 1)
+		}
+
+		// the merger waits for all readers, keep the watermark moving
+		if r.poll() || pm.merge != nil {
+			timeout = pm.pollTimeout
+		} else {
+			timeout = pm.idleTimeout
+		}
+	}
+}
+
+// Stats returns the counters of the map, per CPU for the lost samples.
+func (pm *perfMap) Stats() SourceStats {
+	st := SourceStats{
+		Map:  pm.name,
+		Kind: "perf",
+	}
+	for _, r := range pm.readers {
+		st.Held += int(atomic.LoadInt64(&r.held))
+		st.Wakeups += atomic.LoadUint64(&r.wakeups)
+	}
+	if pm.merge != nil {
+		st.Held += pm.merge.Len()
+	}
+	for _, r := range pm.rings {
+		lost := atomic.LoadUint64(&r.lost)
+		st.Samples += atomic.LoadUint64(&r.samples)
+		st.Bytes += atomic.LoadUint64(&r.bytes)
+		st.Lost += lost
+		st.Pending += r.pending()
+		if lost > 0 {
+			st.LostPerCPU = append(st.LostPerCPU, CPUCount{CPU: r.cpu, Count: lost})
+		}
+	}
+	return st
+}
+
+func (pm *perfMap) PollStart() {
+	if pm.merge != nil {
+		pm.merge.Start()
+	}
+	for _, r := range pm.readers {
+		pm.wg.Add(1)
+		go func(r *perfReader) {
+			defer pm.wg.Done()
+			r.run()
+		}(r)
+	}
+}
+
+func (pm *perfMap) PollStop() {
+	close(pm.stop)
+	pm.wg.Wait()
+
+	// deliver what is left regardless of the window
+	for _, r := range pm.readers {
+		if r.sink != nil {
+			r.poll()
+			continue
+		}
+		for _, ring := range r.rings {
+			ring.read(&r.slab, r.reorder.Push)
+		}
+		r.reorder.Flush()
+		if pm.merge != nil {
+			pm.merge.Push(r.id, r.out, math.MaxUint64)
+			r.out = nil
+		}
+	}
+	if pm.merge != nil {
+		pm.merge.Stop()
+	} else {
+		pm.sink.Flush()
+	}
+
+	pm.close()
+}
@@ -0,0 +1,145 @@
+package tracer
+
+import (
+	"bytes"
+	"fmt"
+	"os"
+	"syscall"
+	"testing"
+)
+
+// newTestRing returns a perfRing on plain memory, of the layout the kernel
+// mmaps: a page of metadata followed by size bytes of ring.
+func newTestRing(size int) *perfRing {
+	pageSize := os.Getpagesize()
+	mem := make([]byte, pageSize+size)
+	return &perfRing{mem: mem, data: mem[pageSize:], mask: uint64(size - 1)}
+}
+
+func (r *perfRing) testHead() uint64 {
+	return ByteOrder.Uint64(r.mem[perfDataHeadOffset:])
+}
+
+// testRecord returns the sample record of payload, as
+// bpf_perf_event_output writes it.
+func testRecord(payload []byte) []byte {
+	rec := make([]byte, perfEventHeaderSize+4+len(payload))
+	ByteOrder.PutUint32(rec[0:4], perfRecordSample)
+	ByteOrder.PutUint16(rec[6:8], uint16(len(rec)))
+	ByteOrder.PutUint32(rec[8:12], uint32(len(payload)))
+	copy(rec[12:], payload)
+	return rec
+}
+
+// testWrite writes rec at the head of the ring and moves the head past it.
+func (r *perfRing) testWrite(rec []byte) {
+	head := r.testHead()
+	for i, c := range rec {
+		r.data[(head+uint64(i))&r.mask] = c
+	}
+	ByteOrder.PutUint64(r.mem[perfDataHeadOffset:], head+uint64(len(rec)))
+}
+
+func TestPerfRingRead(t *testing.T) {
+	r := newTestRing(128)
+	// start close to the end so that the second sample wraps around,
+	// records are 8 byte aligned as the kernel writes them
+	ByteOrder.PutUint64(r.mem[perfDataHeadOffset:], 96)
+	ByteOrder.PutUint64(r.mem[perfDataTailOffset:], 96)
+	want := [][]byte{
+		[]byte("abcdefghijkl"),
+		[]byte("mnopqrstuvwxyz0123456789ABCD"),
+		[]byte("0123456789abcdefghij"),
+	}
+	for _, p := range want {
+		r.testWrite(testRecord(p))
+	}
+
+	for _, slab := range []*sampleSlab{nil, {}} {
+		ByteOrder.PutUint64(r.mem[perfDataTailOffset:], 96)
+		var got [][]byte
+		r.read(slab, func(sample []byte) {
+			got = append(got, append([]byte(nil), sample...))
+		})
+		if len(got) != len(want) {
+			t.Fatalf("got %d samples, want %d", len(got), len(want))
+		}
+		for i := range want {
+			if !bytes.Equal(got[i], want[i]) {
+				t.Errorf("sample %d is %q, want %q", i, got[i], want[i])
+			}
+		}
+		if tail := ByteOrder.Uint64(r.mem[perfDataTailOffset:]); tail != r.testHead() {
+			t.Errorf("tail %d not moved to head %d", tail, r.testHead())
+		}
+	}
+}
+
+// BenchmarkPerfWakeup measures the cost per event of the reader for several
+// numbers of events per wakeup, as set by -perf-wakeup-events. A wakeup is
+// an epoll_wait returning on a pipe, standing in for the perf event fd,
+// followed by the read of the ring and the hand-over of the batch. The
+// kernel side of a wakeup is not part of it.
+func BenchmarkPerfWakeup(b *testing.B) {
+	for _, perWakeup := range []int{1, 8, 64} {
+		b.Run(fmt.Sprintf("events=%d", perWakeup), func(b *testing.B) {
+			benchmarkPerfWakeup(b, perWakeup)
+		})
+	}
+}
+
+func benchmarkPerfWakeup(b *testing.B, perWakeup int) {
+	var fds [2]int
+	if err := syscall.Pipe(fds[:]); err != nil {
+		b.Fatal(err)
+	}
+	defer syscall.Close(fds[0])
+	defer syscall.Close(fds[1])
+	epfd, err := syscall.EpollCreate1(syscall.EPOLL_CLOEXEC)
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer syscall.Close(epfd)
+	ev := syscall.EpollEvent{Events: syscall.EPOLLIN, Fd: int32(fds[0])}
+	if err := syscall.EpollCtl(epfd, syscall.EPOLL_CTL_ADD, fds[0], &ev); err != nil {
+		b.Fatal(err)
+	}
+
+	var samples int
+	p := newEventPipeline(256, SinkFunc(func(f Family, s [][]byte) {
+		samples += len(s)
+	}))
+	p.Start()
+	sink := p.sampleSink(FamilyIPv4)
+
+	r := newTestRing(64 * 1024)
+	rec := testRecord(make([]byte, tcpEventV4CompactSize))
+	events := make([]syscall.EpollEvent, 1)
+	one := []byte{0}
+	var buf [1]byte
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for n := 0; n < b.N; n += perWakeup {
+		b.StopTimer()
+		for i := 0; i < perWakeup; i++ {
+			r.testWrite(rec)
+		}
+		syscall.Write(fds[1], one)
+		b.StartTimer()
+
+		if _, err := syscall.EpollWait(epfd, events, -1); err != nil {
+			b.Fatal(err)
+		}
+		syscall.Read(fds[0], buf[:])
+		r.read(nil, sink.Add)
+		sink.Flush()
+	}
+	b.StopTimer()
+	p.Stop()
+
+	// b.N events, rounded up to whole wakeups
+	if samples < b.N {
+		b.Fatalf("got %d samples, want at least %d", samples, b.N)
+	}
+}
@@ -0,0 +1,164 @@
+package tracer
+
+import (
+	"sync/atomic"
+)
+
+const (
+	// sampleArenaSize is the number of sample bytes a batch holds
+	sampleArenaSize = 64 * 1024
+	// pipelineDepth is the number of batches queued for the consumer
+	pipelineDepth = 64
+)
+
+// sampleBatch carries the samples one source read during a wakeup to the
+// consumer. The samples are copied into the batch's arena, batches are
+// recycled once consumed so delivery does not allocate.
+type sampleBatch struct {
+	family  Family
+	arena   []byte
+	samples [][]byte
+}
+
+// add copies sample into the batch and reports whether there was room.
+func (sb *sampleBatch) add(sample []byte) bool {
+	if len(sb.samples) == cap(sb.samples) {
+		return false
+	}
+	off := len(sb.arena)
+	if off+len(sample) > cap(sb.arena) {
+		if off > 0 {
+			return false
+		}
+		// larger than the whole arena, give it its own buffer
+		sb.samples = append(sb.samples, append([]byte(nil), sample...))
+		return true
+	}
+	sb.arena = append(sb.arena, sample...)
+	sb.samples = append(sb.samples, sb.arena[off:len(sb.arena):len(sb.arena)])
+	return true
+}
+
+// eventPipeline fans the samples of all sources into one consumer, which
+// hands them to the Sink. Sources fill batches through their sampleSink
+// and hand over a batch per wakeup, or earlier when it is full, instead of
+// one channel send per sample.
+type eventPipeline struct {
+	batchSize int
+	sink      Sink
+
+	batches chan *sampleBatch
+	free    chan *sampleBatch
+	queued  int64 // samples in batches, for Backlog
+	done    chan struct{}
+}
+
+func newEventPipeline(batchSize int, sink Sink) *eventPipeline {
+	if batchSize < 1 {
+		batchSize = 1
+	}
+	return &eventPipeline{
+		batchSize: batchSize,
+		sink:      sink,
+		batches:   make(chan *sampleBatch, pipelineDepth),
+		free:      make(chan *sampleBatch, pipelineDepth+1),
+		done:      make(chan struct{}),
+	}
+}
+
+func (p *eventPipeline) getBatch(f Family) *sampleBatch {
+	var sb *sampleBatch
+	select {
+	case sb = <-p.free:
+	default:
+		sb = &sampleBatch{
+			arena:   make([]byte, 0, sampleArenaSize),
+			samples: make([][]byte, 0, p.batchSize),
+		}
+	}
+	sb.family = f
+	return sb
+}
+
+func (p *eventPipeline) putBatch(sb *sampleBatch) {
+	for i := range sb.samples {
+		sb.samples[i] = nil
+	}
+	sb.samples = sb.samples[:0]
+	sb.arena = sb.arena[:0]
+	select {
+	case p.free <- sb:
+	default:
+	}
+}
+
+func (p *eventPipeline) send(sb *sampleBatch) {
+	atomic.AddInt64(&p.queued, int64(len(sb.samples)))
+	p.batches <- sb
+}
+
+// sampleSink collects the samples of one source. It is only used from the
+// source's goroutine.
+type sampleSink struct {
+	pipeline *eventPipeline
+	family   Family
+	cur      *sampleBatch
+}
+
+// sampleSink returns the sink for the samples of f's source.
+func (p *eventPipeline) sampleSink(f Family) *sampleSink {
+	return &sampleSink{pipeline: p, family: f}
+}
+
+// fork returns another sink for the same source, for a goroutine of its
+// own.
+func (s *sampleSink) fork() *sampleSink {
+	return s.pipeline.sampleSink(s.family)
+}
+
+// Add copies sample into the current batch, sending the batch first if it
+// is full. The caller may reuse sample once Add returns.
+func (s *sampleSink) Add(sample []byte) {
+	if s.cur == nil {
+		s.cur = s.pipeline.getBatch(s.family)
+	}
+	if !s.cur.add(sample) {
+		s.pipeline.send(s.cur)
+		s.cur = s.pipeline.getBatch(s.family)
+		s.cur.add(sample)
+	}
+}
+
+// Flush sends the current batch, if any. Sources call it at the end of
+// each wakeup.
+func (s *sampleSink) Flush() {
+	if s.cur == nil || len(s.cur.samples) == 0 {
+		return
+	}
+	s.pipeline.send(s.cur)
+	s.cur = nil
+}
+
+// Backlog returns the number of samples waiting for the consumer.
+func (p *eventPipeline) Backlog() int {
+	return int(atomic.LoadInt64(&p.queued))
+}
+
+func (p *eventPipeline) Start() {
+	go func() {
+		defer close(p.done)
+
+		for sb := range p.batches {
+			p.sink.Samples(sb.family, sb.samples)
+			atomic.AddInt64(&p.queued, -int64(len(sb.samples)))
+			p.putBatch(sb)
+		}
+	}()
+}
+
+// Stop waits for the consumer to handle the samples delivered so far. The
+// sources must be stopped first.
+func (p *eventPipeline) Stop() {
+	close(p.batches)
+	<-p.done
+}
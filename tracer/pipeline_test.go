@@ -0,0 +1,107 @@
+package tracer
+
+import (
+	"testing"
+)
+
+func TestPipeline(t *testing.T) {
+	var got []byte
+	var batches int
+	p := newEventPipeline(3, SinkFunc(func(f Family, samples [][]byte) {
+		if f != FamilyIPv6 {
+			t.Errorf("got samples of %v, want %v", f, FamilyIPv6)
+		}
+		batches++
+		for _, s := range samples {
+			got = append(got, s...)
+		}
+	}))
+	p.Start()
+
+	s := p.sampleSink(FamilyIPv6)
+	sample := make([]byte, 1)
+	for i := 0; i < 10; i++ {
+		sample[0] = byte(i)
+		s.Add(sample) // copied, sample can be reused
+	}
+	s.Flush()
+	// larger than an arena
+	s.Add(make([]byte, sampleArenaSize+1))
+	s.Flush()
+	p.Stop()
+
+	if len(got) != 10+sampleArenaSize+1 {
+		t.Fatalf("got %d bytes, want %d", len(got), 10+sampleArenaSize+1)
+	}
+	for i := 0; i < 10; i++ {
+		if got[i] != byte(i) {
+			t.Fatalf("sample %d is %d", i, got[i])
+		}
+	}
+	// 10 samples in batches of 3, and the large one
+	if batches != 5 {
+		t.Errorf("got %d batches, want 5", batches)
+	}
+	if n := p.Backlog(); n != 0 {
+		t.Errorf("backlog of %d samples once stopped", n)
+	}
+}
+
+// wakeupSamples is the number of samples read per wakeup in the benchmarks
+const wakeupSamples = 64
+
+// BenchmarkPipelineBatch hands the samples over in one batch per wakeup.
+func BenchmarkPipelineBatch(b *testing.B) {
+	var n int
+	p := newEventPipeline(256, SinkFunc(func(f Family, samples [][]byte) {
+		n += len(samples)
+	}))
+	p.Start()
+	s := p.sampleSink(FamilyIPv4)
+	sample := make([]byte, tcpEventV4CompactSize)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		s.Add(sample)
+		if i%wakeupSamples == wakeupSamples-1 {
+			s.Flush()
+		}
+	}
+	s.Flush()
+	p.Stop()
+	if n != b.N {
+		b.Fatalf("got %d samples, want %d", n, b.N)
+	}
+}
+
+// BenchmarkPipelineChannel is the former delivery, one channel send of a
+// copy of each sample.
+func BenchmarkPipelineChannel(b *testing.B) {
+	var n int
+	samples := make(chan []byte)
+	done := make(chan struct{})
+	sink := SinkFunc(func(f Family, samples [][]byte) {
+		n += len(samples)
+	})
+	go func() {
+		defer close(done)
+		one := make([][]byte, 1)
+		for s := range samples {
+			one[0] = s
+			sink.Samples(FamilyIPv4, one)
+		}
+	}()
+	sample := make([]byte, tcpEventV4CompactSize)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		samples <- append([]byte(nil), sample...)
+	}
+	close(samples)
+	<-done
+	if n != b.N {
+		b.Fatalf("got %d samples, want %d", n, b.N)
+	}
+}
@@ -0,0 +1,105 @@
+package tracer
+
+import (
+	"container/heap"
+	"sync/atomic"
+)
+
+// sampleHeap is a min-heap of samples on their timestamp.
+type sampleHeap [][]byte
+
+func (h sampleHeap) Len() int { return len(h) }
+func (h sampleHeap) Less(i, j int) bool {
+	return sampleTimestamp(h[i]) < sampleTimestamp(h[j])
+}
+func (h sampleHeap) Swap(i, j int) { h[i], h[j] = h[j], h[i] }
+
+func (h *sampleHeap) Push(x interface{}) {
+	*h = append(*h, x.([]byte))
+}
+
+func (h *sampleHeap) Pop() interface{} {
+	old := *h
+	n := len(old)
+	x := old[n-1]
+	old[n-1] = nil
+	*h = old[:n-1]
+	return x
+}
+
+func sampleTimestamp(sample []byte) uint64 {
+	if len(sample) < 8 {
+		return 0
+	}
+	return ByteOrder.Uint64(sample)
+}
+
+// reorderBuffer restores the timestamp order of samples coming from
+// several per-CPU rings. Samples are held until they are older than the
+// window, so the window is the maximum latency ordering adds. At most max
+// samples are held; past that the oldest ones are released early. Samples
+// arriving after a newer one was already released are passed through
+// immediately and counted as late, the consumers flag them.
+type reorderBuffer struct {
+	window uint64
+	max    int
+	emit   func(sample []byte)
+
+	pending     sampleHeap
+	lastEmitted uint64
+	late        uint64
+}
+
+func newReorderBuffer(window uint64, max int, emit func(sample []byte)) *reorderBuffer {
+	return &reorderBuffer{
+		window: window,
+		max:    max,
+		emit:   emit,
+	}
+}
+
+func (rb *reorderBuffer) release(sample []byte) {
+	if ts := sampleTimestamp(sample); ts > rb.lastEmitted {
+		rb.lastEmitted = ts
+	}
+	rb.emit(sample)
+}
+
+// Push adds a sample to the window.
+func (rb *reorderBuffer) Push(sample []byte) {
+	if sampleTimestamp(sample) < rb.lastEmitted {
+		atomic.AddUint64(&rb.late, 1)
+		rb.emit(sample)
+		return
+	}
+
+	heap.Push(&rb.pending, sample)
+	if len(rb.pending) > rb.max {
+		rb.release(heap.Pop(&rb.pending).([]byte))
+	}
+}
+
+// Advance releases all samples stamped before now minus the window. now
+// is a CLOCK_MONOTONIC time, the clock bpf_ktime_get_ns() reads.
+func (rb *reorderBuffer) Advance(now uint64) {
+	for len(rb.pending) > 0 && sampleTimestamp(rb.pending[0])+rb.window <= now {
+		rb.release(heap.Pop(&rb.pending).([]byte))
+	}
+}
+
+// Flush releases all held samples in order.
+func (rb *reorderBuffer) Flush() {
+	for len(rb.pending) > 0 {
+		rb.release(heap.Pop(&rb.pending).([]byte))
+	}
+}
+
+// Len returns the number of held samples.
+func (rb *reorderBuffer) Len() int {
+	return len(rb.pending)
+}
+
+// Late returns the number of samples that arrived past the window.
+func (rb *reorderBuffer) Late() uint64 {
+	return atomic.LoadUint64(&rb.late)
+}
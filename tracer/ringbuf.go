@@ -0,0 +1,241 @@
+package tracer
+
+import (
+	"fmt"
+	"io"
+	"os"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+const (
+	ringBufBusyBit    = 1 << 31
+	ringBufDiscardBit = 1 << 30
+	ringBufHdrSize    = 8
+)
+
+// eventSource is what a Tracer needs from a map delivering events, it is
+// implemented by perfMap and ringBuffer.
+type eventSource interface {
+	PollStart()
+	PollStop()
+	Stats() SourceStats
+
+	// close releases the fds and mappings of a source never started, or
+	// stopped already.
+	close()
+}
+
+// initEventSource opens the events map mapName for reading, its samples go
+// to sink. The backend is picked from
+// the type the map was created with: BPF ring buffers and perf event
+// arrays, which are set up according to perfOpts. The setup is described
+// on log.
+func initEventSource(b *elf.Module, mapName string, sink *sampleSink, perfOpts perfMapOptions, log io.Writer) (eventSource, error) {
+	mp := b.Map(mapName)
+	if mp == nil {
+		return nil, fmt.Errorf("no map with name %s", mapName)
+	}
+
+	// BPF_OBJ_GET_INFO_BY_FD is older than ring buffers, if it is not
+	// supported the map cannot be one
+	info, err := bpfMapGetInfo(mp.Fd())
+	if err == nil && info.Type == bpfMapTypeRingBuf {
+		rb, err := initRingBuffer(mp.Fd(), int(info.MaxEntries), sink, idleTimeoutMillis(perfOpts.MaxLatency))
+		if err != nil {
+			return nil, err
+		}
+		rb.name = mapName
+		fmt.Fprintf(log, "%s: ring buffer of %d KiB shared by all cpus\n", mapName, info.MaxEntries/1024)
+		return rb, nil
+	}
+
+	pm, err := initPerfMap(b, mapName, sink, perfOpts)
+	if err != nil {
+		return nil, err
+	}
+	fmt.Fprintf(log, "%s: %d per-cpu perf rings of %d pages (%d KiB), %d KiB total, %d readers\n",
+		mapName, len(pm.rings), pm.pageCount, pm.RingSize()/1024, len(pm.rings)*pm.RingSize()/1024, len(pm.readers))
+	return pm, nil
+}
+
+// ringBuffer consumes a BPF_MAP_TYPE_RINGBUF map. The kernel shares a
+// single ring between all CPUs so records arrive in reservation order and
+// are delivered as is, without the reordering the perf maps need.
+type ringBuffer struct {
+	name string
+	fd   int
+	mask uint64
+
+	// consumer page (read-write), producer page and data pages (read-only).
+	// The data pages are mapped twice in a row so that records wrapping
+	// around the end of the ring can be read contiguously.
+	consumer []byte
+	producer []byte
+	data     []byte
+
+	epfd    int
+	timeout int
+	sink    *sampleSink
+
+	// updated by the poller, loaded by Stats
+	samples uint64
+	bytes   uint64
+	wakeups uint64
+
+	stop chan struct{}
+	wg   sync.WaitGroup
+}
+
+// initRingBuffer maps the ring buffer fd of size bytes. Its poller waits
+// at most timeout milliseconds for a wakeup.
+func initRingBuffer(fd, size int, sink *sampleSink, timeout int) (*ringBuffer, error) {
+	pageSize := os.Getpagesize()
+
+	consumer, err := syscall.Mmap(fd, 0, pageSize, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("failed to mmap ring buffer consumer page: %v", err)
+	}
+
+	producer, err := syscall.Mmap(fd, int64(pageSize), pageSize+2*size, syscall.PROT_READ, syscall.MAP_SHARED)
+	if err != nil {
+		syscall.Munmap(consumer)
+		return nil, fmt.Errorf("failed to mmap ring buffer data pages: %v", err)
+	}
+
+	epfd, err := syscall.EpollCreate1(syscall.EPOLL_CLOEXEC)
+	if err != nil {
+		syscall.Munmap(producer)
+		syscall.Munmap(consumer)
+		return nil, fmt.Errorf("epoll_create1: %v", err)
+	}
+
+	ev := syscall.EpollEvent{Events: syscall.EPOLLIN, Fd: int32(fd)}
+	if err := syscall.EpollCtl(epfd, syscall.EPOLL_CTL_ADD, fd, &ev); err != nil {
+		syscall.Close(epfd)
+		syscall.Munmap(producer)
+		syscall.Munmap(consumer)
+		return nil, fmt.Errorf("epoll_ctl: %v", err)
+	}
+
+	return &ringBuffer{
+		fd:       fd,
+		mask:     uint64(size - 1),
+		consumer: consumer,
+		producer: producer,
+		data:     producer[pageSize:],
+		epfd:     epfd,
+		timeout:  timeout,
+		sink:     sink,
+		stop:     make(chan struct{}),
+	}, nil
+}
+
+func (rb *ringBuffer) consumerPos() *uint64 {
+	return (*uint64)(unsafe.Pointer(&rb.consumer[0]))
+}
+
+func (rb *ringBuffer) producerPos() *uint64 {
+	return (*uint64)(unsafe.Pointer(&rb.producer[0]))
+}
+
+// drain delivers all committed records and returns the number of them.
+func (rb *ringBuffer) drain() int {
+	n := 0
+	cons := atomic.LoadUint64(rb.consumerPos())
+	for {
+		prod := atomic.LoadUint64(rb.producerPos())
+		if cons >= prod {
+			break
+		}
+
+		for cons < prod {
+			off := cons & rb.mask
+			hdr := atomic.LoadUint32((*uint32)(unsafe.Pointer(&rb.data[off])))
+			if hdr&ringBufBusyBit != 0 {
+				// reserved but not committed yet
+				atomic.StoreUint64(rb.consumerPos(), cons)
+				return n
+			}
+
+			length := uint64(hdr &^ (ringBufBusyBit | ringBufDiscardBit))
+			if hdr&ringBufDiscardBit == 0 {
+				// copied by the sink before the space is released
+				rb.sink.Add(rb.data[off+ringBufHdrSize : off+ringBufHdrSize+length])
+				atomic.AddUint64(&rb.samples, 1)
+				atomic.AddUint64(&rb.bytes, length)
+				n++
+			}
+
+			cons += (length + ringBufHdrSize + 7) &^ 7
+			atomic.StoreUint64(rb.consumerPos(), cons)
+		}
+	}
+	return n
+}
+
+func (rb *ringBuffer) PollStart() {
+	rb.wg.Add(1)
+	go func() {
+		defer rb.wg.Done()
+
+		events := make([]syscall.EpollEvent, 1)
+		for {
+			select {
+			case <-rb.stop:
+				return
+			default:
+			}
+
+			rb.drain()
+			rb.sink.Flush()
+
+			n, err := syscall.EpollWait(rb.epfd, events, rb.timeout)
+			if err != nil && err != syscall.EINTR {
+				fmt.Fprintf(os.Stderr, "ring buffer epoll_wait: %v\n", err)
+				return
+			}
+			if n > 0 {
+				atomic.AddUint64(&rb.wakeups, 1)
+			}
+		}
+	}()
+}
+
+func (rb *ringBuffer) PollStop() {
+	close(rb.stop)
+	rb.wg.Wait()
+
+	rb.drain()
+	rb.sink.Flush()
+
+	rb.close()
+}
+
+func (rb *ringBuffer) close() {
+	syscall.Close(rb.epfd)
+	syscall.Munmap(rb.producer)
+	syscall.Munmap(rb.consumer)
+	rb.producer, rb.consumer, rb.data = nil, nil, nil
+}
+
+// Stats returns the counters of the ring. The kernel does not report
+// records it failed to reserve, the sample program counts them as
+// events_dropped in its probe counters.
+func (rb *ringBuffer) Stats() SourceStats {
+	st := SourceStats{
+		Map:     rb.name,
+		Kind:    "ringbuf",
+		Samples: atomic.LoadUint64(&rb.samples),
+		Bytes:   atomic.LoadUint64(&rb.bytes),
+		Wakeups: atomic.LoadUint64(&rb.wakeups),
+	}
+	if rb.producer != nil {
+		st.Pending = atomic.LoadUint64(rb.producerPos()) - atomic.LoadUint64(rb.consumerPos())
+	}
+	return st
+}
@@ -0,0 +1,58 @@
+package tracer
+
+import (
+	"fmt"
+	"math"
+	"time"
+	"unsafe"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// samplingConfig mirrors struct sampling_config in
+// kernel/trace_output_kern.c.
+type samplingConfig struct {
+	flowIntervalNs uint64
+	flowBurstNs    uint64
+	sampleEvery    uint32
+	pad            uint32
+}
+
+// setSampling makes the kernel program keep one event in sampleEvery and
+// at most flowRate events per second and flow, on each CPU, with bursts of
+// flowBurst events. Events sent carry the number of events they stand
+// for. Zero values disable either.
+func setSampling(b *elf.Module, sampleEvery int, flowRate float64, flowBurst int) error {
+	mp := b.Map("sampling_config")
+	if mp == nil {
+		if sampleEvery > 1 || flowRate > 0 {
+			return fmt.Errorf("object has no sampling_config map, cannot sample events")
+		}
+		return nil
+	}
+
+	var cfg samplingConfig
+	if sampleEvery > 1 {
+		if sampleEvery > math.MaxUint16 {
+			return fmt.Errorf("invalid sampling rate 1 in %d, the event weight is 16 bits", sampleEvery)
+		}
+		cfg.sampleEvery = uint32(sampleEvery)
+	}
+	if flowRate > 0 {
+		if flowBurst < 1 {
+			flowBurst = 1
+		}
+		interval := time.Duration(float64(time.Second) / flowRate)
+		if interval < 1 {
+			interval = 1
+		}
+		cfg.flowIntervalNs = uint64(interval)
+		cfg.flowBurstNs = uint64(interval) * uint64(flowBurst)
+	}
+
+	var zero uint32
+	if err := b.UpdateElement(mp, unsafe.Pointer(&zero), unsafe.Pointer(&cfg), 0); err != nil {
+		return fmt.Errorf("failed to update sampling_config: %v", err)
+	}
+	return nil
+}
@@ -0,0 +1,137 @@
+package tracer
+
+// Sink consumes the samples of the event maps. Samples is called from a
+// single goroutine with the samples of family f one source read at once,
+// in timestamp order unless Options.Unordered. The samples are the records
+// as the kernel side wrote them, in ByteOrder, and are only valid until
+// Samples returns. A Sink slower than the kernel holds up the pipeline and
+// eventually makes the kernel drop samples.
+type Sink interface {
+	Samples(f Family, samples [][]byte)
+}
+
+// SinkFunc adapts a function to a Sink, for the sinks doing their own
+// decoding.
+type SinkFunc func(f Family, samples [][]byte)
+
+// Samples calls fn(f, samples).
+func (fn SinkFunc) Samples(f Family, samples [][]byte) {
+	fn(f, samples)
+}
+
+// ErrorFunc is called with the samples that cannot be decoded.
+type ErrorFunc func(f Family, sample []byte, err error)
+
+func (fn ErrorFunc) report(f Family, sample []byte, err error) {
+	if fn != nil {
+		fn(f, sample, err)
+	}
+}
+
+// Callbacks is a Sink decoding the samples and calling V4 or V6 with each
+// event. The event is reused once the call returns. The samples of a
+// family without a callback are not decoded.
+type Callbacks struct {
+	V4    func(event *TCPEventV4)
+	V6    func(event *TCPEventV6)
+	Error ErrorFunc
+
+	v4 TCPEventV4
+	v6 TCPEventV6
+}
+
+func (c *Callbacks) Samples(f Family, samples [][]byte) {
+	switch {
+	case f == FamilyIPv4 && c.V4 != nil:
+		for _, sample := range samples {
+			if err := DecodeTCPEventV4(sample, &c.v4); err != nil {
+				c.Error.report(f, sample, err)
+				continue
+			}
+			c.V4(&c.v4)
+		}
+	case f == FamilyIPv6 && c.V6 != nil:
+		for _, sample := range samples {
+			if err := DecodeTCPEventV6(sample, &c.v6); err != nil {
+				c.Error.report(f, sample, err)
+				continue
+			}
+			c.V6(&c.v6)
+		}
+	}
+}
+
+// BatchCallbacks is a Sink decoding all the samples it gets at once, then
+// calling V4 or V6 with the events. The slice is reused once the call
+// returns.
+type BatchCallbacks struct {
+	V4    func(events []TCPEventV4)
+	V6    func(events []TCPEventV6)
+	Error ErrorFunc
+
+	v4 []TCPEventV4
+	v6 []TCPEventV6
+}
+
+func (c *BatchCallbacks) Samples(f Family, samples [][]byte) {
+	switch {
+	case f == FamilyIPv4 && c.V4 != nil:
+		events := c.v4[:0]
+		for _, sample := range samples {
+			events = append(events, TCPEventV4{})
+			if err := DecodeTCPEventV4(sample, &events[len(events)-1]); err != nil {
+				c.Error.report(f, sample, err)
+				events = events[:len(events)-1]
+			}
+		}
+		c.v4 = events
+		if len(events) > 0 {
+			c.V4(events)
+		}
+	case f == FamilyIPv6 && c.V6 != nil:
+		events := c.v6[:0]
+		for _, sample := range samples {
+			events = append(events, TCPEventV6{})
+			if err := DecodeTCPEventV6(sample, &events[len(events)-1]); err != nil {
+				c.Error.report(f, sample, err)
+				events = events[:len(events)-1]
+			}
+		}
+		c.v6 = events
+		if len(events) > 0 {
+			c.V6(events)
+		}
+	}
+}
+
+// Channels is a Sink sending the events to V4 or V6. The sends block, a
+// receiver not keeping up holds up the pipeline like a slow Sink. The
+// events of a family without a channel are not decoded.
+type Channels struct {
+	V4    chan<- TCPEventV4
+	V6    chan<- TCPEventV6
+	Error ErrorFunc
+}
+
+func (c *Channels) Samples(f Family, samples [][]byte) {
+	switch {
+	case f == FamilyIPv4 && c.V4 != nil:
+		var event TCPEventV4
+		for _, sample := range samples {
+			if err := DecodeTCPEventV4(sample, &event); err != nil {
+				c.Error.report(f, sample, err)
+				continue
+			}
+			c.V4 <- event
+		}
+	case f == FamilyIPv6 && c.V6 != nil:
+		var event TCPEventV6
+		for _, sample := range samples {
+			if err := DecodeTCPEventV6(sample, &event); err != nil {
+				c.Error.report(f, sample, err)
+				continue
+			}
+			c.V6 <- event
+		}
+	}
+}
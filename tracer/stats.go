@@ -0,0 +1,52 @@
+package tracer
+
+import (
+	"fmt"
+	"strconv"
+	"strings"
+)
+
+// CPUCount is a counter of one CPU.
+type CPUCount struct {
+	CPU   int
+	Count uint64
+}
+
+// SourceStats are the counters of an eventSource since it was opened.
+type SourceStats struct {
+	Map  string
+	Kind string // "perf" or "ringbuf"
+
+	Samples uint64
+	Bytes   uint64
+
+	// Lost is the number of samples the kernel could not write to a full
+	// perf ring, LostPerCPU lists the CPUs that lost some.
+	Lost       uint64
+	LostPerCPU []CPUCount
+
+	// Pending is the number of bytes in the rings not read yet, Held the
+	// number of samples read and waiting to be reordered.
+	Pending uint64
+	Held    int
+
+	// Wakeups is the number of times the poller was woken up by the
+	// kernel, as opposed to timeouts.
+	Wakeups uint64
+}
+
+func (st SourceStats) String() string {
+	s := fmt.Sprintf("%s (%s): %d events, %d bytes, %d lost", st.Map, st.Kind, st.Samples, st.Bytes, st.Lost)
+	if len(st.LostPerCPU) > 0 {
+		perCPU := make([]string, len(st.LostPerCPU))
+		for i, c := range st.LostPerCPU {
+			perCPU[i] = "cpu" + strconv.Itoa(c.CPU) + "=" + strconv.FormatUint(c.Count, 10)
+		}
+		s += " (" + strings.Join(perCPU, " ") + ")"
+	}
+	if st.Wakeups > 0 {
+		// what batching the wakeups saves
+		s += fmt.Sprintf(", %d wakeups, %.1f events per wakeup", st.Wakeups, float64(st.Samples)/float64(st.Wakeups))
+	}
+	return s
+}
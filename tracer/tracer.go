@@ -0,0 +1,304 @@
+// Package tracer loads a BPF object with the kprobes and maps of
+// tcptracer-bpf, like kernel/trace_output_kern.o, and streams the events of
+// its maps to a Sink. It is what the gobpf-elf-loader command is built on,
+// for programs that want the events without going through its output.
+//
+// A Tracer is set up in steps, so that callers only pay for what they use:
+//
+//	t, err := tracer.Load(fileName, tracer.Options{})
+//	...
+//	err = t.EnableKprobes()
+//	...
+//	err = t.ResolveOffsets()
+//	...
+//	err = t.Start(&tracer.Callbacks{V4: func(e *tracer.TCPEventV4) { ... }})
+//	...
+//	t.Stop()
+//
+// Sinks get the raw samples of the kernel, Callbacks, BatchCallbacks and
+// Channels decode them first. Nothing is formatted along the way, and with
+// Options.Unordered nothing is held back for reordering either.
+package tracer
+
+import (
+	"fmt"
+	"io"
+	"io/ioutil"
+	"os"
+	"strings"
+	"time"
+
+	"github.com/iovisor/gobpf/elf"
+)
+
+// Options are the tunables of a Tracer. The zero value is usable.
+type Options struct {
+	// PerfPages is the size of each per-CPU perf ring in pages, a power of
+	// 2. 8 when 0.
+	PerfPages int
+	// ReorderWindow is how long perf samples are held to put them back in
+	// timestamp order
+	ReorderWindow time.Duration
+	// ReorderMax is the maximum number of perf samples held, 65536 when 0
+	ReorderMax int
+	// WakeupEvents and WakeupWatermark batch the wakeups of the perf
+	// rings, MaxLatency bounds how long samples wait because of it, ring
+	// buffers included, and Readers is the number of goroutines reading the rings of each map.
+	// See perfMapOptions.
+	WakeupEvents    int
+	WakeupWatermark int
+	MaxLatency      time.Duration
+	Readers         int
+	// Unordered delivers the perf samples as they are read, without
+	// reordering them. Sinks that do not need the order then skip their
+	// cost: holding the samples, copying them and merging the streams of
+	// the Readers.
+	Unordered bool
+
+	// BatchSize is the maximum number of samples handed to the Sink at
+	// once, 256 when 0
+	BatchSize int
+
+	// OmitComm sends the comm of a process with its first event only, the
+	// others are smaller in the rings and get it back from a cache of
+	// the comm of each pid before reaching the Sink.
+	OmitComm bool
+
+	// ConnectsockEntries is the size of the map of connects in flight,
+	// from the cpu and thread count when 0
+	ConnectsockEntries int
+
+	// DisableBTF guesses the struct offsets even when the kernel's BTF
+	// could tell them. OffsetCacheDir, if not empty, is where guessed
+	// offsets are cached per kernel. GuessObject, if not empty, is the
+	// object guessing a batch of offsets per connect,
+	// kernel/offset_guess_kern.o.
+	DisableBTF     bool
+	OffsetCacheDir string
+	GuessObject    string
+
+	// Log gets the progress messages, discarded when nil
+	Log io.Writer
+	// Phase, if not nil, is called at the start of each step of Load with
+	// its name. The function it returns is called at the end of the step.
+	Phase func(name string) func()
+}
+
+// Tracer is a loaded BPF object and the readers of its event maps.
+type Tracer struct {
+	module *elf.Module
+	opts   Options
+	log    io.Writer
+
+	pipeline *eventPipeline
+	sources  []eventSource
+	comm     *commCache
+}
+
+// Load loads the BPF object fileName, its maps resized to the system. The
+// kprobes are not enabled yet, the maps can be configured first.
+func Load(fileName string, opts Options) (*Tracer, error) {
+	if opts.PerfPages == 0 {
+		opts.PerfPages = 8
+	}
+	if opts.ReorderMax == 0 {
+		opts.ReorderMax = 65536
+	}
+	if opts.BatchSize == 0 {
+		opts.BatchSize = 256
+	}
+	t := &Tracer{opts: opts, log: opts.Log}
+	if t.log == nil {
+		t.log = ioutil.Discard
+	}
+
+	cpus, err := PossibleCPUs()
+	if err != nil {
+		return nil, fmt.Errorf("failed to get the number of possible cpus: %v", err)
+	}
+	connectEntries := opts.ConnectsockEntries
+	if connectEntries <= 0 {
+		connectEntries = connectsockSize(cpus)
+	}
+
+	endPhase := t.phase("resize")
+	loadFileName, resized, err := resizeMaps(fileName, func(name string, typ uint32) uint32 {
+		switch {
+		case typ == bpfMapTypePerfEventArray:
+			// perf event arrays need one slot per possible cpu, otherwise
+			// bpf_perf_event_output fails on the cpus beyond max_entries
+			return uint32(cpus)
+		case name == "connectsock":
+			return uint32(connectEntries)
+		}
+		return 0
+	})
+	if err != nil {
+		return nil, err
+	}
+	for _, r := range resized {
+		fmt.Fprintf(t.log, "%s: max_entries %d -> %d\n", r.Name, r.From, r.To)
+	}
+	endPhase()
+
+	endPhase = t.phase("load")
+	defer endPhase()
+	b := elf.NewModule(loadFileName)
+	if b == nil {
+		return nil, fmt.Errorf("System doesn't support BPF")
+	}
+
+	err = b.Load()
+	if loadFileName != fileName {
+		os.Remove(loadFileName)
+	}
+	if err != nil {
+		return nil, err
+	}
+	t.module = b
+	return t, nil
+}
+
+func (t *Tracer) phase(name string) func() {
+	if t.opts.Phase == nil {
+		return func() {}
+	}
+	return t.opts.Phase(name)
+}
+
+// Module returns the loaded object, for the maps this package knows
+// nothing about.
+func (t *Tracer) Module() *elf.Module {
+	return t.module
+}
+
+// SetSampling makes the kernel program keep one event in sampleEvery and
+// at most flowRate events per second and flow, see setSampling.
+func (t *Tracer) SetSampling(sampleEvery int, flowRate float64, flowBurst int) error {
+	return setSampling(t.module, sampleEvery, flowRate, flowBurst)
+}
+
+// SetFilters replaces the in-kernel filters with rules. It can be called
+// at any time.
+func (t *Tracer) SetFilters(rules FilterRules) error {
+	return applyFilterRules(t.module, rules)
+}
+
+// EnableKprobes enables all kprobes of the object. The ones failing are
+// reported together, the others are enabled anyway.
+func (t *Tracer) EnableKprobes() error {
+	var failed []string
+	for p := range t.module.IterKprobes() {
+		if err := t.module.EnableKprobe(p.Name); err != nil {
+			failed = append(failed, fmt.Sprintf("%s: %v", p.Name, err))
+		}
+	}
+	if len(failed) > 0 {
+		return fmt.Errorf("failed to enable kprobes: %s", strings.Join(failed, ", "))
+	}
+	return nil
+}
+
+// ResolveOffsets sets the struct sock offsets the kprobes need, if the
+// object does not know them already. The kprobes must be enabled, the
+// offsets may have to be guessed from what they see. The event sources
+// may run meanwhile, no event is sent before the offsets are set.
+func (t *Tracer) ResolveOffsets() error {
+	return resolveOffsets(t.module, !t.opts.DisableBTF, t.opts.OffsetCacheDir, t.opts.GuessObject, t.log)
+}
+
+// Start opens the event maps of the object and starts delivering their
+// samples to sink. Objects aggregating in the kernel may have no event
+// maps, Start does nothing for them.
+func (t *Tracer) Start(sink Sink) error {
+	perfOpts := perfMapOptions{
+		PageCount:       t.opts.PerfPages,
+		ReorderWindow:   t.opts.ReorderWindow,
+		ReorderMax:      t.opts.ReorderMax,
+		WakeupEvents:    t.opts.WakeupEvents,
+		WakeupWatermark: t.opts.WakeupWatermark,
+		MaxLatency:      t.opts.MaxLatency,
+		Readers:         t.opts.Readers,
+		Unordered:       t.opts.Unordered,
+	}
+
+	if t.opts.OmitComm {
+		if err := setOmitComm(t.module, true); err != nil {
+			return err
+		}
+		t.comm = newCommCache(t.module, sink)
+		sink = t.comm
+	}
+
+	t.pipeline = newEventPipeline(t.opts.BatchSize, sink)
+	aggregating := t.module.Map("tcp_flows") != nil
+	for f, mapName := range familyMaps {
+		if aggregating && t.module.Map(mapName) == nil {
+			continue
+		}
+		src, err := initEventSource(t.module, mapName, t.pipeline.sampleSink(Family(f)), perfOpts, t.log)
+		if err != nil {
+			// none of the sources polls yet, Stop has nothing to do
+			for _, src := range t.sources {
+				src.close()
+			}
+			t.sources = nil
+			t.pipeline = nil
+			if t.comm != nil {
+				setOmitComm(t.module, false)
+				t.comm = nil
+			}
+			return err
+		}
+		t.sources = append(t.sources, src)
+	}
+
+	t.pipeline.Start()
+	for _, src := range t.sources {
+		src.PollStart()
+	}
+	return nil
+}
+
+// Stop stops reading the event maps once the sink got the samples read so
+// far.
+func (t *Tracer) Stop() {
+	for _, src := range t.sources {
+		src.PollStop()
+	}
+	if t.pipeline != nil {
+		t.pipeline.Stop()
+	}
+}
+
+// Stats returns the counters of each event map read.
+func (t *Tracer) Stats() []SourceStats {
+	stats := make([]SourceStats, len(t.sources))
+	for i, src := range t.sources {
+		stats[i] = src.Stats()
+	}
+	return stats
+}
+
+// Backlog returns the number of samples read and not handed to the sink
+// yet.
+func (t *Tracer) Backlog() int {
+	if t.pipeline == nil {
+		return 0
+	}
+	return t.pipeline.Backlog()
+}
+
+// CommStats formats the counters of the comm cache, empty without
+// Options.OmitComm.
+func (t *Tracer) CommStats() string {
+	if t.comm == nil {
+		return ""
+	}
+	return t.comm.String()
+}
+
+// Counters formats the probe counters of the object, if it has them.
+func (t *Tracer) Counters() (string, error) {
+	return probeCounters(t.module)
+}